@@ -0,0 +1,669 @@
+/*
+ * @file BlockCompression.h
+ * @brief テクスチャをGPUの圧縮形式(BC1/BC3/BC7)にエンコード・デコードする
+ * @detail 4x4画素のブロックごとに2つの端点の色とその間を補間するインデックスで表す
+ *             BC1: RGB (1bitのアルファ) 8バイト/ブロック (RGBA8の1/8)
+ *             BC3: RGBA (アルファは別の端点とインデックス) 16バイト/ブロック (1/4)
+ *             BC7: RGBA 16バイト/ブロック (エンコードはモード6のみ, 端点7bit+pビット, インデックス4bit)
+ *         速いモードは端点を色の範囲の対角(SSE2で最小・最大を求める)から選び、品質モードは主成分の方向から選んで
+ *         最小二乗法で端点を合わせ直す デコーダはエンコードの確認と、圧縮形式に対応しない環境での代替に使う
+ *         OpenGLは呼び出さない
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <GL/glew.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCK_COMPRESSION_SSE2 1
+#endif
+
+// S3TC の形式 (GL_EXT_texture_compression_s3tc, GL_EXT_texture_sRGB)
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// ブロック圧縮
+class BlockCompression {
+public:
+    // 圧縮形式
+    enum Format {
+        bc1 = 1,
+        bc3 = 2,
+        bc7 = 3
+    };
+
+    // 1ブロックのバイト数
+    static std::size_t blockBytes(Format format) { return format == bc1 ? 8 : 16; }
+
+    // 圧縮した画像のバイト数
+    static std::size_t compressedSize(Format format, GLsizei width, GLsizei height) {
+        return static_cast<std::size_t>((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+    }
+
+    // テクスチャの形式
+    static GLenum internalFormat(Format format, bool srgb) {
+        switch (format) {
+            case bc1: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+            case bc3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            default: return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+        }
+    }
+
+private:
+    // 浮動小数点数の画素 (RGBA)
+    typedef float Pixel[4];
+
+    // BC7 の4bitインデックスの重み (/64)
+    static const int *bc7Weights() {
+        static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+        return weights;
+    }
+
+    // 画像から4x4画素のブロックを取り出す (画像の外は端の画素で埋める)
+    static void fetch(const GLubyte *rgba, GLsizei width, GLsizei height, GLsizei bx, GLsizei by, GLubyte block[64]) {
+        for (int y = 0; y < 4; ++y) {
+            const GLsizei sy(std::min(by * 4 + y, height - 1));
+            for (int x = 0; x < 4; ++x) {
+                const GLsizei sx(std::min(bx * 4 + x, width - 1));
+                std::memcpy(block + (y * 4 + x) * 4, rgba + (static_cast<std::size_t>(sy) * width + sx) * 4, 4);
+            }
+        }
+    }
+
+    // ブロックの各チャンネルの最小値・最大値
+    static void boundingBox(const GLubyte block[64], GLubyte lo[4], GLubyte hi[4]) {
+#if defined(BLOCK_COMPRESSION_SSE2)
+        // 4画素ずつ最小・最大を取ってから4画素の間で比べる
+        __m128i mn(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block)));
+        __m128i mx(mn);
+        for (int i = 1; i < 4; ++i) {
+            const __m128i v(_mm_loadu_si128(reinterpret_cast<const __m128i *>(block + i * 16)));
+            mn = _mm_min_epu8(mn, v);
+            mx = _mm_max_epu8(mx, v);
+        }
+        mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(1, 0, 3, 2)));
+        mn = _mm_min_epu8(mn, _mm_shuffle_epi32(mn, _MM_SHUFFLE(2, 3, 0, 1)));
+        mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(1, 0, 3, 2)));
+        mx = _mm_max_epu8(mx, _mm_shuffle_epi32(mx, _MM_SHUFFLE(2, 3, 0, 1)));
+        const std::uint32_t l(static_cast<std::uint32_t>(_mm_cvtsi128_si32(mn)));
+        const std::uint32_t h(static_cast<std::uint32_t>(_mm_cvtsi128_si32(mx)));
+        std::memcpy(lo, &l, 4);
+        std::memcpy(hi, &h, 4);
+#else
+        for (int c = 0; c < 4; ++c) {
+            lo[c] = hi[c] = block[c];
+            for (int i = 1; i < 16; ++i) {
+                lo[c] = std::min(lo[c], block[i * 4 + c]);
+                hi[c] = std::max(hi[c], block[i * 4 + c]);
+            }
+        }
+#endif
+    }
+
+    // 対角の端点を選ぶ (範囲を少し内側に寄せ、緑と逆に変化するチャンネルは入れ替える)
+    template <int N>
+    static void diagonal(const Pixel *pixel, int count, const GLubyte lo8[4], const GLubyte hi8[4], float lo[4], float hi[4]) {
+        float center[4];
+        for (int c = 0; c < N; ++c) {
+            const float inset((hi8[c] - lo8[c]) / 16.0f);
+            lo[c] = lo8[c] + inset;
+            hi[c] = hi8[c] - inset;
+            center[c] = (lo8[c] + hi8[c]) * 0.5f;
+        }
+        for (int c = 0; c < N; ++c) {
+            if (c == 1) continue;
+            float covariance(0.0f);
+            for (int i = 0; i < count; ++i) covariance += (pixel[i][c] - center[c]) * (pixel[i][1] - center[1]);
+            if (covariance < 0.0f) std::swap(lo[c], hi[c]);
+        }
+    }
+
+    // 主成分の方向に沿って端点を選ぶ
+    template <int N>
+    static void principal(const Pixel *pixel, int count, float lo[4], float hi[4]) {
+        float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < count; ++i)
+            for (int c = 0; c < N; ++c) mean[c] += pixel[i][c] / count;
+        float covariance[4][4] = {};
+        for (int i = 0; i < count; ++i)
+            for (int a = 0; a < N; ++a)
+                for (int b = 0; b < N; ++b) covariance[a][b] += (pixel[i][a] - mean[a]) * (pixel[i][b] - mean[b]);
+
+        // べき乗法で一番大きな固有ベクトルを求める
+        float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 8; ++iteration) {
+            float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, length(0.0f);
+            for (int a = 0; a < N; ++a) {
+                for (int b = 0; b < N; ++b) next[a] += covariance[a][b] * axis[b];
+                length = std::max(length, std::fabs(next[a]));
+            }
+            if (length == 0.0f) break;
+            for (int a = 0; a < N; ++a) axis[a] = next[a] / length;
+        }
+
+        float tmin(0.0f), tmax(0.0f), norm(0.0f);
+        for (int c = 0; c < N; ++c) norm += axis[c] * axis[c];
+        if (norm == 0.0f) norm = 1.0f;
+        for (int i = 0; i < count; ++i) {
+            float t(0.0f);
+            for (int c = 0; c < N; ++c) t += (pixel[i][c] - mean[c]) * axis[c];
+            t /= norm;
+            if (i == 0 || t < tmin) tmin = t;
+            if (i == 0 || t > tmax) tmax = t;
+        }
+        for (int c = 0; c < N; ++c) {
+            lo[c] = std::min(std::max(mean[c] + axis[c] * tmin, 0.0f), 255.0f);
+            hi[c] = std::min(std::max(mean[c] + axis[c] * tmax, 0.0f), 255.0f);
+        }
+    }
+
+    // 各画素の補間の重みから最小二乗法で端点を合わせ直す
+    template <int N>
+    static bool leastSquares(const Pixel *pixel, const float *t, int count, float lo[4], float hi[4]) {
+        float aa(0.0f), ab(0.0f), bb(0.0f), ax[4] = {}, bx[4] = {};
+        for (int i = 0; i < count; ++i) {
+            const float a(1.0f - t[i]), b(t[i]);
+            aa += a * a;
+            ab += a * b;
+            bb += b * b;
+            for (int c = 0; c < N; ++c) {
+                ax[c] += a * pixel[i][c];
+                bx[c] += b * pixel[i][c];
+            }
+        }
+        const float determinant(aa * bb - ab * ab);
+        if (std::fabs(determinant) < 1e-6f) return false;
+        for (int c = 0; c < N; ++c) {
+            lo[c] = std::min(std::max((bb * ax[c] - ab * bx[c]) / determinant, 0.0f), 255.0f);
+            hi[c] = std::min(std::max((aa * bx[c] - ab * ax[c]) / determinant, 0.0f), 255.0f);
+        }
+        return true;
+    }
+
+    // RGB565 に変換する
+    static std::uint16_t to565(const float color[4]) {
+        const int r(static_cast<int>(std::lround(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f)));
+        const int g(static_cast<int>(std::lround(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f)));
+        const int b(static_cast<int>(std::lround(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f)));
+        return static_cast<std::uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    // RGB565 を8bitに戻す
+    static void from565(std::uint16_t c, int rgb[3]) {
+        const int r((c >> 11) & 31), g((c >> 5) & 63), b(c & 31);
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    // BC1 の色の表を作る (4色のときは c0 > c1, 3色と透明のときは c0 <= c1)
+    static void bc1Palette(std::uint16_t c0, std::uint16_t c1, bool four, int palette[4][4]) {
+        from565(c0, palette[0]);
+        from565(c1, palette[1]);
+        for (int c = 0; c < 3; ++c) {
+            if (four) {
+                palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+            }
+            else {
+                palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                palette[3][c] = 0;
+            }
+        }
+        palette[0][3] = palette[1][3] = palette[2][3] = 255;
+        palette[3][3] = four ? 255 : 0;
+    }
+
+    /*
+     * @fn
+     * 端点から BC1 の色のブロックを作る
+     * @param block ブロックの画素 RGBA
+     * @param transparent 透明にする画素 (nullptrなら4色のモード)
+     * @param lo 端点
+     * @param hi 端点
+     * @param out 出力 (8バイト)
+     * @param weight 各画素の補間の重み (最小二乗法に使う, 透明の画素は-1)
+     * @return 誤差の二乗和
+     */
+    static long long bc1Solve(const GLubyte block[64], const bool *transparent, const float lo[4], const float hi[4],
+                              GLubyte out[8], float weight[16]) {
+        std::uint16_t c0(to565(hi)), c1(to565(lo));
+        const bool four(transparent == nullptr);
+        const bool swapped(four ? c0 < c1 : c0 > c1);
+        if (swapped) std::swap(c0, c1);
+        int palette[4][4];
+        bc1Palette(c0, c1, four && c0 != c1, palette);
+
+        // 4色のモードで2つの端点が同じになったらすべて0番にする
+        const int choices(four ? (c0 != c1 ? 4 : 1) : 3);
+        // インデックスごとの c0 から c1 への補間の割合
+        static const float fourWeight[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+        static const float threeWeight[3] = { 0.0f, 1.0f, 0.5f };
+        std::uint32_t indices(0);
+        long long error(0);
+        for (int i = 0; i < 16; ++i) {
+            int best(0);
+            if (transparent != nullptr && transparent[i]) {
+                best = 3;
+                weight[i] = -1.0f;
+            }
+            else {
+                int bestError(INT32_MAX);
+                for (int k = 0; k < choices; ++k) {
+                    int e(0);
+                    for (int c = 0; c < 3; ++c) {
+                        const int d(block[i * 4 + c] - palette[k][c]);
+                        e += d * d;
+                    }
+                    if (e < bestError) {
+                        bestError = e;
+                        best = k;
+                    }
+                }
+                error += bestError;
+                // lo から hi への割合に直す (入れ替えていなければ c0 が hi)
+                const float toC1(four ? fourWeight[best] : threeWeight[best]);
+                weight[i] = swapped ? toC1 : 1.0f - toC1;
+            }
+            indices |= static_cast<std::uint32_t>(best) << (i * 2);
+        }
+
+        out[0] = static_cast<GLubyte>(c0 & 0xff);
+        out[1] = static_cast<GLubyte>(c0 >> 8);
+        out[2] = static_cast<GLubyte>(c1 & 0xff);
+        out[3] = static_cast<GLubyte>(c1 >> 8);
+        for (int k = 0; k < 4; ++k) out[4 + k] = static_cast<GLubyte>(indices >> (k * 8));
+        return error;
+    }
+
+    // BC1 の色のブロックをエンコードする (BC3 では punch を false にする)
+    static void encodeColor(const GLubyte block[64], GLubyte out[8], bool quality, bool punch) {
+        // 透明の画素を除いて端点を選ぶ
+        bool transparent[16];
+        bool any(false);
+        Pixel pixel[16];
+        int count(0);
+        for (int i = 0; i < 16; ++i) {
+            transparent[i] = punch && block[i * 4 + 3] < 128;
+            any = any || transparent[i];
+            if (transparent[i]) continue;
+            for (int c = 0; c < 4; ++c) pixel[count][c] = block[i * 4 + c];
+            ++count;
+        }
+        const bool *const mask(any ? transparent : nullptr);
+        if (count == 0) {
+            // すべて透明
+            static const float black[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            float weight[16];
+            bc1Solve(block, transparent, black, black, out, weight);
+            return;
+        }
+
+        GLubyte lo8[4] = { 255, 255, 255, 255 }, hi8[4] = { 0, 0, 0, 0 };
+        if (!any) {
+            boundingBox(block, lo8, hi8);
+        }
+        else {
+            for (int i = 0; i < count; ++i)
+                for (int c = 0; c < 4; ++c) {
+                    lo8[c] = std::min(lo8[c], static_cast<GLubyte>(pixel[i][c]));
+                    hi8[c] = std::max(hi8[c], static_cast<GLubyte>(pixel[i][c]));
+                }
+        }
+        float lo[4], hi[4], weight[16];
+        diagonal<3>(pixel, count, lo8, hi8, lo, hi);
+        long long best(bc1Solve(block, mask, lo, hi, out, weight));
+        if (!quality || best == 0) return;
+
+        // 主成分の方向から選んで、最小二乗法で合わせ直す
+        GLubyte candidate[8];
+        principal<3>(pixel, count, lo, hi);
+        for (int iteration = 0; iteration < 3; ++iteration) {
+            const long long error(bc1Solve(block, mask, lo, hi, candidate, weight));
+            if (error < best) {
+                best = error;
+                std::memcpy(out, candidate, 8);
+            }
+            float t[16];
+            int n(0);
+            for (int i = 0; i < 16; ++i)
+                if (weight[i] >= 0.0f) t[n++] = weight[i];
+            if (!leastSquares<3>(pixel, t, count, lo, hi)) break;
+        }
+    }
+
+    // アルファのブロック (BC3 のアルファ, BC4 と同じ) の端点からインデックスを選ぶ
+    static long long alphaSolve(const GLubyte block[64], int a0, int a1, GLubyte out[8]) {
+        int palette[8] = { a0, a1 };
+        if (a0 > a1) {
+            for (int k = 1; k < 7; ++k) palette[k + 1] = ((7 - k) * a0 + k * a1) / 7;
+        }
+        else {
+            for (int k = 1; k < 5; ++k) palette[k + 1] = ((5 - k) * a0 + k * a1) / 5;
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+
+        std::uint64_t indices(0);
+        long long error(0);
+        for (int i = 0; i < 16; ++i) {
+            const int a(block[i * 4 + 3]);
+            int best(0), bestError(INT32_MAX);
+            for (int k = 0; k < 8; ++k) {
+                const int e((a - palette[k]) * (a - palette[k]));
+                if (e < bestError) {
+                    bestError = e;
+                    best = k;
+                }
+            }
+            error += bestError;
+            indices |= static_cast<std::uint64_t>(best) << (i * 3);
+        }
+        out[0] = static_cast<GLubyte>(a0);
+        out[1] = static_cast<GLubyte>(a1);
+        for (int k = 0; k < 6; ++k) out[2 + k] = static_cast<GLubyte>(indices >> (k * 8));
+        return error;
+    }
+
+    // アルファのブロックをエンコードする
+    static void encodeAlpha(const GLubyte block[64], GLubyte out[8], bool quality) {
+        int lo(255), hi(0), innerLo(255), innerHi(0);
+        for (int i = 0; i < 16; ++i) {
+            const int a(block[i * 4 + 3]);
+            lo = std::min(lo, a);
+            hi = std::max(hi, a);
+            if (a != 0 && a != 255) {
+                innerLo = std::min(innerLo, a);
+                innerHi = std::max(innerHi, a);
+            }
+        }
+        const long long error(alphaSolve(block, hi, lo, out));
+        if (!quality || error == 0) return;
+
+        // 0と255を表に持つ6段階のモードも試す
+        if (innerLo > innerHi) innerLo = innerHi = lo;
+        GLubyte candidate[8];
+        if (alphaSolve(block, innerLo, innerHi, candidate) < error) std::memcpy(out, candidate, 8);
+    }
+
+    // ビット列に書き込む
+    static void putBits(GLubyte *out, int &position, int count, std::uint32_t value) {
+        for (int i = 0; i < count; ++i, ++position)
+            if (value & (1u << i)) out[position >> 3] |= static_cast<GLubyte>(1u << (position & 7));
+    }
+
+    // ビット列から読み込む
+    static std::uint32_t getBits(const GLubyte *in, int &position, int count) {
+        std::uint32_t value(0);
+        for (int i = 0; i < count; ++i, ++position)
+            if (in[position >> 3] & (1u << (position & 7))) value |= 1u << i;
+        return value;
+    }
+
+    /*
+     * @fn
+     * 端点から BC7 モード6のブロックを作る
+     * @param block ブロックの画素 RGBA
+     * @param lo 端点
+     * @param hi 端点
+     * @param out 出力 (16バイト)
+     * @param weight 各画素の補間の重み (最小二乗法に使う)
+     * @return 誤差の二乗和
+     */
+    static long long bc7Solve(const GLubyte block[64], const float lo[4], const float hi[4], GLubyte out[16], float weight[16]) {
+        const int *const w(bc7Weights());
+        long long best(-1);
+        int bestEndpoint[2][4] = {}, bestP[2] = { 0, 0 }, bestIndex[16] = {};
+
+        // pビットの4通りを試す
+        for (int p = 0; p < 4; ++p) {
+            const int p0(p & 1), p1(p >> 1);
+            int e[2][4];
+            for (int c = 0; c < 4; ++c) {
+                e[0][c] = std::min(std::max(static_cast<int>(std::lround((lo[c] - p0) / 2.0f)), 0), 127);
+                e[1][c] = std::min(std::max(static_cast<int>(std::lround((hi[c] - p1) / 2.0f)), 0), 127);
+            }
+            int palette[16][4];
+            for (int c = 0; c < 4; ++c) {
+                const int a((e[0][c] << 1) | p0), b((e[1][c] << 1) | p1);
+                for (int k = 0; k < 16; ++k) palette[k][c] = ((64 - w[k]) * a + w[k] * b + 32) >> 6;
+            }
+            long long error(0);
+            int index[16];
+            for (int i = 0; i < 16; ++i) {
+                int bestK(0), bestError(INT32_MAX);
+                for (int k = 0; k < 16; ++k) {
+                    int d(0);
+                    for (int c = 0; c < 4; ++c) {
+                        const int v(block[i * 4 + c] - palette[k][c]);
+                        d += v * v;
+                    }
+                    if (d < bestError) {
+                        bestError = d;
+                        bestK = k;
+                    }
+                }
+                index[i] = bestK;
+                error += bestError;
+            }
+            if (best < 0 || error < best) {
+                best = error;
+                std::memcpy(bestEndpoint, e, sizeof e);
+                bestP[0] = p0;
+                bestP[1] = p1;
+                std::memcpy(bestIndex, index, sizeof index);
+            }
+        }
+        for (int i = 0; i < 16; ++i) weight[i] = w[bestIndex[i]] / 64.0f;
+
+        // 最初の画素のインデックスの最上位ビットは0と決まっているので、1なら端点を入れ替える
+        if (bestIndex[0] >= 8) {
+            for (int c = 0; c < 4; ++c) std::swap(bestEndpoint[0][c], bestEndpoint[1][c]);
+            std::swap(bestP[0], bestP[1]);
+            for (int i = 0; i < 16; ++i) bestIndex[i] = 15 - bestIndex[i];
+        }
+
+        std::memset(out, 0, 16);
+        int position(0);
+        putBits(out, position, 7, 1u << 6);
+        for (int c = 0; c < 4; ++c) {
+            putBits(out, position, 7, static_cast<std::uint32_t>(bestEndpoint[0][c]));
+            putBits(out, position, 7, static_cast<std::uint32_t>(bestEndpoint[1][c]));
+        }
+        putBits(out, position, 1, static_cast<std::uint32_t>(bestP[0]));
+        putBits(out, position, 1, static_cast<std::uint32_t>(bestP[1]));
+        for (int i = 0; i < 16; ++i) putBits(out, position, i == 0 ? 3 : 4, static_cast<std::uint32_t>(bestIndex[i]));
+        return best;
+    }
+
+    // BC7 のブロックをエンコードする
+    static void encodeBC7(const GLubyte block[64], GLubyte out[16], bool quality) {
+        Pixel pixel[16];
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 4; ++c) pixel[i][c] = block[i * 4 + c];
+
+        GLubyte lo8[4], hi8[4];
+        boundingBox(block, lo8, hi8);
+        float lo[4], hi[4], weight[16];
+        diagonal<4>(pixel, 16, lo8, hi8, lo, hi);
+        long long best(bc7Solve(block, lo, hi, out, weight));
+        if (!quality || best == 0) return;
+
+        GLubyte candidate[16];
+        principal<4>(pixel, 16, lo, hi);
+        for (int iteration = 0; iteration < 3; ++iteration) {
+            const long long error(bc7Solve(block, lo, hi, candidate, weight));
+            if (error < best) {
+                best = error;
+                std::memcpy(out, candidate, 16);
+            }
+            if (!leastSquares<4>(pixel, weight, 16, lo, hi)) break;
+        }
+    }
+
+    // BC1 の色のブロックをデコードする
+    static void decodeColor(const GLubyte *in, bool alwaysFour, GLubyte block[64]) {
+        const std::uint16_t c0(static_cast<std::uint16_t>(in[0] | (in[1] << 8)));
+        const std::uint16_t c1(static_cast<std::uint16_t>(in[2] | (in[3] << 8)));
+        int palette[4][4];
+        bc1Palette(c0, c1, alwaysFour || c0 > c1, palette);
+        const std::uint32_t indices(in[4] | (in[5] << 8) | (in[6] << 16) | (static_cast<std::uint32_t>(in[7]) << 24));
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < 4; ++c) block[i * 4 + c] = static_cast<GLubyte>(palette[(indices >> (i * 2)) & 3][c]);
+    }
+
+    // アルファのブロックをデコードする
+    static void decodeAlpha(const GLubyte *in, GLubyte block[64]) {
+        const int a0(in[0]), a1(in[1]);
+        int palette[8] = { a0, a1 };
+        if (a0 > a1) {
+            for (int k = 1; k < 7; ++k) palette[k + 1] = ((7 - k) * a0 + k * a1) / 7;
+        }
+        else {
+            for (int k = 1; k < 5; ++k) palette[k + 1] = ((5 - k) * a0 + k * a1) / 5;
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+        std::uint64_t indices(0);
+        for (int k = 0; k < 6; ++k) indices |= static_cast<std::uint64_t>(in[2 + k]) << (k * 8);
+        for (int i = 0; i < 16; ++i) block[i * 4 + 3] = static_cast<GLubyte>(palette[(indices >> (i * 3)) & 7]);
+    }
+
+    // BC7 のブロックをデコードする (モード6以外はマゼンタにして false を返す)
+    static bool decodeBC7(const GLubyte *in, GLubyte block[64]) {
+        int position(0);
+        if (getBits(in, position, 7) != (1u << 6)) {
+            for (int i = 0; i < 16; ++i) {
+                block[i * 4] = block[i * 4 + 2] = block[i * 4 + 3] = 255;
+                block[i * 4 + 1] = 0;
+            }
+            return false;
+        }
+        int e[2][4];
+        for (int c = 0; c < 4; ++c) {
+            e[0][c] = static_cast<int>(getBits(in, position, 7));
+            e[1][c] = static_cast<int>(getBits(in, position, 7));
+        }
+        const int p0(static_cast<int>(getBits(in, position, 1))), p1(static_cast<int>(getBits(in, position, 1)));
+        const int *const w(bc7Weights());
+        for (int i = 0; i < 16; ++i) {
+            const int k(static_cast<int>(getBits(in, position, i == 0 ? 3 : 4)));
+            for (int c = 0; c < 4; ++c) {
+                const int a((e[0][c] << 1) | p0), b((e[1][c] << 1) | p1);
+                block[i * 4 + c] = static_cast<GLubyte>(((64 - w[k]) * a + w[k] * b + 32) >> 6);
+            }
+        }
+        return true;
+    }
+
+    // ブロックの行の範囲をエンコードする
+    static void encodeRows(Format format, const GLubyte *rgba, GLsizei width, GLsizei height, bool quality,
+                           GLsizei first, GLsizei last, GLubyte *out) {
+        const GLsizei columns((width + 3) / 4);
+        const std::size_t bytes(blockBytes(format));
+        GLubyte block[64];
+        for (GLsizei by = first; by < last; ++by) {
+            for (GLsizei bx = 0; bx < columns; ++bx) {
+                fetch(rgba, width, height, bx, by, block);
+                GLubyte *const dst(out + (static_cast<std::size_t>(by) * columns + bx) * bytes);
+                switch (format) {
+                    case bc1:
+                        encodeColor(block, dst, quality, true);
+                        break;
+                    case bc3:
+                        encodeAlpha(block, dst, quality);
+                        encodeColor(block, dst + 8, quality, false);
+                        break;
+                    default:
+                        encodeBC7(block, dst, quality);
+                        break;
+                }
+            }
+        }
+    }
+
+public:
+    /*
+     * @fn
+     * 画像をエンコードする
+     * @param format 圧縮形式
+     * @param rgba 画素 RGBA
+     * @param width 画像の幅
+     * @param height 画像の高さ
+     * @param quality 品質モード (主成分と最小二乗法で端点を選ぶ, 遅い)
+     * @param threads スレッドの数 (0ならコアの数)
+     * @return ブロックを左上から行ごとに並べたもの (空の画像なら空)
+     */
+    static std::vector<GLubyte> encode(Format format, const GLubyte *rgba, GLsizei width, GLsizei height,
+                                       bool quality = false, unsigned int threads = 0) {
+        if (width <= 0 || height <= 0) return std::vector<GLubyte>();
+        std::vector<GLubyte> out(compressedSize(format, width, height));
+        const GLsizei rows((height + 3) / 4);
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = std::min<unsigned int>(threads, static_cast<unsigned int>(rows));
+
+        // ブロックの行を分けて並べてエンコードする
+        std::vector<std::thread> workers;
+        for (unsigned int t = 1; t < threads; ++t)
+            workers.emplace_back(encodeRows, format, rgba, width, height, quality,
+                                 rows * t / threads, rows * (t + 1) / threads, out.data());
+        encodeRows(format, rgba, width, height, quality, 0, rows / threads, out.data());
+        for (auto &worker : workers) worker.join();
+        return out;
+    }
+
+    /*
+     * @fn
+     * 画像をデコードする
+     * @param format 圧縮形式
+     * @param blocks ブロック
+     * @param width 画像の幅
+     * @param height 画像の高さ
+     * @param rgba 画素 RGBA (width * height * 4 バイト)
+     * @return すべてのブロックをデコードできたら true (BC7 はモード6だけ)
+     */
+    static bool decode(Format format, const GLubyte *blocks, GLsizei width, GLsizei height, GLubyte *rgba) {
+        const GLsizei columns((width + 3) / 4), rows((height + 3) / 4);
+        const std::size_t bytes(blockBytes(format));
+        bool complete(true);
+        GLubyte block[64];
+        for (GLsizei by = 0; by < rows; ++by) {
+            for (GLsizei bx = 0; bx < columns; ++bx) {
+                const GLubyte *const in(blocks + (static_cast<std::size_t>(by) * columns + bx) * bytes);
+                switch (format) {
+                    case bc1:
+                        decodeColor(in, false, block);
+                        break;
+                    case bc3:
+                        decodeColor(in + 8, true, block);
+                        decodeAlpha(in, block);
+                        break;
+                    default:
+                        complete = decodeBC7(in, block) && complete;
+                        break;
+                }
+                for (int y = 0; y < 4 && by * 4 + y < height; ++y)
+                    for (int x = 0; x < 4 && bx * 4 + x < width; ++x)
+                        std::memcpy(rgba + (static_cast<std::size_t>(by * 4 + y) * width + bx * 4 + x) * 4, block + (y * 4 + x) * 4, 4);
+            }
+        }
+        return complete;
+    }
+};
@@ -0,0 +1,345 @@
+/*
+ * @file BufferHeap.h
+ * @brief 多数の図形の頂点とインデックスを少数の大きなバッファオブジェクトにまとめて置くクラス
+ * @detail 図形ごとにバッファオブジェクトを作らず、大きなバッファ(ページ)の中の領域を空きリストで割り当てる
+ *         描画はページの頂点配列オブジェクトを結合して、領域の位置を base vertex と最初のインデックスで指定する
+ *         頂点の形式ごとにヒープを作るので、頂点配列オブジェクトは形式ごと(ページごと)に1つで済む
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <vector>
+
+// 図形データ
+#include "Object.h"
+
+// 空きリストによる領域の割り当て
+class FreeList {
+    // 管理する領域の大きさ
+    const GLsizeiptr capacity;
+
+    // 空き領域 (先頭の位置 → 大きさ)
+    std::map<GLsizeiptr, GLsizeiptr> by_offset;
+
+    // 空き領域 (大きさ → 先頭の位置)
+    std::multimap<GLsizeiptr, GLsizeiptr> by_size;
+
+    // 使用中の大きさ
+    GLsizeiptr used;
+
+    // 空き領域を登録する
+    void insert(GLsizeiptr offset, GLsizeiptr size) {
+        by_offset.emplace(offset, size);
+        by_size.emplace(size, offset);
+    }
+
+    // 空き領域の登録を取り消す
+    void erase(std::map<GLsizeiptr, GLsizeiptr>::iterator block) {
+        auto range(by_size.equal_range(block->second));
+        for (auto i = range.first; i != range.second; ++i) {
+            if (i->second == block->first) {
+                by_size.erase(i);
+                break;
+            }
+        }
+        by_offset.erase(block);
+    }
+
+public:
+    // 割り当てに失敗したときの位置
+    static constexpr GLsizeiptr invalid = -1;
+
+    // コンストラクタ
+    explicit FreeList(GLsizeiptr capacity)
+    : capacity(capacity), used(0) {
+        insert(0, capacity);
+    }
+
+    /*
+     * @fn
+     * 領域を割り当てる
+     * @param size 大きさ
+     * @param alignment 先頭の位置をそろえる単位
+     * @return 先頭の位置 (割り当てられなければinvalid)
+     * @detail 収まる中で最も小さい空き領域から切り出す (best fit)
+     */
+    GLsizeiptr allocate(GLsizeiptr size, GLsizeiptr alignment = 1) {
+        if (size <= 0) return invalid;
+        for (auto i = by_size.lower_bound(size); i != by_size.end(); ++i) {
+            const GLsizeiptr offset(i->second), length(i->first);
+            const GLsizeiptr aligned((offset + alignment - 1) / alignment * alignment);
+            if (aligned + size > offset + length) continue;
+
+            // 空き領域を取り除いて前後の余りを戻す
+            erase(by_offset.find(offset));
+            if (aligned > offset) insert(offset, aligned - offset);
+            if (aligned + size < offset + length) insert(aligned + size, offset + length - aligned - size);
+            used += size;
+            return aligned;
+        }
+        return invalid;
+    }
+
+    /*
+     * @fn
+     * 領域を解放する
+     * @param offset allocate()が返した先頭の位置
+     * @param size allocate()に渡した大きさ
+     * @detail 隣り合う空き領域とつなげる
+     */
+    void free(GLsizeiptr offset, GLsizeiptr size) {
+        used -= size;
+
+        // 後ろの空き領域とつなげる
+        auto next(by_offset.lower_bound(offset));
+        if (next != by_offset.end() && next->first == offset + size) {
+            size += next->second;
+            auto erased(next++);
+            erase(erased);
+        }
+
+        // 前の空き領域とつなげる
+        if (next != by_offset.begin()) {
+            auto previous(std::prev(next));
+            if (previous->first + previous->second == offset) {
+                offset = previous->first;
+                size += previous->second;
+                erase(previous);
+            }
+        }
+
+        insert(offset, size);
+    }
+
+    // 管理する領域の大きさ
+    GLsizeiptr getCapacity() const { return capacity; }
+
+    // 使用中の大きさ
+    GLsizeiptr getUsed() const { return used; }
+
+    // 最も大きい空き領域の大きさ
+    GLsizeiptr getLargestFree() const { return by_size.empty() ? 0 : by_size.rbegin()->first; }
+
+    // 空き領域の数
+    std::size_t getFreeBlocks() const { return by_offset.size(); }
+
+    // 断片化の度合い (0: 空き領域が1つにまとまっている 〜 1: 細かく分かれている)
+    double getFragmentation() const {
+        const GLsizeiptr available(capacity - used);
+        return available > 0 ? 1.0 - static_cast<double>(getLargestFree()) / available : 0.0;
+    }
+};
+
+// 頂点の形式Vの図形データを置くヒープ
+template <typename V>
+class BufferHeap {
+    // コピーコンストラクタによるコピー禁止
+    BufferHeap(const BufferHeap &h);
+
+    // 代入によるコピー禁止
+    BufferHeap &operator=(const BufferHeap &h);
+
+    // 大きなバッファオブジェクトの組
+    struct Page {
+        // 頂点配列オブジェクト・頂点バッファオブジェクト・インデックスのバッファオブジェクト
+        GLuint vao, vbo, ebo;
+
+        // 頂点とインデックスの領域の割り当て
+        FreeList vertices, indices;
+
+        Page(GLint size, GLsizeiptr vertex_bytes, GLsizeiptr index_bytes)
+        : vertices(vertex_bytes), indices(index_bytes) {
+            glGenVertexArrays(1, &vao);
+            glBindVertexArray(vao);
+
+            glGenBuffers(1, &vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, vbo);
+            glBufferData(GL_ARRAY_BUFFER, vertex_bytes, nullptr, GL_STATIC_DRAW);
+
+            glGenBuffers(1, &ebo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, nullptr, GL_STATIC_DRAW);
+
+            V::Format::setup(size);
+        }
+
+        ~Page() {
+            glDeleteVertexArrays(1, &vao);
+            glDeleteBuffers(1, &vbo);
+            glDeleteBuffers(1, &ebo);
+        }
+    };
+
+    // 頂点の位置の次元
+    const GLint size;
+
+    // 1ページの頂点とインデックスのバイト数
+    const GLsizeiptr vertex_bytes, index_bytes;
+
+    // ページ
+    std::vector<std::unique_ptr<Page>> pages;
+
+    // 最後に結合したページ
+    int bound;
+
+public:
+    // 割り当てた領域
+    struct Allocation {
+        // ページの番号 (割り当てられなければ-1)
+        int page;
+
+        // 最初の頂点の番号 (base vertex) と頂点の数
+        GLint base_vertex;
+        GLsizei vertex_count;
+
+        // 最初のインデックスの番号とインデックスの数 (インデックスを使わなければ0)
+        GLint first_index;
+        GLsizei index_count;
+
+        // インデックスの型 (図形ごとに最大値が入る一番小さい型を選ぶ)
+        GLenum index_type;
+    };
+
+    /*
+     * @fn
+     * コンストラクタ
+     * @param size 頂点の位置の次元
+     * @param vertex_bytes 1ページの頂点のバイト数
+     * @param index_bytes 1ページのインデックスのバイト数
+     */
+    explicit BufferHeap(GLint size, GLsizeiptr vertex_bytes = 4 << 20, GLsizeiptr index_bytes = 1 << 20)
+    : size(size), vertex_bytes(vertex_bytes / sizeof(V) * sizeof(V)), index_bytes(index_bytes), bound(-1) {}
+
+    /*
+     * @fn
+     * 図形データを置く
+     * @param vertex_count 頂点の数
+     * @param vertex 頂点属性を格納した配列
+     * @param index_count インデックスの数 (インデックスを使わなければ0)
+     * @param index 頂点のインデックスを格納した配列 (図形の先頭の頂点を0とする)
+     * @return 割り当てた領域 (入りきらなければpageが-1)
+     * @detail 図形の先頭からの番号なので、頂点が少なければ16bitや8bitのインデックスで済む
+     */
+    Allocation allocate(GLsizei vertex_count, const V *vertex, GLsizei index_count = 0, const GLuint *index = nullptr) {
+        Allocation allocation = { -1, 0, vertex_count, 0, index_count, GL_UNSIGNED_INT };
+        const std::vector<GLubyte> packed(Object::packIndices(index, index_count, allocation.index_type));
+        const GLsizeiptr vbytes(vertex_count * sizeof(V)), ibytes(packed.size());
+        const GLsizeiptr isize(Object::indexTypeSize(allocation.index_type));
+        if (vbytes > vertex_bytes || ibytes > index_bytes) return allocation;
+
+        // 入るページを探して、なければページを追加する
+        for (std::size_t p = 0; p <= pages.size(); ++p) {
+            if (p == pages.size()) pages.emplace_back(new Page(size, vertex_bytes, index_bytes));
+            Page &page(*pages[p]);
+
+            const GLsizeiptr voffset(page.vertices.allocate(vbytes, sizeof(V)));
+            if (voffset == FreeList::invalid) continue;
+            GLsizeiptr ioffset(0);
+            if (index_count > 0) {
+                ioffset = page.indices.allocate(ibytes, isize);
+                if (ioffset == FreeList::invalid) {
+                    page.vertices.free(voffset, vbytes);
+                    continue;
+                }
+            }
+
+            // 転送する
+            glBindBuffer(GL_ARRAY_BUFFER, page.vbo);
+            glBufferSubData(GL_ARRAY_BUFFER, voffset, vbytes, vertex);
+            if (index_count > 0) {
+                // 要素配列バッファの結合は頂点配列オブジェクトの状態なので、ページを結合してから転送する
+                glBindVertexArray(page.vao);
+                bound = static_cast<int>(p);
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, ioffset, ibytes, packed.data());
+            }
+
+            allocation.page = static_cast<int>(p);
+            allocation.base_vertex = static_cast<GLint>(voffset / sizeof(V));
+            allocation.first_index = static_cast<GLint>(ioffset / isize);
+            return allocation;
+        }
+        return allocation;
+    }
+
+    // Object::indices の三角形で図形データを置く (allocate() と同じ名前だと nullptr や0を渡したときに曖昧になる)
+    Allocation allocateTriangles(GLsizei vertex_count, const V *vertex, GLsizei triangle_count, const Object::indices *indices) {
+        return allocate(vertex_count, vertex, triangle_count * 3, reinterpret_cast<const GLuint *>(indices));
+    }
+
+    // 図形データを取り除く
+    void free(const Allocation &allocation) {
+        if (allocation.page < 0) return;
+        Page &page(*pages[allocation.page]);
+        page.vertices.free(allocation.base_vertex * sizeof(V), allocation.vertex_count * sizeof(V));
+        if (allocation.index_count > 0) {
+            const GLsizeiptr isize(Object::indexTypeSize(allocation.index_type));
+            page.indices.free(allocation.first_index * isize, allocation.index_count * isize);
+        }
+    }
+
+    /*
+     * @fn
+     * 図形を描画する
+     * @param allocation allocate() か allocateTriangles() が返した領域
+     * @detail 同じページの図形を続けて描くと頂点配列オブジェクトを結合し直さない
+     */
+    void draw(const Allocation &allocation) {
+        if (allocation.page < 0) return;
+        if (bound != allocation.page) {
+            glBindVertexArray(pages[allocation.page]->vao);
+            bound = allocation.page;
+        }
+
+        if (allocation.index_count > 0)
+            glDrawElementsBaseVertex(GL_TRIANGLES, allocation.index_count, allocation.index_type,
+                                     (void*)(static_cast<GLsizeiptr>(allocation.first_index) * Object::indexTypeSize(allocation.index_type)),
+                                     allocation.base_vertex);
+        else
+            glDrawArrays(GL_TRIANGLES, allocation.base_vertex, allocation.vertex_count);
+    }
+
+    // ヒープ以外の頂点配列オブジェクトを結合したら、次にdraw()を呼ぶ前に呼び出す
+    void unbind() { bound = -1; }
+
+    // ページの数
+    std::size_t getPages() const { return pages.size(); }
+
+    // 使用中のバイト数 (頂点とインデックスの合計)
+    GLsizeiptr getUsedBytes() const {
+        GLsizeiptr used(0);
+        for (const auto &page : pages) used += page->vertices.getUsed() + page->indices.getUsed();
+        return used;
+    }
+
+    // 確保したバイト数 (頂点とインデックスの合計)
+    GLsizeiptr getCapacityBytes() const {
+        return static_cast<GLsizeiptr>(pages.size()) * (vertex_bytes + index_bytes);
+    }
+
+    // 頂点の領域の断片化の度合い (ページの平均)
+    double getFragmentation() const {
+        if (pages.empty()) return 0.0;
+        double sum(0.0);
+        for (const auto &page : pages) sum += page->vertices.getFragmentation();
+        return sum / pages.size();
+    }
+
+    // 統計を表示する
+    void printStatistics(std::ostream &out = std::cerr) const {
+        out << "Buffer heap: " << pages.size() << " pages, "
+            << getUsedBytes() << "/" << getCapacityBytes() << " bytes used";
+        for (std::size_t p = 0; p < pages.size(); ++p) {
+            const Page &page(*pages[p]);
+            out << "\n  page " << p << ": vertices " << page.vertices.getUsed() << " bytes, "
+                << page.vertices.getFreeBlocks() << " free blocks, fragmentation " << page.vertices.getFragmentation()
+                << "; indices " << page.indices.getUsed() << " bytes, "
+                << page.indices.getFreeBlocks() << " free blocks, fragmentation " << page.indices.getFragmentation();
+        }
+        out << std::endl;
+    }
+};
@@ -0,0 +1,203 @@
+/*
+ * @file ImageDecoder.h
+ * @brief 複数のスレッドから安全に使える stb_image の呼び出し
+ * @detail stb_image の上下の反転・アルファの乗算の解除・iPhoneのPNGの変換の設定と失敗の理由は
+ *         stbi_set_flip_vertically_on_load() などで設定するすべてのスレッドに共通の状態なので、
+ *         別々の設定で並行してデコードすると互いに上書きしてしまう
+ *         ここでは呼び出しごとに設定を受け取り、同梱の stb_image.h のスレッドごとの設定(*_thread())に
+ *         入れてからデコードするので、設定と失敗の理由はそのスレッドの中だけで有効になる
+ *         ImageDecoder を使うスレッドではスレッドごとの設定が優先されるので、全体の設定は効かなくなる
+ *         PNGはまず PngDecoder でデコードし、対応しない形式のときだけ stb_image に任せる
+ *         loadAll() は独立した複数の画像をスレッドに分けてデコードする
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "stb_image.h"
+
+// ファイルのメモリへのマップ
+#include "MappedFile.h"
+
+// 速いPNGのデコーダ
+#include "PngDecoder.h"
+
+// 画像のデコード
+class ImageDecoder {
+public:
+    // デコードの設定
+    struct Options {
+        // 上下を反転するか (最初の画素を左下にする)
+        bool flip;
+
+        // アルファを乗算済みと記録している画像のアルファの乗算を解除するか
+        bool unpremultiply;
+
+        // iPhoneのPNG(BGRでアルファ乗算済み)を普通のRGBに変換するか
+        bool convert_iphone;
+
+        // 出力のチャンネル数 (0ならファイルのまま, 1-4ならこのチャンネル数に変換する)
+        int channels;
+
+        // PNGを PngDecoder でデコードするか (false ならいつも stb_image を使う)
+        bool fast_png;
+
+        // stb_image の既定と同じ設定
+        Options()
+        : flip(false), unpremultiply(false), convert_iphone(false), channels(0), fast_png(true) {}
+    };
+
+    // stbi_image_free() で画素を解放する
+    struct Free {
+        void operator()(stbi_uc *pixels) const { stbi_image_free(pixels); }
+    };
+
+    // デコードした画像
+    struct Image {
+        // 画素 (失敗したらnullptr)
+        std::unique_ptr<stbi_uc, Free> pixels;
+
+        // 大きさ
+        int width, height;
+
+        // 画素のチャンネル数・ファイルのチャンネル数
+        int channels, file_channels;
+
+        // 失敗の理由 (成功したら空)
+        std::string error;
+
+        Image()
+        : width(0), height(0), channels(0), file_channels(0) {}
+
+        // デコードできたか
+        explicit operator bool() const { return pixels != nullptr; }
+
+        // 画素の持ち主をやめて返す (stbi_image_free() で解放する)
+        stbi_uc *release() { return pixels.release(); }
+    };
+
+private:
+    // 設定をこのスレッドの stb_image に入れる
+    static void apply(const Options &options) {
+        stbi_set_flip_vertically_on_load_thread(options.flip);
+        stbi_set_unpremultiply_on_load_thread(options.unpremultiply);
+        stbi_convert_iphone_png_to_rgb_thread(options.convert_iphone);
+    }
+
+    // デコードの結果をまとめる
+    static Image finish(stbi_uc *pixels, int width, int height, int channels, const Options &options) {
+        Image image;
+        image.pixels.reset(pixels);
+        if (pixels == nullptr) {
+            const char *const reason(stbi_failure_reason());
+            image.error = reason != nullptr ? reason : "unknown error";
+            return image;
+        }
+        image.width = width;
+        image.height = height;
+        image.file_channels = channels;
+        image.channels = options.channels != 0 ? options.channels : channels;
+        return image;
+    }
+
+    // 画素の上下を入れ替える
+    static void flip(stbi_uc *pixels, int width, int height, int channels) {
+        const std::size_t stride(static_cast<std::size_t>(width) * channels);
+        for (int y = 0; y < height / 2; ++y)
+            std::swap_ranges(pixels + y * stride, pixels + (y + 1) * stride, pixels + (height - 1 - y) * stride);
+    }
+
+    // PngDecoder でデコードする (対応しなければnullptr)
+    static stbi_uc *loadPng(const unsigned char *data, std::size_t size, int &width, int &height, int &channels,
+                            const Options &options) {
+        if (!options.fast_png || !PngDecoder::isPng(data, size) || size > 0x7fffffff) return nullptr;
+        stbi_uc *const pixels(PngDecoder::loadFromMemory(data, static_cast<int>(size), &width, &height, &channels, options.channels));
+        if (pixels != nullptr && options.flip) flip(pixels, width, height, options.channels != 0 ? options.channels : channels);
+        return pixels;
+    }
+
+public:
+    /*
+     * @fn
+     * 画像ファイルをデコードする (どのスレッドからでも呼び出せる)
+     * @param path 画像ファイル名
+     * @param options デコードの設定
+     * @return デコードした画像
+     */
+    static Image load(const std::string &path, const Options &options = Options()) {
+        MappedFile file;
+        if (file.open(path)) return load(file.getData(), file.getSize(), options);
+        apply(options);
+        int width(0), height(0), channels(0);
+        stbi_uc *const pixels(stbi_load(path.c_str(), &width, &height, &channels, options.channels));
+        return finish(pixels, width, height, channels, options);
+    }
+
+    /*
+     * @fn
+     * メモリにある画像ファイルの中身をデコードする (どのスレッドからでも呼び出せる)
+     * @param data ファイルの中身
+     * @param size バイト数
+     * @param options デコードの設定
+     * @return デコードした画像
+     */
+    static Image load(const unsigned char *data, std::size_t size, const Options &options = Options()) {
+        int width(0), height(0), channels(0);
+        stbi_uc *pixels(loadPng(data, size, width, height, channels, options));
+        if (pixels == nullptr) {
+            apply(options);
+            pixels = stbi_load_from_memory(data, static_cast<int>(size), &width, &height, &channels, options.channels);
+        }
+        return finish(pixels, width, height, channels, options);
+    }
+
+    /*
+     * @fn
+     * 独立した複数の画像ファイルをスレッドに分けてデコードする
+     * @param paths 画像ファイル名
+     * @param options デコードの設定
+     * @param threads スレッドの数 (0ならコアの数)
+     * @return デコードした画像 (paths と同じ順)
+     */
+    static std::vector<Image> loadAll(const std::vector<std::string> &paths, const Options &options = Options(),
+                                      unsigned int threads = 0) {
+        std::vector<Image> images(paths.size());
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        threads = static_cast<unsigned int>(std::min<std::size_t>(threads, paths.size()));
+
+        // 次にデコードする画像を取り合う
+        std::atomic<std::size_t> next(0);
+        const auto work = [&]() {
+            for (std::size_t i; (i = next++) < paths.size();) images[i] = load(paths[i], options);
+        };
+        std::vector<std::thread> workers;
+        for (unsigned int i = 1; i < threads; ++i) workers.emplace_back(work);
+        work();
+        for (auto &worker : workers) worker.join();
+        return images;
+    }
+
+    /*
+     * @fn
+     * デコードせずに画像の大きさとチャンネル数を調べる (どのスレッドからでも呼び出せる)
+     * @param path 画像ファイル名
+     * @param width 幅
+     * @param height 高さ
+     * @param channels ファイルのチャンネル数
+     * @return 調べられたら true
+     */
+    static bool info(const std::string &path, int &width, int &height, int &channels) {
+        return stbi_info(path.c_str(), &width, &height, &channels) != 0;
+    }
+
+    // このスレッドで最後に失敗した理由
+    static const char *failureReason() {
+        return stbi_failure_reason();
+    }
+};
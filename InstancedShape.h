@@ -0,0 +1,249 @@
+/*
+ * @file InstancedShape.h
+ * @brief 同じ図形をインスタンス描画でまとめて描くクラス
+ * @detail 図形データ(Object)に加えてインスタンスごとの属性(位置・拡大率・色・テクスチャ座標の範囲)のバッファを持ち、
+ *         glVertexAttribDivisor()で1インスタンスに1つずつ進めて、全インスタンスを1回の描画命令で描く
+ *         インスタンスの属性はObjectを作り直さずにまとめて更新できる
+ */
+
+#pragma once
+
+#include <memory>
+
+// 図形データ
+#include "Object.h"
+
+// プログラムオブジェクトの検証
+#include "ProgramValidator.h"
+
+// インスタンス描画する図形
+class InstancedShape {
+    // コピーコンストラクタによるコピー禁止
+    InstancedShape(const InstancedShape &s);
+
+    // 代入によるコピー禁止
+    InstancedShape &operator=(const InstancedShape &s);
+
+    // 図形データ
+    std::shared_ptr<const Object> object;
+
+    // インスタンスの属性を格納するバッファオブジェクト
+    GLuint ibo;
+
+    // インスタンスの属性のバッファに確保した数
+    GLsizei capacity;
+
+    // 描画するインスタンスの数
+    GLsizei instance_count;
+
+    // 描画に貼り付けるテクスチャ (0ならテクスチャを結合しない)
+    GLuint texture;
+
+public:
+    // インスタンスごとの属性
+    struct Instance {
+        // 図形の位置 instanceOffset
+        GLfloat offset[2];
+
+        // 図形の拡大率 instanceScale
+        GLfloat scale;
+
+        // 図形の色 RGBA instanceColor
+        GLfloat color[4];
+
+        // テクスチャ座標の範囲 (u0, v0, u1, v1) instanceRect
+        GLfloat rect[4];
+
+        // インスタンスの属性の形式
+        typedef VertexFormat<Attribute<GL_FLOAT, 2>, Attribute<GL_FLOAT, 1>,
+                             Attribute<GL_FLOAT, 4>, Attribute<GL_FLOAT, 4>> Format;
+    };
+
+    // インスタンスの属性の attribute 変数の場所 (Objectの頂点属性 0〜2 の後ろ)
+    enum : GLuint {
+        offsetLocation = 3,
+        scaleLocation = 4,
+        colorLocation = 5,
+        rectLocation = 6
+    };
+
+    /*
+     * @fn
+     * インスタンスの属性の attribute 変数の場所を設定する
+     * @param program リンク前のプログラムオブジェクト名
+     */
+    static void bindAttribLocations(GLuint program) {
+        glBindAttribLocation(program, offsetLocation, "instanceOffset");
+        glBindAttribLocation(program, scaleLocation, "instanceScale");
+        glBindAttribLocation(program, colorLocation, "instanceColor");
+        glBindAttribLocation(program, rectLocation, "instanceRect");
+    }
+
+protected:
+    // 描画に使う頂点またはインデックスの数
+    const GLsizei vertex_count;
+
+    // インデックスを使って描画するか
+    const bool indexed;
+
+    /*
+     * @fn
+     * 図形データの頂点配列オブジェクトにインスタンスの属性を追加する
+     * @param capacity あらかじめ確保するインスタンスの数
+     * @param instance インスタンスの属性を格納した配列 (nullptrなら確保だけ行う)
+     * @param count instanceに格納したインスタンスの数
+     */
+    void setup(GLsizei capacity, const Instance *instance, GLsizei count) {
+        // 図形データの頂点配列オブジェクトに追加する
+        object->bind();
+
+        // インスタンスの属性のバッファオブジェクト
+        glGenBuffers(1, &ibo);
+        glBindBuffer(GL_ARRAY_BUFFER, ibo);
+        this->capacity = capacity > count ? capacity : count;
+        glBufferData(GL_ARRAY_BUFFER, this->capacity * sizeof(Instance), nullptr, GL_DYNAMIC_DRAW);
+        if (instance != nullptr && count > 0)
+            glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(Instance), instance);
+        instance_count = instance != nullptr ? count : 0;
+
+        // 結合されているバッファオブジェクトをin変数から参照できるようにして、1インスタンスごとに1つ進める
+        static_assert(sizeof(Instance) == Instance::Format::stride, "Instance struct does not match its format.");
+        Instance::Format::setup(0, offsetLocation);
+        for (GLuint location = offsetLocation; location <= rectLocation; ++location)
+            glVertexAttribDivisor(location, 1);
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param size 頂点の位置の次元
+     * @param vertex_count 頂点の数
+     * @param vertex 頂点属性を格納した配列
+     * @param capacity あらかじめ確保するインスタンスの数
+     * @param instance インスタンスの属性を格納した配列
+     * @param count instanceに格納したインスタンスの数
+     */
+    InstancedShape(GLint size, GLsizei vertex_count, const Object::Vertex *vertex,
+                   GLsizei capacity, const Instance *instance = nullptr, GLsizei count = 0)
+    : object(new Object(size, vertex_count, vertex))
+    , texture(0), vertex_count(vertex_count), indexed(false) {
+        setup(capacity, instance, count);
+    }
+
+    InstancedShape(GLint size, GLsizei vertex_count, const Object::Vertex_With_Color *vertex,
+                   GLsizei capacity, const Instance *instance = nullptr, GLsizei count = 0)
+    : object(new Object(size, vertex_count, vertex))
+    , texture(0), vertex_count(vertex_count), indexed(false) {
+        setup(capacity, instance, count);
+    }
+
+    /*
+     * @fn
+     * コンストラクタ
+     * @param size 頂点の位置の次元
+     * @param vertex_count 頂点の数
+     * @param vertex 頂点属性を格納した配列
+     * @param indices 頂点のインデックスを格納した配列
+     * @param index_count インデックスの数
+     * @param texture 貼り付けるテクスチャオブジェクト名 (Texture::getTexture())
+     * @param capacity あらかじめ確保するインスタンスの数
+     * @param instance インスタンスの属性を格納した配列
+     * @param count instanceに格納したインスタンスの数
+     */
+    InstancedShape(GLint size, GLsizei vertex_count, const Object::Vertex_Textrue *vertex,
+                   const Object::indices *indices, GLsizei index_count, GLuint texture,
+                   GLsizei capacity, const Instance *instance = nullptr, GLsizei count = 0)
+    : object(new Object(size, vertex_count, vertex, indices, index_count))
+    , texture(texture), vertex_count(index_count), indexed(true) {
+        setup(capacity, instance, count);
+    }
+
+    // デストラクタ
+    virtual ~InstancedShape() {
+        // インスタンスの属性のバッファオブジェクトを削除する
+        glDeleteBuffers(1, &ibo);
+    }
+
+    /*
+     * @fn
+     * インスタンスの属性をまとめて置き換える
+     * @param instance インスタンスの属性を格納した配列
+     * @param count instanceに格納したインスタンスの数
+     * @detail 確保した数を超えるときはバッファを確保し直す
+     */
+    void setInstances(const Instance *instance, GLsizei count) {
+        glBindBuffer(GL_ARRAY_BUFFER, ibo);
+        if (count > capacity) {
+            // 足りなければ確保し直す (頂点配列オブジェクトはバッファ名で参照しているので設定し直す必要はない)
+            capacity = count;
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Instance), instance, GL_DYNAMIC_DRAW);
+        }
+        else {
+            // 描画中の古い内容を待たないように捨ててから書き込む
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Instance), nullptr, GL_DYNAMIC_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(Instance), instance);
+        }
+        instance_count = count;
+    }
+
+    /*
+     * @fn
+     * インスタンスの属性の一部を更新する
+     * @param first 更新する最初のインスタンスの番号
+     * @param instance インスタンスの属性を格納した配列
+     * @param count instanceに格納したインスタンスの数
+     * @return 描画するインスタンスの範囲を超えていたらfalseを返す
+     */
+    bool updateInstances(GLsizei first, const Instance *instance, GLsizei count) {
+        if (first < 0 || count < 0 || first + count > instance_count) return false;
+        glBindBuffer(GL_ARRAY_BUFFER, ibo);
+        glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(Instance), count * sizeof(Instance), instance);
+        return true;
+    }
+
+    // 描画するインスタンスの数を取り出す
+    GLsizei getInstanceCount() const { return instance_count; }
+
+    // 描画
+    void draw() const {
+        // テクスチャを結合する
+        if (texture != 0) glBindTexture(GL_TEXTURE_2D, texture);
+
+        // 頂点配列オブジェクトを結合する
+        object->bind();
+
+        // 描画の実行
+        execute();
+    }
+
+    /*
+     * @fn
+     * 結合してから必要ならプログラムオブジェクトを検証して描画
+     * @param validator 検証 (このオブジェクトが結合した状態で調べるので、同じプログラムで複数の図形を描いても検証し直さない)
+     * @param program 使用中のプログラムオブジェクト名
+     * @return 描画したら true (検証に失敗したら描画しない)
+     */
+    bool draw(ProgramValidator &validator, GLuint program) const {
+        // テクスチャを結合する
+        if (texture != 0) glBindTexture(GL_TEXTURE_2D, texture);
+        // 頂点配列オブジェクトを結合する
+        object->bind();
+
+        // 結合した状態で検証する
+        if (!validator.validate(program)) return false;
+
+        // 描画の実行
+        execute();
+        return true;
+    }
+
+    // 描画の実行
+    virtual void execute() const {
+        if (instance_count == 0) return;
+        if (indexed)
+            glDrawElementsInstanced(GL_TRIANGLES, vertex_count, object->getIndexType(), 0, instance_count);
+        else
+            glDrawArraysInstanced(GL_TRIANGLES, 0, vertex_count, instance_count);
+    }
+};
@@ -0,0 +1,132 @@
+/*
+ * @file MappedFile.h
+ * @brief ファイルを読み出し専用でメモリにマップするクラス
+ * @detail ファイルの中身をヒープにコピーせずにポインタで参照できるようにする
+ *         POSIX では mmap()、Windows では CreateFileMapping() を使う
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// メモリにマップしたファイル
+class MappedFile {
+    // コピーコンストラクタによるコピー禁止
+    MappedFile(const MappedFile &f);
+
+    // 代入によるコピー禁止
+    MappedFile &operator=(const MappedFile &f);
+
+    // マップした先頭
+    const unsigned char *data;
+
+    // バイト数
+    std::size_t size;
+
+#ifdef _WIN32
+    // ファイルとマッピングのハンドル
+    HANDLE file, mapping;
+#endif
+
+public:
+    // コンストラクタ
+    MappedFile()
+    : data(nullptr), size(0)
+#ifdef _WIN32
+    , file(INVALID_HANDLE_VALUE), mapping(nullptr)
+#endif
+    {}
+
+    // デストラクタ
+    virtual ~MappedFile() {
+        close();
+    }
+
+    /*
+     * @fn
+     * ファイルをマップする
+     * @param path ファイル名
+     * @return マップできたら true (メッセージは表示しないので呼び出し側で扱う)
+     */
+    bool open(const std::string &path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER length;
+        GetFileSizeEx(file, &length);
+        size = static_cast<std::size_t>(length.QuadPart);
+        mapping = size > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+        data = mapping != nullptr ? static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+        const int fd(::open(path.c_str(), O_RDONLY));
+        if (fd < 0) return false;
+        struct stat status;
+        if (fstat(fd, &status) == 0) size = static_cast<std::size_t>(status.st_size);
+        if (size > 0) {
+            void *const address(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+            if (address != MAP_FAILED) data = static_cast<const unsigned char *>(address);
+        }
+        // マップした後はファイル記述子はいらない
+        ::close(fd);
+#endif
+        if (data == nullptr) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // マップを外す
+    void close() {
+#ifdef _WIN32
+        if (data != nullptr) UnmapViewOfFile(data);
+        if (mapping != nullptr) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (data != nullptr) munmap(const_cast<unsigned char *>(data), size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+
+    /*
+     * @fn
+     * 範囲を先読みするようにOSに伝える
+     * @param offset 先頭からの位置
+     * @param length バイト数
+     */
+    void prefetch(std::size_t offset, std::size_t length) const {
+#if !defined(_WIN32) && defined(MADV_WILLNEED)
+        if (data == nullptr || offset >= size) return;
+        const std::size_t page(static_cast<std::size_t>(sysconf(_SC_PAGESIZE)));
+        const std::size_t begin(offset / page * page);
+        madvise(const_cast<unsigned char *>(data) + begin, std::min(size, offset + length) - begin, MADV_WILLNEED);
+#else
+        (void)offset;
+        (void)length;
+#endif
+    }
+
+    // マップした先頭 (マップしていなければnullptr)
+    const unsigned char *getData() const { return data; }
+
+    // バイト数
+    std::size_t getSize() const { return size; }
+};
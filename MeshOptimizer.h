@@ -0,0 +1,322 @@
+/*
+ * @file MeshOptimizer.h
+ * @brief インデックスを使う図形の頂点とインデックスを並べ替えてGPUの頂点キャッシュを効かせる
+ * @detail 同じ頂点の重複の削除、Forsythの方法による三角形の並べ替え(頂点キャッシュの最適化)、
+ *         インデックスで最初に使われる順への頂点の並べ替え(頂点の読み込みの最適化)を行う
+ *         効果は ACMR (三角形あたりの頂点シェーダの実行回数) と ATVR (頂点あたりの実行回数) で確かめる
+ *         三角形の順番が変わるので、深度テストなしで重なり順に頼る図形には使わない
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+#include <GL/glew.h>
+
+// 頂点キャッシュの効率
+struct VertexCacheStatistics {
+    // 三角形あたりの頂点シェーダの実行回数 (理想は0.5前後, 最悪は3)
+    double acmr;
+
+    // 頂点あたりの頂点シェーダの実行回数 (理想は1)
+    double atvr;
+};
+
+/*
+ * @fn
+ * 頂点キャッシュ(FIFO)を真似てインデックスの順番の効率を求める
+ * @param index インデックス
+ * @param vertex_count 頂点の数
+ * @param cache_size キャッシュに入る頂点の数
+ * @return ACMRとATVR
+ */
+inline VertexCacheStatistics analyzeVertexCache(const std::vector<GLuint> &index, std::size_t vertex_count,
+                                                std::size_t cache_size = 16) {
+    // 頂点がキャッシュに入った時刻
+    std::vector<std::size_t> stamp(vertex_count, 0);
+    std::size_t misses(0);
+    for (const GLuint i : index) {
+        if (i >= vertex_count) continue;
+
+        // FIFOなので、最後に入ってから cache_size 回以上追い出しがあれば入っていない
+        if (stamp[i] == 0 || misses - stamp[i] >= cache_size) {
+            ++misses;
+            stamp[i] = misses;
+        }
+    }
+
+    const std::size_t triangles(index.size() / 3);
+    VertexCacheStatistics statistics;
+    statistics.acmr = triangles > 0 ? static_cast<double>(misses) / triangles : 0.0;
+    statistics.atvr = vertex_count > 0 ? static_cast<double>(misses) / vertex_count : 0.0;
+    return statistics;
+}
+
+/*
+ * @fn
+ * インデックスが三角形の並びで全部頂点を指しているか調べる
+ * @param index インデックス
+ * @param vertex_count 頂点の数
+ * @return 数が3の倍数で範囲外のインデックスがなければ true (でなければメッセージを表示する)
+ */
+inline bool validateIndices(const std::vector<GLuint> &index, std::size_t vertex_count) {
+    // 余ったインデックスがあると三角形ごとの表からはみ出す
+    if (index.size() % 3 != 0) {
+        std::cerr << "Error: Index count " << index.size() << " is not a multiple of 3" << std::endl;
+        return false;
+    }
+    for (std::size_t i = 0; i < index.size(); ++i) {
+        if (index[i] >= vertex_count) {
+            std::cerr << "Error: Index " << index[i] << " at " << i << " is out of range (" << vertex_count
+                      << " vertices)" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * @fn
+ * 中身が同じ頂点を1つにまとめる
+ * @param vertex 頂点 (重複を取り除いたものに置き換える)
+ * @param index インデックス (まとめた頂点を指すように書き換える)
+ * @return 取り除いた頂点の数
+ */
+template <typename V>
+std::size_t deduplicateVertices(std::vector<V> &vertex, std::vector<GLuint> &index) {
+    if (!validateIndices(index, vertex.size())) return 0;
+
+    // 頂点のバイト列でハッシュ表を引く
+    struct Hash {
+        std::size_t operator()(const V *v) const {
+            const unsigned char *const p(reinterpret_cast<const unsigned char *>(v));
+            std::size_t h(14695981039346656037ULL);
+            for (std::size_t i = 0; i < sizeof(V); ++i) h = (h ^ p[i]) * 1099511628211ULL;
+            return h;
+        }
+    };
+    struct Equal {
+        bool operator()(const V *a, const V *b) const { return std::memcmp(a, b, sizeof(V)) == 0; }
+    };
+
+    std::unordered_map<const V *, GLuint, Hash, Equal> table(vertex.size() * 2);
+    std::vector<GLuint> remap(vertex.size());
+    std::vector<V> unique;
+    unique.reserve(vertex.size());
+    for (std::size_t i = 0; i < vertex.size(); ++i) {
+        const auto found(table.emplace(&vertex[i], static_cast<GLuint>(unique.size())));
+        if (found.second) unique.push_back(vertex[i]);
+        remap[i] = found.first->second;
+    }
+
+    for (GLuint &i : index) i = remap[i];
+    const std::size_t removed(vertex.size() - unique.size());
+    vertex.swap(unique);
+    return removed;
+}
+
+/*
+ * @fn
+ * 頂点キャッシュに当たりやすいように三角形を並べ替える (Tom Forsyth, Linear-Speed Vertex Cache Optimisation)
+ * @param index インデックス (並べ替えたものに置き換える)
+ * @param vertex_count 頂点の数
+ * @return 並べ替えたら true (数が3の倍数でないか範囲外のインデックスがあれば並べ替えない)
+ */
+inline bool optimizeVertexCache(std::vector<GLuint> &index, std::size_t vertex_count) {
+    // 最適化に使うキャッシュの大きさと点数の係数
+    constexpr int cache_size = 32;
+    constexpr double decay_power = 1.5, last_triangle_score = 0.75;
+    constexpr double valence_boost_scale = 2.0, valence_boost_power = 0.5;
+
+    // 三角形に足りないインデックスや範囲外のインデックスがあると表を壊すので、先に調べる
+    if (!validateIndices(index, vertex_count)) return false;
+    const std::size_t triangle_count(index.size() / 3);
+    if (triangle_count == 0) return true;
+
+    // 頂点ごとの、まだ出力していない三角形
+    std::vector<std::size_t> offset(vertex_count + 1, 0);
+    for (const GLuint i : index) ++offset[i + 1];
+    for (std::size_t v = 0; v < vertex_count; ++v) offset[v + 1] += offset[v];
+    std::vector<std::size_t> triangles(index.size());
+    std::vector<std::size_t> remaining(vertex_count, 0);
+    for (std::size_t t = 0; t < triangle_count; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            const GLuint v(index[t * 3 + k]);
+            triangles[offset[v] + remaining[v]++] = t;
+        }
+    }
+
+    // 頂点の点数
+    std::vector<int> position(vertex_count, -1);
+    auto score = [&](GLuint v) -> double {
+        if (remaining[v] == 0) return -1.0;
+        double s(0.0);
+        const int p(position[v]);
+        if (p >= 0) {
+            if (p < 3) {
+                // 直前の三角形の頂点は次の三角形でも使いやすいように少し低くする
+                s = last_triangle_score;
+            }
+            else {
+                const double scale(1.0 / (cache_size - 3));
+                s = std::pow(1.0 - (p - 3) * scale, decay_power);
+            }
+        }
+        // 残りの三角形が少ない頂点を優先して片付ける
+        s += valence_boost_scale * std::pow(static_cast<double>(remaining[v]), -valence_boost_power);
+        return s;
+    };
+
+    std::vector<double> vertex_score(vertex_count);
+    for (GLuint v = 0; v < vertex_count; ++v) vertex_score[v] = score(v);
+    std::vector<double> triangle_score(triangle_count);
+    std::vector<bool> emitted(triangle_count, false);
+    for (std::size_t t = 0; t < triangle_count; ++t)
+        triangle_score[t] = vertex_score[index[t * 3]] + vertex_score[index[t * 3 + 1]] + vertex_score[index[t * 3 + 2]];
+
+    std::vector<GLuint> result;
+    result.reserve(index.size());
+    std::vector<GLuint> cache, next;
+    cache.reserve(cache_size + 3);
+    next.reserve(cache_size + 3);
+    std::size_t cursor(0);
+
+    // 最初は一番点数の高い三角形から始める
+    std::size_t best(std::max_element(triangle_score.begin(), triangle_score.end()) - triangle_score.begin());
+    while (result.size() < index.size()) {
+        if (best == triangle_count) {
+            // キャッシュの頂点を使う三角形がなければ、まだ出力していない三角形を順に探す
+            while (cursor < triangle_count && emitted[cursor]) ++cursor;
+            best = cursor;
+        }
+
+        // 三角形を出力して頂点の残りの三角形から取り除く
+        emitted[best] = true;
+        for (int k = 0; k < 3; ++k) {
+            const GLuint v(index[best * 3 + k]);
+            result.push_back(v);
+            std::size_t *const first(&triangles[offset[v]]);
+            std::size_t *const last(first + remaining[v]);
+            std::size_t *const found(std::find(first, last, best));
+            *found = *(last - 1);
+            --remaining[v];
+        }
+
+        // 三角形の頂点をキャッシュの先頭に入れる
+        next.clear();
+        for (int k = 0; k < 3; ++k) next.push_back(index[best * 3 + k]);
+        for (const GLuint v : cache)
+            if (std::find(next.begin(), next.begin() + 3, v) == next.begin() + 3) next.push_back(v);
+
+        // キャッシュの中の位置を更新する (追い出された頂点は-1)
+        for (std::size_t i = 0; i < next.size(); ++i)
+            position[next[i]] = i < static_cast<std::size_t>(cache_size) ? static_cast<int>(i) : -1;
+
+        // 追い出された頂点も含めて点数とその三角形の点数を更新する
+        for (const GLuint v : next) {
+            const double updated(score(v));
+            const double delta(updated - vertex_score[v]);
+            vertex_score[v] = updated;
+            for (std::size_t j = 0; j < remaining[v]; ++j) triangle_score[triangles[offset[v] + j]] += delta;
+        }
+        if (next.size() > static_cast<std::size_t>(cache_size)) next.resize(cache_size);
+        cache.swap(next);
+
+        // キャッシュの頂点を使う三角形から次に出力するものを選ぶ
+        best = triangle_count;
+        double best_score(-1.0);
+        for (const GLuint v : cache) {
+            for (std::size_t j = 0; j < remaining[v]; ++j) {
+                const std::size_t t(triangles[offset[v] + j]);
+                if (triangle_score[t] > best_score) {
+                    best_score = triangle_score[t];
+                    best = t;
+                }
+            }
+        }
+    }
+
+    index.swap(result);
+    return true;
+}
+
+/*
+ * @fn
+ * インデックスで最初に使われる順に頂点を並べ替える (頂点の読み込みを連続させる)
+ * @param vertex 頂点 (並べ替えたものに置き換える, 使われない頂点は取り除く)
+ * @param index インデックス (並べ替えた頂点を指すように書き換える)
+ */
+template <typename V>
+void optimizeVertexFetch(std::vector<V> &vertex, std::vector<GLuint> &index) {
+    if (!validateIndices(index, vertex.size())) return;
+    const GLuint unused(~0u);
+    std::vector<GLuint> remap(vertex.size(), unused);
+    std::vector<V> ordered;
+    ordered.reserve(vertex.size());
+    for (GLuint &i : index) {
+        if (remap[i] == unused) {
+            remap[i] = static_cast<GLuint>(ordered.size());
+            ordered.push_back(vertex[i]);
+        }
+        i = remap[i];
+    }
+    vertex.swap(ordered);
+}
+
+// 最適化の前後の比較
+struct MeshOptimizationReport {
+    // 頂点の数
+    std::size_t vertices_before, vertices_after;
+
+    // 頂点キャッシュの効率
+    VertexCacheStatistics before, after;
+
+    // インデックスが正しかったか (正しくなければ何もしていない)
+    bool valid;
+
+    // 表示する
+    void print(std::ostream &out = std::cerr) const {
+        if (!valid) {
+            out << "Mesh optimization: skipped, invalid indices" << std::endl;
+            return;
+        }
+        out << "Mesh optimization: vertices " << vertices_before << " -> " << vertices_after
+            << ", ACMR " << before.acmr << " -> " << after.acmr
+            << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+    }
+};
+
+/*
+ * @fn
+ * 重複の削除・頂点キャッシュの最適化・頂点の読み込みの最適化をまとめて行う
+ * @param vertex 頂点
+ * @param index インデックス (Object::indices の配列として Object に渡せる)
+ * @param cache_size 効率を求めるときのキャッシュの大きさ
+ * @return 最適化の前後の比較 (インデックスが正しくなければ何もせずに valid を false にする)
+ */
+template <typename V>
+MeshOptimizationReport optimizeMesh(std::vector<V> &vertex, std::vector<GLuint> &index, std::size_t cache_size = 16) {
+    MeshOptimizationReport report;
+    report.vertices_before = vertex.size();
+    report.before = analyzeVertexCache(index, vertex.size(), cache_size);
+
+    // 数が3の倍数でないか範囲外のインデックスがあれば何もしない
+    report.valid = validateIndices(index, vertex.size());
+    if (!report.valid) {
+        report.vertices_after = report.vertices_before;
+        report.after = report.before;
+        return report;
+    }
+
+    deduplicateVertices(vertex, index);
+    optimizeVertexCache(index, vertex.size());
+    optimizeVertexFetch(vertex, index);
+
+    report.vertices_after = vertex.size();
+    report.after = analyzeVertexCache(index, vertex.size(), cache_size);
+    return report;
+}
@@ -0,0 +1,389 @@
+/*
+ * @file MipGenerator.h
+ * @brief ミップマップをCPUで作るクラス
+ * @detail glGenerateMipmap() の代わりに、ボックスフィルタかカイザー窓付きのsincフィルタで縮小した全レベルを作る
+ *         sRGBの画像は線形の値に直してから縮小し、アルファテストで使う画像は縮小してもアルファが閾値を超える
+ *         画素の割合(カバレッジ)が変わらないようにアルファを調整できる
+ *         OpenGLを呼び出さないのでワーカースレッドで実行でき、upload() で全レベルを明示的に転送する
+ *         SSE2 があれば画素単位で、AVX があればボックスフィルタを2画素ずつ処理する
+ *         ボックスフィルタはどの経路でも同じ順に足すので、浮動小数点演算を縮約 (FMA) しなければ同じ結果になる
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <GL/glew.h>
+#include "PixelFormat.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_GENERATOR_SSE2 1
+#endif
+
+// CPUによるミップマップの生成
+class MipGenerator {
+public:
+    // 縮小に使うフィルタ
+    enum Filter {
+        // 2x2の平均
+        box,
+
+        // カイザー窓付きのsinc (6タップ, ボケにくい)
+        kaiser
+    };
+
+    // 生成の設定
+    struct Options {
+        // 縮小に使うフィルタ
+        Filter filter;
+
+        // 色がsRGBか (線形の値に直して縮小する)
+        bool srgb;
+
+        // アルファのカバレッジを保つか (4チャンネルのときだけ)
+        bool alpha_coverage;
+
+        // カバレッジを求めるアルファの閾値
+        GLfloat alpha_reference;
+
+        Options()
+        : filter(box), srgb(false), alpha_coverage(false), alpha_reference(0.5f) {}
+    };
+
+    // ミップマップの1レベル
+    struct Level {
+        // 大きさ
+        GLsizei width, height;
+
+        // 画素 (行の間にすき間はない)
+        std::vector<GLubyte> pixels;
+    };
+
+    // ミップマップの全レベル
+    struct Chain {
+        // 1画素のチャンネル数
+        GLsizei channels;
+
+        // 色がsRGBか
+        bool srgb;
+
+        // レベル0から1x1までの画像
+        std::vector<Level> levels;
+    };
+
+private:
+    // sRGBの値を線形の値にする表
+    static const GLfloat *srgbToLinear() {
+        static const std::vector<GLfloat> table([] {
+            std::vector<GLfloat> t(256);
+            for (int i = 0; i < 256; ++i) {
+                const double c(i / 255.0);
+                t[i] = static_cast<GLfloat>(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+            }
+            return t;
+        }());
+        return table.data();
+    }
+
+    // 線形の値をsRGBの値にする (隣り合う値の境目の表を二分探索するので丸めが正確)
+    static GLubyte linearToSrgb(GLfloat value) {
+        static const std::vector<GLfloat> threshold([] {
+            std::vector<GLfloat> t(255);
+            for (int i = 0; i < 255; ++i) {
+                const double c((i + 0.5) / 255.0);
+                t[i] = static_cast<GLfloat>(c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4));
+            }
+            return t;
+        }());
+        return static_cast<GLubyte>(std::upper_bound(threshold.begin(), threshold.end(), value) - threshold.begin());
+    }
+
+    // 線形の値を8bitにする
+    static GLubyte toUnorm8(GLfloat value) {
+        return static_cast<GLubyte>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f));
+    }
+
+    // 1画素 (4チャンネル) に重みを掛けて足し込む
+    static void accumulate(GLfloat *sum, const GLfloat *pixel, GLfloat weight) {
+#if defined(MIP_GENERATOR_SSE2)
+        _mm_storeu_ps(sum, _mm_add_ps(_mm_loadu_ps(sum), _mm_mul_ps(_mm_loadu_ps(pixel), _mm_set1_ps(weight))));
+#else
+        for (int c = 0; c < 4; ++c) sum[c] += pixel[c] * weight;
+#endif
+    }
+
+    // 縮小後の1画素が使う縮小前の画素と重み (1次元)
+    struct Taps {
+        int count;
+        int index[3];
+        GLfloat weight[3];
+    };
+
+    /*
+     * @fn
+     * ボックスフィルタのタップを求める
+     * @param size 縮小前の画素数
+     * @param x 縮小後の画素の位置
+     * @param dsize 縮小後の画素数
+     * @detail 偶数なら2画素の平均、奇数 (2d+1) なら3画素を面積で重み付けする (端の画素も捨てない)
+     */
+    static Taps boxTaps(int size, int x, int dsize) {
+        Taps taps;
+        if (size == 1) {
+            taps.count = 1;
+            taps.index[0] = 0;
+            taps.weight[0] = 1.0f;
+        }
+        else if (size % 2 == 0) {
+            taps.count = 2;
+            taps.index[0] = 2 * x;
+            taps.index[1] = 2 * x + 1;
+            taps.weight[0] = taps.weight[1] = 0.5f;
+        }
+        else {
+            const GLfloat n(static_cast<GLfloat>(size));
+            taps.count = 3;
+            for (int t = 0; t < 3; ++t) taps.index[t] = 2 * x + t;
+            taps.weight[0] = static_cast<GLfloat>(dsize - x) / n;
+            taps.weight[1] = static_cast<GLfloat>(dsize) / n;
+            taps.weight[2] = static_cast<GLfloat>(x + 1) / n;
+        }
+        return taps;
+    }
+
+    // 2x2の平均で縮小する (4チャンネルの浮動小数点数)
+    // どの経路も (上の行の2画素の和) + (下の行の2画素の和) の順に足し、0.25を掛ける
+    // 幅か高さが奇数なら端の画素を捨てないように3タップの重み付きで縮小する
+    static void downsampleBox(const GLfloat *src, int width, int height, GLfloat *dst, int dw, int dh) {
+        if (width % 2 != 0 || height % 2 != 0) {
+            downsampleBoxOdd(src, width, height, dst, dw, dh);
+            return;
+        }
+        for (int y = 0; y < dh; ++y) {
+            const GLfloat *const r0(src + static_cast<std::size_t>(2 * y) * width * 4);
+            const GLfloat *const r1(r0 + static_cast<std::size_t>(width) * 4);
+            GLfloat *const out(dst + static_cast<std::size_t>(y) * dw * 4);
+            int x(0);
+#if defined(__AVX__)
+            // 4画素 x 2行を読んで2画素を書く
+            const __m256 quarter(_mm256_set1_ps(0.25f));
+            for (; x + 1 < dw; x += 2) {
+                const __m256 a0(_mm256_loadu_ps(r0 + 8 * x)), a1(_mm256_loadu_ps(r0 + 8 * x + 8));
+                const __m256 b0(_mm256_loadu_ps(r1 + 8 * x)), b1(_mm256_loadu_ps(r1 + 8 * x + 8));
+                const __m256 top(_mm256_add_ps(_mm256_permute2f128_ps(a0, a1, 0x20), _mm256_permute2f128_ps(a0, a1, 0x31)));
+                const __m256 bottom(_mm256_add_ps(_mm256_permute2f128_ps(b0, b1, 0x20), _mm256_permute2f128_ps(b0, b1, 0x31)));
+                _mm256_storeu_ps(out + 4 * x, _mm256_mul_ps(_mm256_add_ps(top, bottom), quarter));
+            }
+#endif
+            for (; x < dw; ++x) {
+                const int x0(2 * x), x1(2 * x + 1);
+#if defined(MIP_GENERATOR_SSE2)
+                const __m128 top(_mm_add_ps(_mm_loadu_ps(r0 + 4 * x0), _mm_loadu_ps(r0 + 4 * x1)));
+                const __m128 bottom(_mm_add_ps(_mm_loadu_ps(r1 + 4 * x0), _mm_loadu_ps(r1 + 4 * x1)));
+                _mm_storeu_ps(out + 4 * x, _mm_mul_ps(_mm_add_ps(top, bottom), _mm_set1_ps(0.25f)));
+#else
+                for (int c = 0; c < 4; ++c)
+                    out[4 * x + c] = ((r0[4 * x0 + c] + r0[4 * x1 + c]) + (r1[4 * x0 + c] + r1[4 * x1 + c])) * 0.25f;
+#endif
+            }
+        }
+    }
+
+    // 幅か高さが奇数の画像を面積で重み付けして縮小する
+    static void downsampleBoxOdd(const GLfloat *src, int width, int height, GLfloat *dst, int dw, int dh) {
+        std::fill(dst, dst + static_cast<std::size_t>(dw) * dh * 4, 0.0f);
+        for (int y = 0; y < dh; ++y) {
+            const Taps rows(boxTaps(height, y, dh));
+            GLfloat *const out(dst + static_cast<std::size_t>(y) * dw * 4);
+            for (int x = 0; x < dw; ++x) {
+                const Taps columns(boxTaps(width, x, dw));
+                for (int j = 0; j < rows.count; ++j) {
+                    const GLfloat *const row(src + static_cast<std::size_t>(rows.index[j]) * width * 4);
+                    for (int i = 0; i < columns.count; ++i)
+                        accumulate(out + 4 * x, row + 4 * columns.index[i], rows.weight[j] * columns.weight[i]);
+                }
+            }
+        }
+    }
+
+    // カイザー窓付きのsincの重み (縮小後の画素の中心からの距離が -2.5, -1.5, ..., 2.5 の6タップ)
+    static const GLfloat *kaiserWeights() {
+        static const std::vector<GLfloat> weights([] {
+            // 0次の第1種変形ベッセル関数
+            auto bessel = [](double x) {
+                double sum(1.0), term(1.0);
+                for (int k = 1; k < 20; ++k) {
+                    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                    sum += term;
+                }
+                return sum;
+            };
+            const double pi(3.14159265358979323846), beta(4.0), radius(3.0);
+            std::vector<GLfloat> w(6);
+            double total(0.0);
+            for (int t = 0; t < 6; ++t) {
+                const double d(t - 2.5), x(d / 2.0);
+                const double sinc(std::sin(pi * x) / (pi * x));
+                const double window(bessel(beta * std::sqrt(1.0 - (d / radius) * (d / radius))) / bessel(beta));
+                w[t] = static_cast<GLfloat>(sinc * window);
+                total += w[t];
+            }
+            for (auto &v : w) v = static_cast<GLfloat>(v / total);
+            return w;
+        }());
+        return weights.data();
+    }
+
+    // カイザーフィルタで縮小する (横・縦の順に1次元のフィルタを掛ける)
+    static void downsampleKaiser(const GLfloat *src, int width, int height, GLfloat *dst, int dw, int dh) {
+        const GLfloat *const weight(kaiserWeights());
+
+        // 横方向
+        std::vector<GLfloat> temporary(static_cast<std::size_t>(dw) * height * 4, 0.0f);
+        for (int y = 0; y < height; ++y) {
+            const GLfloat *const row(src + static_cast<std::size_t>(y) * width * 4);
+            GLfloat *const out(&temporary[static_cast<std::size_t>(y) * dw * 4]);
+            for (int x = 0; x < dw; ++x)
+                for (int t = 0; t < 6; ++t)
+                    accumulate(out + 4 * x, row + 4 * std::min(std::max(2 * x - 2 + t, 0), width - 1), weight[t]);
+        }
+
+        // 縦方向
+        std::fill(dst, dst + static_cast<std::size_t>(dw) * dh * 4, 0.0f);
+        for (int y = 0; y < dh; ++y) {
+            GLfloat *const out(dst + static_cast<std::size_t>(y) * dw * 4);
+            for (int t = 0; t < 6; ++t) {
+                const GLfloat *const row(&temporary[static_cast<std::size_t>(std::min(std::max(2 * y - 2 + t, 0), height - 1)) * dw * 4]);
+                for (int x = 0; x < dw; ++x) accumulate(out + 4 * x, row + 4 * x, weight[t]);
+            }
+        }
+    }
+
+    // アルファに scale を掛けたときに閾値を超える画素の割合
+    static double coverage(const std::vector<GLfloat> &image, GLfloat reference, GLfloat scale) {
+        std::size_t count(0);
+        for (std::size_t i = 3; i < image.size(); i += 4)
+            if (image[i] * scale > reference) ++count;
+        return image.size() > 0 ? static_cast<double>(count) / (image.size() / 4) : 0.0;
+    }
+
+    // カバレッジが target になるアルファの倍率を二分探索で求める
+    static GLfloat coverageScale(const std::vector<GLfloat> &image, GLfloat reference, double target) {
+        GLfloat lower(0.0f), upper(16.0f);
+        for (int i = 0; i < 16; ++i) {
+            const GLfloat middle((lower + upper) * 0.5f);
+            if (coverage(image, reference, middle) < target) lower = middle;
+            else upper = middle;
+        }
+        return upper;
+    }
+
+    // 浮動小数点数の画像を8bitにする
+    static void store(const std::vector<GLfloat> &image, GLsizei channels, bool srgb, GLfloat alpha_scale, Level &level) {
+        const std::size_t count(static_cast<std::size_t>(level.width) * level.height);
+        level.pixels.resize(count * channels);
+        for (std::size_t i = 0; i < count; ++i) {
+            for (GLsizei c = 0; c < channels; ++c) {
+                const GLfloat value(image[i * 4 + c]);
+                GLubyte &out(level.pixels[i * channels + c]);
+                if (c == 3) out = toUnorm8(value * alpha_scale);
+                else if (srgb) out = linearToSrgb(value);
+                else out = toUnorm8(value);
+            }
+        }
+    }
+
+public:
+    // 全レベルの数
+    static int levelCount(GLsizei width, GLsizei height) {
+        int count(1);
+        while (width > 1 || height > 1) {
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+            ++count;
+        }
+        return count;
+    }
+
+    /*
+     * @fn
+     * ミップマップの全レベルを作る (どのスレッドからでも呼び出せる)
+     * @param pixels レベル0の画素 (行の間にすき間のない8bit)
+     * @param width レベル0の幅
+     * @param height レベル0の高さ
+     * @param channels 1画素のチャンネル数 (1〜4)
+     * @param options 生成の設定
+     * @return 全レベル (レベル0は pixels の複製)
+     * @detail sRGBの変換は3チャンネル以上のときだけ行う (OpenGLのsRGB形式がRGBとRGBAだけのため)
+     */
+    static Chain generate(const GLubyte *pixels, GLsizei width, GLsizei height, GLsizei channels,
+                          const Options &options = Options()) {
+        Chain chain;
+        chain.channels = channels;
+        chain.srgb = options.srgb && channels >= 3;
+        const bool coverage_enabled(options.alpha_coverage && channels == 4);
+
+        // レベル0を4チャンネルの浮動小数点数にする (足りないチャンネルは0, アルファは1)
+        const std::size_t count(static_cast<std::size_t>(width) * height);
+        std::vector<GLfloat> current(count * 4), next;
+        const GLfloat *const decode(srgbToLinear());
+        for (std::size_t i = 0; i < count; ++i) {
+            for (GLsizei c = 0; c < 4; ++c) {
+                if (c >= channels) current[i * 4 + c] = c == 3 ? 1.0f : 0.0f;
+                else if (chain.srgb && c < 3) current[i * 4 + c] = decode[pixels[i * channels + c]];
+                else current[i * 4 + c] = pixels[i * channels + c] / 255.0f;
+            }
+        }
+
+        Level base;
+        base.width = width;
+        base.height = height;
+        base.pixels.assign(pixels, pixels + count * channels);
+        chain.levels.reserve(levelCount(width, height));
+        chain.levels.push_back(std::move(base));
+        const double target(coverage_enabled ? coverage(current, options.alpha_reference, 1.0f) : 0.0);
+
+        // 1つ前のレベルから縮小していく (アルファの調整は書き出すときだけ行い、次の縮小には元の値を使う)
+        while (width > 1 || height > 1) {
+            const GLsizei dw(std::max(1, width / 2)), dh(std::max(1, height / 2));
+            next.assign(static_cast<std::size_t>(dw) * dh * 4, 0.0f);
+            if (options.filter == kaiser) downsampleKaiser(current.data(), width, height, next.data(), dw, dh);
+            else downsampleBox(current.data(), width, height, next.data(), dw, dh);
+
+            Level level;
+            level.width = dw;
+            level.height = dh;
+            const GLfloat alpha_scale(coverage_enabled ? coverageScale(next, options.alpha_reference, target) : 1.0f);
+            store(next, channels, chain.srgb, alpha_scale, level);
+            chain.levels.push_back(std::move(level));
+
+            current.swap(next);
+            width = dw;
+            height = dh;
+        }
+        return chain;
+    }
+
+    /*
+     * @fn
+     * 全レベルをテクスチャに転送する (描画スレッドで呼び出す)
+     * @param texture テクスチャオブジェクト名
+     * @param chain generate() で作った全レベル
+     */
+    static void upload(GLuint texture, const Chain &chain) {
+        const PixelFormat pixel(PixelFormat::fromChannels(chain.channels, chain.levels[0].width, chain.srgb));
+        glBindTexture(GL_TEXTURE_2D, texture);
+        for (std::size_t i = 0; i < chain.levels.size(); ++i) {
+            const Level &level(chain.levels[i]);
+            pixel.upload(static_cast<GLint>(i), level.width, level.height, level.pixels.data());
+        }
+        pixel.setSwizzle();
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(chain.levels.size()) - 1);
+    }
+};
@@ -5,8 +5,14 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
 #include <GL/glew.h>
 
+// 頂点の形式
+#include "VertexFormat.h"
+
 // 図形データ
 class Object {
 private:
@@ -25,6 +31,12 @@ private:
     // element buffer object
     GLuint ebo;
 
+    // インデックスの型 (GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_UNSIGNED_INT)
+    GLenum index_type;
+
+    // インデックスの数
+    GLsizei index_count;
+
 public:
     // 頂点配列オブジェクトの結合
     void bind() const {
@@ -36,30 +48,101 @@ public:
     struct Vertex {
         // 位置 position
         GLfloat position[2];
+
+        // 頂点の形式
+        typedef VertexFormat<Attribute<GL_FLOAT, 2>> Format;
     };
 
     // color attribute
     struct Vertex_With_Color {
         // 位置 RGB
         GLfloat position_color[5];
+
+        // 頂点の形式
+        typedef VertexFormat<Attribute<GL_FLOAT, 2>, Attribute<GL_FLOAT, 3>> Format;
     };
 
     struct Vertex_Textrue {
         GLfloat position_color_coord[7];
+
+        // 頂点の形式
+        typedef VertexFormat<Attribute<GL_FLOAT, 2>, Attribute<GL_FLOAT, 3>, Attribute<GL_FLOAT, 2>> Format;
     };
 
     struct indices{
         GLint indice[3];
     };
 
+    /*
+     * @fn
+     * インデックスの最大値が入る一番小さい型を選ぶ
+     * @param max インデックスの最大値
+     * @return GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_UNSIGNED_INT のいずれか
+     */
+    static GLenum selectIndexType(GLuint max) {
+        return max <= 0xff ? GL_UNSIGNED_BYTE : max <= 0xffff ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    // インデックスの型の1つあたりのバイト数
+    static GLsizei indexTypeSize(GLenum type) {
+        return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+    }
+
+    /*
+     * @fn
+     * インデックスを型に合わせて詰める
+     * @param index インデックスを格納した配列
+     * @param count インデックスの数
+     * @param type selectIndexType()で選んだ型を返す
+     * @return 詰めたインデックスのバイト列
+     */
+    static std::vector<GLubyte> packIndices(const GLuint *index, GLsizei count, GLenum &type) {
+        GLuint max(0);
+        for (GLsizei i = 0; i < count; ++i) max = std::max(max, index[i]);
+        type = selectIndexType(max);
+
+        std::vector<GLubyte> packed(count * indexTypeSize(type));
+        for (GLsizei i = 0; i < count; ++i) {
+            if (type == GL_UNSIGNED_BYTE) {
+                packed[i] = static_cast<GLubyte>(index[i]);
+            }
+            else if (type == GL_UNSIGNED_SHORT) {
+                const auto value(static_cast<GLushort>(index[i]));
+                std::memcpy(&packed[i * sizeof value], &value, sizeof value);
+            }
+            else {
+                std::memcpy(&packed[i * sizeof index[i]], &index[i], sizeof index[i]);
+            }
+        }
+        return packed;
+    }
+
+    // インデックスの型を取り出す
+    GLenum getIndexType() const { return index_type; }
+
+    // インデックスの数を取り出す (インデックスを使わなければ0)
+    GLsizei getIndexCount() const { return index_count; }
+
+    // 頂点バッファを共有するときに頂点の形式を指定する
+    template <typename V>
+    struct Shared {
+        // 頂点属性を格納しているバッファオブジェクト名
+        GLuint buffer;
+    };
+
     /*
      * @fn
      * コンストラクタ
      * @param size 頂点の位置の次元
      * @param vertex_count 頂点の数
      * @param vertex 頂点属性を格納した配列
+     * @detail 頂点属性の配置は V::Format から決まる
      */
-    Object(GLint size, GLsizei vertex_count, const Vertex *vertex) {
+    template <typename V>
+    Object(GLint size, GLsizei vertex_count, const V *vertex)
+    : ebo(0), index_type(GL_UNSIGNED_INT), index_count(0) {
+        static_assert(sizeof(V) == V::Format::stride, "Vertex struct does not match its format.");
+
         // 頂点配列オブジェクト
         glGenVertexArrays(1, &vao);
         glBindVertexArray(vao);
@@ -67,11 +150,10 @@ public:
         // 頂点バッファオブジェクト
         glGenBuffers(1, &vbo);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(Vertex), vertex, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(V), vertex, GL_STATIC_DRAW);
 
         // 結合されている頂点バッファオブジェクトをin変数から参照できるようにする
-        glVertexAttribPointer(0, size, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(0);
+        V::Format::setup(size);
     }
 
     /*
@@ -80,9 +162,15 @@ public:
      * @param size 頂点の位置の次元
      * @param vertex_count 頂点の数
      * @param vertex 頂点属性を格納した配列
-     * @param vertex_uv uv属性を格納した配列
+     * @param indices 頂点のインデックスを格納した配列
+     * @param index_count インデックスの数
+     * @detail インデックスは最大値が入る一番小さい型に詰めて転送する
      */
-    Object(GLint size, GLsizei vertex_count, const Vertex_With_Color *vertex) {
+    template <typename V>
+    Object(GLint size, GLsizei vertex_count, const V *vertex, const indices *indices, GLsizei index_count)
+    : index_count(index_count) {
+        static_assert(sizeof(V) == V::Format::stride, "Vertex struct does not match its format.");
+
         // 頂点配列オブジェクト
         glGenVertexArrays(1, &vao);
         glBindVertexArray(vao);
@@ -90,55 +178,46 @@ public:
         // 頂点バッファオブジェクト
         glGenBuffers(1, &vbo);
         glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(Vertex_With_Color), vertex, GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(V), vertex, GL_STATIC_DRAW);
 
+        glGenBuffers(1, &ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        const std::vector<GLubyte> packed(packIndices(reinterpret_cast<const GLuint *>(indices), index_count, index_type));
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, packed.size(), packed.data(), GL_STATIC_DRAW);
 
         // 結合されている頂点バッファオブジェクトをin変数から参照できるようにする
-        glVertexAttribPointer(0, size, GL_FLOAT, GL_FALSE, 5 * sizeof(float), 0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(2 * sizeof(float)));
-        glEnableVertexAttribArray(0);
-        glEnableVertexAttribArray(1);
+        V::Format::setup(size);
     }
 
     /*
      * @fn
      * コンストラクタ
      * @param size 頂点の位置の次元
-     * @param vertex_count 頂点の数
-     * @param vertex 頂点属性を格納した配列
-     * @param vertex_uv uv属性を格納した配列
+     * @param shared 頂点属性を格納しているバッファオブジェクト (StreamBuffer::getBuffer() など、このオブジェクトでは削除しない)
+     * @detail 頂点属性はバッファの先頭から並んでいるものとして、描画時に何番目の頂点から使うかを指定する
      */
-    Object(GLint size, GLsizei vertex_count, const Vertex_Textrue *vertex, const indices *indices) {
+    template <typename V>
+    Object(GLint size, Shared<V> shared)
+    : vbo(0), ebo(0), index_type(GL_UNSIGNED_INT), index_count(0) {
         // 頂点配列オブジェクト
         glGenVertexArrays(1, &vao);
         glBindVertexArray(vao);
 
-        // 頂点バッファオブジェクト
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(Vertex_Textrue), vertex, GL_STATIC_DRAW);
-
-        glGenBuffers(1, &ebo);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-
+        // 共有するバッファオブジェクト
+        glBindBuffer(GL_ARRAY_BUFFER, shared.buffer);
 
         // 結合されている頂点バッファオブジェクトをin変数から参照できるようにする
-        glVertexAttribPointer(0, size, GL_FLOAT, GL_FALSE, 7 * sizeof(float), 0);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)(2 * sizeof(float)));
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 7 * sizeof(float), (void*)(5 * sizeof(float)));
-        glEnableVertexAttribArray(0);
-        glEnableVertexAttribArray(1);
-        glEnableVertexAttribArray(2);
+        V::Format::setup(size);
     }
 
     // デストラクタ
     virtual ~Object(){
         // 頂点配列オブジェクトを削除する
-        glDeleteBuffers(1, &vao);
+        glDeleteVertexArrays(1, &vao);
 
         // 頂点バッファオブジェクトを削除する
         glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &ebo);
     }
 
 };
\ No newline at end of file
@@ -0,0 +1,74 @@
+/*
+ * @file PixelFormat.h
+ * @brief 画像のチャンネル数からテクスチャの形式を選ぶ
+ * @detail stb_image がデコードしたチャンネル数のまま変換せずに転送できるように、テクスチャの形式・画素の形式と
+ *         1行のバイト数に合った GL_UNPACK_ALIGNMENT を決める
+ *         1・2チャンネルは GL_R8・GL_RG8 にしてメモリを減らし、グレースケールに見えるようにスウィズルを設定する
+ */
+
+#pragma once
+
+#include <GL/glew.h>
+
+// テクスチャの形式
+struct PixelFormat {
+    // テクスチャの形式 (GL_RGBA8 など)
+    GLint internal_format;
+
+    // 画素の形式 (GL_RGBA など)
+    GLenum format;
+
+    // 1画素のチャンネル数
+    GLint channels;
+
+    // 1行のバイト数に合った GL_UNPACK_ALIGNMENT
+    GLint alignment;
+
+    /*
+     * @fn
+     * チャンネル数から形式を選ぶ
+     * @param channels 1画素のチャンネル数 (1: グレー, 2: グレー+アルファ, 3: RGB, 4: RGBA)
+     * @param width 画像の幅
+     * @param srgb 色がsRGBか (3チャンネル以上のとき GL_SRGB8・GL_SRGB8_ALPHA8 にする)
+     * @return テクスチャの形式
+     */
+    static PixelFormat fromChannels(GLint channels, GLsizei width, bool srgb = false) {
+        static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+        static const GLint linear[] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+        static const GLint gamma[] = { GL_R8, GL_RG8, GL_SRGB8, GL_SRGB8_ALPHA8 };
+        if (channels < 1 || channels > 4) channels = 4;
+
+        PixelFormat pixel;
+        pixel.internal_format = srgb ? gamma[channels - 1] : linear[channels - 1];
+        pixel.format = formats[channels - 1];
+        pixel.channels = channels;
+        pixel.alignment = alignmentOf(width * channels);
+        return pixel;
+    }
+
+    // 1行のバイト数から行の先頭がそろう一番大きな境界を求める
+    static GLint alignmentOf(GLsizei row) {
+        return row % 8 == 0 ? 8 : row % 4 == 0 ? 4 : row % 2 == 0 ? 2 : 1;
+    }
+
+    // 結合しているテクスチャに1・2チャンネルをグレースケールとして読むスウィズルを設定する
+    void setSwizzle() const {
+        if (channels > 2) return;
+        const GLint swizzle[] = { GL_RED, GL_RED, GL_RED, channels == 2 ? GL_GREEN : GL_ONE };
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+
+    /*
+     * @fn
+     * 結合しているテクスチャのレベルに画素を転送する
+     * @param level ミップマップのレベル (GL_UNPACK_ALIGNMENT はこのレベルの幅から決める)
+     * @param width 画像の幅
+     * @param height 画像の高さ
+     * @param pixels 画素 (行の間にすき間のない8bit)
+     */
+    void upload(GLint level, GLsizei width, GLsizei height, const void *pixels) const {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, alignmentOf(width * channels));
+        glTexImage2D(GL_TEXTURE_2D, level, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+};
@@ -0,0 +1,439 @@
+/*
+ * @file PixelUploader.h
+ * @brief ピクセルバッファオブジェクトを通してテクスチャに画素を転送するクラス
+ * @detail 決まった大きさのピクセルバッファオブジェクト(GL_PIXEL_UNPACK_BUFFER)を環状に並べ、マップした状態で
+ *         ワーカースレッドに渡す ワーカースレッドはデコードした画素を直接書き込み、描画スレッドはアンマップして
+ *         glTexSubImage2D() をバッファから実行するだけなので、ドライバが画素を同期してコピーする必要がない
+ *         転送が終わったかはフェンスで調べ、終わったバッファだけを次にマップする
+ *         1つのバッファに入らない大きな画像は、行の帯に分けて数フレームに渡って別のテクスチャに転送し、
+ *         全部の帯が届いてから転送先のテクスチャにコピーする (それまで転送先は元の内容 (代わりの模様など) のまま)
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <GL/glew.h>
+
+// ピクセルバッファオブジェクトによる転送
+class PixelUploader {
+public:
+    // ワーカースレッドが画素を書き込む領域
+    struct Staging {
+        // バッファの番号
+        std::size_t slot;
+
+        // マップしたポインタ (取れなければnullptr)
+        void *data;
+    };
+
+private:
+    // コピーコンストラクタによるコピー禁止
+    PixelUploader(const PixelUploader &u);
+
+    // 代入によるコピー禁止
+    PixelUploader &operator=(const PixelUploader &u);
+
+    // バッファ
+    struct Slot {
+        // ピクセルバッファオブジェクト名
+        GLuint pbo;
+
+        // 転送が終わったかを調べるフェンス (転送中でなければnullptr)
+        GLsync fence;
+
+        // マップしたポインタ
+        void *data;
+    };
+
+    // 帯に分けて転送する画像
+    struct Chunked {
+        // 転送先のテクスチャオブジェクト名
+        GLuint texture;
+
+        // 帯を転送していくテクスチャオブジェクト名 (終わったら転送先にコピーして削除する)
+        GLuint streaming;
+
+        // テクスチャの形式
+        GLint internal_format;
+
+        // 画像の大きさ
+        GLsizei width, height;
+
+        // 画素の形式と1画素のバイト数
+        GLenum format;
+        GLsizei channels;
+
+        // 画素
+        std::vector<GLubyte> pixels;
+
+        // 次に転送する行
+        GLsizei row;
+
+        // 最後の帯を転送した後でミップマップを作るか
+        bool mipmap;
+    };
+
+    // バッファ1つのバイト数
+    const std::size_t slot_bytes;
+
+    // バッファ
+    std::vector<Slot> slots;
+
+    // available を守る
+    std::mutex mutex;
+
+    // マップしてワーカースレッドに渡せるバッファ
+    std::deque<std::size_t> available;
+
+    // 帯に分けて転送している画像
+    std::deque<Chunked> chunked;
+
+    // 帯に分けて転送した画像をコピーするフレームバッファオブジェクト名 (使うまでは0)
+    GLuint framebuffers[2];
+
+    // 空きのバッファがなかった回数 (mutex で守る)・転送したバイト数
+    unsigned int stalls;
+    std::size_t uploaded;
+
+    // 画素の形式の1画素のバイト数
+    static GLsizei channelsOf(GLenum format) {
+        switch (format) {
+            case GL_RED: return 1;
+            case GL_RG: return 2;
+            case GL_RGB: return 3;
+            default: return 4;
+        }
+    }
+
+    // バッファをマップして渡せるようにする
+    void map(std::size_t index) {
+        Slot &slot(slots[index]);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+        // フェンスで転送が終わったことを確かめているので、古い内容を捨てて同期せずにマップする
+        slot.data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slot_bytes,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (slot.data == nullptr) {
+            std::cerr << "Can't map pixel unpack buffer" << std::endl;
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        available.push_back(index);
+    }
+
+    // バッファをアンマップしてテクスチャに転送し、フェンスを置く (compressed が0でなければブロック圧縮したデータのバイト数)
+    void transfer(std::size_t index, GLuint texture, GLint level, GLint x, GLint y, GLsizei width, GLsizei height,
+                  GLenum format, GLint internal_format, GLsizei compressed = 0) {
+        Slot &slot(slots[index]);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        slot.data = nullptr;
+
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (compressed > 0)
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, internal_format, width, height, 0, compressed, 0);
+        else if (internal_format != 0)
+            glTexImage2D(GL_TEXTURE_2D, level, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, 0);
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, level, x, y, width, height, format, GL_UNSIGNED_BYTE, 0);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        // クライアントのポインタを使う glTexImage2D() がオフセットと解釈されないように必ず外す
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        uploaded += compressed > 0 ? static_cast<std::size_t>(compressed) : static_cast<std::size_t>(width) * height * channelsOf(format);
+    }
+
+    // 帯を転送し終えたテクスチャを転送先にコピーする
+    void complete(const Chunked &image) {
+        if (framebuffers[0] == 0) glGenFramebuffers(2, framebuffers);
+        GLint read(0), draw(0);
+        glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read);
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw);
+
+        // ここで初めて転送先の領域を作り直すので、それまでは元の内容が表示される
+        glBindTexture(GL_TEXTURE_2D, image.texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, image.internal_format, image.width, image.height, 0, image.format, GL_UNSIGNED_BYTE,
+                     nullptr);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image.streaming, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image.texture, 0);
+
+        // レンダリングできない形式ならコピーしても何も起きないので、確かめてから使う
+        const bool blit(glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE
+                        && glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+        if (blit) {
+            // sRGB の形式でも値を変換せずにそのままコピーする
+            const GLboolean srgb(glIsEnabled(GL_FRAMEBUFFER_SRGB));
+            if (srgb) glDisable(GL_FRAMEBUFFER_SRGB);
+            glBlitFramebuffer(0, 0, image.width, image.height, 0, 0, image.width, image.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            if (srgb) glEnable(GL_FRAMEBUFFER_SRGB);
+        }
+
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, static_cast<GLuint>(read));
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, static_cast<GLuint>(draw));
+        glDeleteTextures(1, &image.streaming);
+
+        // コピーできなければ、まだ持っている画素から直接転送する
+        if (!blit) {
+            std::cerr << "Can't blit a streamed texture, uploading it directly" << std::endl;
+            glBindTexture(GL_TEXTURE_2D, image.texture);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, image.internal_format, image.width, image.height, 0, image.format, GL_UNSIGNED_BYTE,
+                         image.pixels.data());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        }
+    }
+
+    // 描画スレッドで空きのバッファを取り出す
+    bool take(std::size_t &index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (available.empty()) {
+            ++stalls;
+            return false;
+        }
+        index = available.front();
+        available.pop_front();
+        return true;
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param count バッファの数
+     * @param bytes バッファ1つのバイト数 (これより大きな画像は帯に分けて転送する)
+     * @detail OpenGLのコンテキストを作成した後で描画スレッドで呼び出す
+     */
+    explicit PixelUploader(std::size_t count = 4, std::size_t bytes = 16 << 20)
+    : slot_bytes(bytes), slots(count), stalls(0), uploaded(0) {
+        framebuffers[0] = framebuffers[1] = 0;
+        for (std::size_t i = 0; i < slots.size(); ++i) {
+            glGenBuffers(1, &slots[i].pbo);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[i].pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, slot_bytes, nullptr, GL_STREAM_DRAW);
+            slots[i].fence = nullptr;
+            slots[i].data = nullptr;
+            map(i);
+        }
+    }
+
+    // デストラクタ (ワーカースレッドが書き込みを終えてから描画スレッドで破棄する)
+    virtual ~PixelUploader() {
+        for (auto &slot : slots) {
+            if (slot.fence != nullptr) glDeleteSync(slot.fence);
+            if (slot.data != nullptr) {
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            }
+            glDeleteBuffers(1, &slot.pbo);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        for (const auto &image : chunked) glDeleteTextures(1, &image.streaming);
+        if (framebuffers[0] != 0) glDeleteFramebuffers(2, framebuffers);
+    }
+
+    /*
+     * @fn
+     * 画素を書き込む領域を取り出す (どのスレッドからでも呼び出せる)
+     * @param bytes 書き込むバイト数
+     * @return 書き込む領域 (空きがないか大きすぎれば data が nullptr)
+     * @detail 取り出した領域は upload() か cancel() で必ず返す
+     */
+    Staging claim(std::size_t bytes) {
+        Staging staging = { 0, nullptr };
+        if (bytes > slot_bytes) return staging;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (available.empty()) {
+            ++stalls;
+            return staging;
+        }
+        staging.slot = available.front();
+        staging.data = slots[staging.slot].data;
+        available.pop_front();
+        return staging;
+    }
+
+    // 使わなかった領域を返す (どのスレッドからでも呼び出せる)
+    void cancel(const Staging &staging) {
+        if (staging.data == nullptr) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        available.push_back(staging.slot);
+    }
+
+    /*
+     * @fn
+     * 書き込んだ領域をテクスチャに転送する (描画スレッドで呼び出す)
+     * @param staging claim() で取り出して画素を書き込んだ領域
+     * @param texture 転送先のテクスチャオブジェクト名
+     * @param x 転送先の位置
+     * @param y 転送先の位置
+     * @param width 転送する幅
+     * @param height 転送する高さ
+     * @param format 画素の形式 (GL_RGBA など, 行の間にすき間のない GL_UNSIGNED_BYTE)
+     * @param internal_format 0でなければこの形式でテクスチャの領域を作り直す (x, y は無視する)
+     * @param level ミップマップのレベル
+     */
+    void upload(const Staging &staging, GLuint texture, GLint x, GLint y, GLsizei width, GLsizei height,
+                GLenum format = GL_RGBA, GLint internal_format = 0, GLint level = 0) {
+        transfer(staging.slot, texture, level, x, y, width, height, format, internal_format);
+    }
+
+    /*
+     * @fn
+     * 書き込んだブロック圧縮のデータをテクスチャのレベルに転送する (描画スレッドで呼び出す)
+     * @param staging claim() で取り出してデータを書き込んだ領域
+     * @param texture 転送先のテクスチャオブジェクト名
+     * @param level ミップマップのレベル
+     * @param width レベルの幅
+     * @param height レベルの高さ
+     * @param internal_format 圧縮形式 (GL_COMPRESSED_RGBA_BPTC_UNORM など)
+     * @param bytes データのバイト数
+     */
+    void uploadCompressed(const Staging &staging, GLuint texture, GLint level, GLsizei width, GLsizei height,
+                          GLenum internal_format, GLsizei bytes) {
+        transfer(staging.slot, texture, level, 0, 0, width, height, 0, static_cast<GLint>(internal_format), bytes);
+    }
+
+    /*
+     * @fn
+     * 画像を帯に分けて転送する予約をする (描画スレッドで呼び出す)
+     * @param texture 転送先のテクスチャオブジェクト名 (全部の帯を転送し終えたときに領域を作り直す)
+     * @param width 画像の幅
+     * @param height 画像の高さ
+     * @param format 画素の形式
+     * @param pixels 画素 (行の間にすき間のない GL_UNSIGNED_BYTE)
+     * @param mipmap 最後の帯を転送した後でミップマップを作るか
+     * @param internal_format テクスチャの形式 (0なら format に合わせた8bitの形式,
+     *                        レンダリングできるとは限らない GL_SRGB8 は GL_SRGB8_ALPHA8 にする)
+     * @return 予約できたら true (画像が空か画素が足りなければ false)
+     */
+    bool enqueue(GLuint texture, GLsizei width, GLsizei height, GLenum format, std::vector<GLubyte> pixels, bool mipmap = true,
+                 GLint internal_format = 0) {
+        if (width <= 0 || height <= 0
+            || pixels.size() < static_cast<std::size_t>(width) * height * channelsOf(format)) {
+            std::cerr << "Can't stream an empty or truncated image (" << width << "x" << height << ")" << std::endl;
+            return false;
+        }
+
+        Chunked image;
+        image.texture = texture;
+        image.width = width;
+        image.height = height;
+        image.format = format;
+        image.channels = channelsOf(format);
+        image.pixels.swap(pixels);
+        image.row = 0;
+        image.mipmap = mipmap;
+
+        // 帯を転送していくテクスチャの領域を作っておく (転送先はまだ触らない)
+        if (internal_format == 0)
+            internal_format = format == GL_RED ? GL_R8 : format == GL_RG ? GL_RG8 : format == GL_RGB ? GL_RGB8 : GL_RGBA8;
+        if (internal_format == GL_SRGB8) internal_format = GL_SRGB8_ALPHA8;
+        image.internal_format = internal_format;
+        glGenTextures(1, &image.streaming);
+        glBindTexture(GL_TEXTURE_2D, image.streaming);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, nullptr);
+        chunked.push_back(std::move(image));
+        return true;
+    }
+
+    /*
+     * @fn
+     * 転送の終わったバッファをマップし直し、帯に分けた画像を予算の分だけ転送する (フレームごとに描画スレッドで呼び出す)
+     * @param budget 1フレームで帯の転送に使ってよいバイト数
+     * @return 転送を終えた画像の数
+     */
+    unsigned int update(std::size_t budget = 8 << 20) {
+        recycle();
+
+        unsigned int completed(0);
+        std::size_t bytes(0);
+        while (!chunked.empty() && bytes < budget) {
+            Chunked &image(chunked.front());
+            const std::size_t row_bytes(static_cast<std::size_t>(image.width) * image.channels);
+            const GLsizei rows(std::min<GLsizei>(image.height - image.row,
+                                                 static_cast<GLsizei>(std::max<std::size_t>(1, slot_bytes / row_bytes))));
+            if (row_bytes * rows > slot_bytes) {
+                // 1行もバッファに入らない
+                std::cerr << "Image row is too large for the pixel unpack buffer" << std::endl;
+                chunked.pop_front();
+                continue;
+            }
+
+            std::size_t index;
+            if (!take(index)) break;
+            std::memcpy(slots[index].data, image.pixels.data() + row_bytes * image.row, row_bytes * rows);
+            transfer(index, image.streaming, 0, 0, image.row, image.width, rows, image.format, 0);
+            image.row += rows;
+            bytes += row_bytes * rows;
+
+            if (image.row >= image.height) {
+                complete(image);
+                if (image.mipmap) {
+                    glBindTexture(GL_TEXTURE_2D, image.texture);
+                    glGenerateMipmap(GL_TEXTURE_2D);
+                }
+                chunked.pop_front();
+                ++completed;
+            }
+        }
+        return completed;
+    }
+
+    // 転送の終わったバッファをマップし直す (描画スレッドで呼び出す)
+    void recycle() {
+        for (std::size_t i = 0; i < slots.size(); ++i) {
+            Slot &slot(slots[i]);
+            if (slot.fence == nullptr) continue;
+            const GLenum status(glClientWaitSync(slot.fence, 0, 0));
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+            glDeleteSync(slot.fence);
+            slot.fence = nullptr;
+            map(i);
+        }
+    }
+
+    // テクスチャへの帯に分けた転送をやめる (テクスチャを破棄する前に呼び出す)
+    void discard(GLuint texture) {
+        for (const auto &image : chunked)
+            if (image.texture == texture) glDeleteTextures(1, &image.streaming);
+        chunked.erase(std::remove_if(chunked.begin(), chunked.end(),
+                                     [texture](const Chunked &image) { return image.texture == texture; }),
+                      chunked.end());
+    }
+
+    // テクスチャが帯に分けた転送の途中か
+    bool isPending(GLuint texture) const {
+        for (const auto &image : chunked)
+            if (image.texture == texture) return true;
+        return false;
+    }
+
+    // バッファ1つのバイト数
+    std::size_t getSlotBytes() const { return slot_bytes; }
+
+    // 帯に分けて転送している画像の数
+    std::size_t getChunkedCount() const { return chunked.size(); }
+
+    // 空きのバッファがなかった回数
+    unsigned int getStalls() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stalls;
+    }
+
+    // 転送したバイト数
+    std::size_t getUploadedBytes() const { return uploaded; }
+};
@@ -0,0 +1,669 @@
+/*
+ * @file PngDecoder.h
+ * @brief stb_image より速い8bitのPNGのデコーダ
+ * @detail stb_image と同じ形の関数 loadFromMemory() で、テクスチャに使う8bitでインターレースなしのPNGをデコードする
+ *             inflate は64bitのビットバッファにまとめて読み込み、11bitの表で符号の長さ・長さと距離の基数・追加ビット数まで
+ *             1回で引く (長い符号だけ正準ハフマン符号として調べる)
+ *             行のフィルタ(Sub/Up/Average/Paeth)は SSE2 があれば、3・4チャンネルは1画素の全チャンネルを、
+ *             Up は16バイトずつまとめて戻す
+ *         16bit・1/2/4bit・インターレース・グレーとRGBの透過色(tRNS)・iPhoneのPNG(CgBI)には対応せず nullptr を返すので、
+ *         呼び出し側で stb_image に任せる (ImageDecoder はそうしている)
+ *         画素は std::malloc() で確保するので stbi_image_free() か std::free() で解放する
+ *         状態を持たないので複数のスレッドから同時に呼び出せる (失敗の理由はスレッドごと)
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PNG_DECODER_SSE2 1
+#endif
+
+// PNGのデコーダ
+class PngDecoder {
+    // 表の項目の種類 (表の項目は 符号の長さ 4bit | 種類 2bit | 追加ビット数 5bit | 値 16bit)
+    enum Kind { literal = 0, copy = 1, end = 2, invalid = 3 };
+
+    // 表の項目を作る
+    static std::uint32_t entry(Kind kind, std::uint32_t extra, std::uint32_t value) {
+        return (static_cast<std::uint32_t>(kind) << 4) | (extra << 8) | (value << 16);
+    }
+
+    // ハフマン符号の表
+    struct Huffman {
+        // 1回で引く符号の長さ
+        static const int fast_bits = 11;
+
+        // 下位 fast_bits ビットで引く表 (符号の長さが0なら長い符号)
+        std::uint32_t fast[1 << fast_bits];
+
+        // 正準ハフマン符号の長さごとの最初の符号と記号の位置・長さごとの符号の上限 (16bitに左詰め)
+        std::uint16_t firstcode[16], firstsymbol[16];
+        std::int32_t maxcode[17];
+
+        // 符号の順に並べた記号とその符号の長さ
+        std::uint16_t value[288];
+        std::uint8_t size[288];
+
+        // 記号ごとの項目
+        std::uint32_t info[288];
+
+        /*
+         * @fn
+         * 符号の長さの並びから表を作る
+         * @param lengths 記号ごとの符号の長さ
+         * @param count 記号の数
+         * @param infos 記号ごとの項目 (符号の長さは入れない)
+         * @return 正しい符号なら true
+         */
+        bool build(const std::uint8_t *lengths, int count, const std::uint32_t *infos) {
+            int sizes[17] = {}, next[16];
+            std::memset(fast, 0, sizeof fast);
+            std::memset(size, 0, sizeof size);
+            for (int i = 0; i < count; ++i) ++sizes[lengths[i]];
+            sizes[0] = 0;
+            for (int i = 1; i < 16; ++i)
+                if (sizes[i] > (1 << i)) return false;
+            int code(0), k(0);
+            for (int i = 1; i < 16; ++i) {
+                next[i] = code;
+                firstcode[i] = static_cast<std::uint16_t>(code);
+                firstsymbol[i] = static_cast<std::uint16_t>(k);
+                code += sizes[i];
+                if (sizes[i] > 0 && code - 1 >= (1 << i)) return false;
+                maxcode[i] = code << (16 - i);
+                code <<= 1;
+                k += sizes[i];
+            }
+            maxcode[16] = 0x10000;
+            for (int i = 0; i < count; ++i) {
+                info[i] = infos[i];
+                const int length(lengths[i]);
+                if (length == 0) continue;
+                const int index(next[length] - firstcode[length] + firstsymbol[length]);
+                value[index] = static_cast<std::uint16_t>(i);
+                size[index] = static_cast<std::uint8_t>(length);
+                if (length <= fast_bits) {
+                    // ビットの順を反転して、下位ビットが同じ項目すべてに入れる
+                    for (int j = reverse(next[length], length); j < (1 << fast_bits); j += 1 << length)
+                        fast[j] = infos[i] | static_cast<std::uint32_t>(length);
+                }
+                ++next[length];
+            }
+            return true;
+        }
+    };
+
+    // ビットの順を反転する
+    static int reverse(int code, int bits) {
+        int result(0);
+        for (int i = 0; i < bits; ++i, code >>= 1) result = (result << 1) | (code & 1);
+        return result;
+    }
+
+    // 下位ビットから読むビット列
+    struct Bits {
+        // 読んでいる位置と終わり
+        const std::uint8_t *in, *last;
+
+        // ビットバッファ・中のビット数・終わりを超えて0を入れたバイト数
+        std::uint64_t bits;
+        int count, padding;
+
+        // ビットバッファを56ビット以上にする
+        void refill() {
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            if (last - in >= 8) {
+                // 8バイトまとめて読み、入った分だけ進める
+                std::uint64_t word;
+                std::memcpy(&word, in, sizeof word);
+                bits |= word << count;
+                in += (63 - count) >> 3;
+                count |= 56;
+                return;
+            }
+#endif
+            for (; count <= 56; count += 8) {
+                if (in < last) bits |= static_cast<std::uint64_t>(*in++) << count;
+                else ++padding;
+            }
+        }
+
+        // n ビット取り出す (n は refill() した後の count まで)
+        std::uint32_t take(int n) {
+            const std::uint32_t value(static_cast<std::uint32_t>(bits & ((std::uint64_t(1) << n) - 1)));
+            bits >>= n;
+            count -= n;
+            return value;
+        }
+
+        // 符号を1つ読んで項目を返す
+        std::uint32_t decode(const Huffman &table) {
+            std::uint32_t item(table.fast[bits & ((1 << Huffman::fast_bits) - 1)]);
+            if (item & 15) {
+                take(item & 15);
+                return item;
+            }
+            // 長い符号は16bitを反転して長さを探す
+            const int k(reverse(static_cast<int>(bits & 0xffff), 16));
+            int size(Huffman::fast_bits + 1);
+            while (k >= table.maxcode[size]) ++size;
+            if (size >= 16) return entry(invalid, 0, 0);
+            const int index((k >> (16 - size)) - table.firstcode[size] + table.firstsymbol[size]);
+            if (index < 0 || index >= 288 || table.size[index] != size) return entry(invalid, 0, 0);
+            take(size);
+            return table.info[table.value[index]];
+        }
+
+        // 終わりを超えたビットを使ったか
+        bool overrun() const { return padding * 8 > count; }
+    };
+
+    // 長さと距離の記号の項目
+    static const std::uint32_t *lengthInfos() {
+        static const std::uint16_t base[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                              35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const std::uint8_t extra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                              3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        struct Table {
+            std::uint32_t items[288];
+            Table() {
+                for (int i = 0; i < 256; ++i) items[i] = entry(literal, 0, i);
+                items[256] = entry(end, 0, 0);
+                for (int i = 0; i < 29; ++i) items[257 + i] = entry(copy, extra[i], base[i]);
+                items[286] = items[287] = entry(invalid, 0, 0);
+            }
+        };
+        static const Table table;
+        return table.items;
+    }
+
+    static const std::uint32_t *distanceInfos() {
+        static const std::uint16_t base[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                              257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        struct Table {
+            std::uint32_t items[32];
+            Table() {
+                for (int i = 0; i < 30; ++i) items[i] = entry(copy, i < 4 ? 0 : i / 2 - 1, base[i]);
+                items[30] = items[31] = entry(invalid, 0, 0);
+            }
+        };
+        static const Table table;
+        return table.items;
+    }
+
+    // 固定ハフマン符号の表
+    struct Fixed {
+        Huffman length, distance;
+        Fixed() {
+            std::uint8_t sizes[288];
+            for (int i = 0; i < 288; ++i) sizes[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            length.build(sizes, 288, lengthInfos());
+            for (int i = 0; i < 32; ++i) sizes[i] = 5;
+            distance.build(sizes, 32, distanceInfos());
+        }
+    };
+
+    // 動的ハフマン符号の表を読む
+    static bool readTables(Bits &bits, Huffman &length, Huffman &distance) {
+        static const std::uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+        bits.refill();
+        const int literals(static_cast<int>(bits.take(5)) + 257);
+        const int distances(static_cast<int>(bits.take(5)) + 1);
+        const int codes(static_cast<int>(bits.take(4)) + 4);
+        std::uint8_t sizes[19] = {};
+        for (int i = 0; i < codes; ++i) {
+            bits.refill();
+            sizes[order[i]] = static_cast<std::uint8_t>(bits.take(3));
+        }
+        std::uint32_t infos[19];
+        for (int i = 0; i < 19; ++i) infos[i] = entry(literal, 0, i);
+        Huffman lengths;
+        if (!lengths.build(sizes, 19, infos)) return false;
+
+        // 符号の長さを読む (16: 直前を繰り返す, 17・18: 0を繰り返す)
+        std::uint8_t all[288 + 32];
+        const int total(literals + distances);
+        for (int n = 0; n < total;) {
+            bits.refill();
+            const std::uint32_t item(bits.decode(lengths));
+            if (((item >> 4) & 3) == invalid) return false;
+            const int symbol(static_cast<int>(item >> 16));
+            int repeat(1);
+            std::uint8_t size(static_cast<std::uint8_t>(symbol));
+            if (symbol == 16) {
+                if (n == 0) return false;
+                repeat = 3 + static_cast<int>(bits.take(2));
+                size = all[n - 1];
+            }
+            else if (symbol == 17) {
+                repeat = 3 + static_cast<int>(bits.take(3));
+                size = 0;
+            }
+            else if (symbol == 18) {
+                repeat = 11 + static_cast<int>(bits.take(7));
+                size = 0;
+            }
+            if (n + repeat > total) return false;
+            std::memset(all + n, size, repeat);
+            n += repeat;
+        }
+        if (all[256] == 0) return false;
+        return length.build(all, literals, lengthInfos()) && distance.build(all + literals, distances, distanceInfos());
+    }
+
+    // ハフマン符号のブロックを展開する
+    static bool inflateBlock(Bits &state, const Huffman &length, const Huffman &distance,
+                             std::uint8_t *begin, std::uint8_t *&position, std::uint8_t *stop) {
+        // 出力への書き込みと別名にならないように、ビット列と位置はローカルに写してレジスタに置く
+        Bits bits(state);
+        std::uint8_t *out(position);
+        bool ok(false);
+        for (;;) {
+            // 長さ・追加ビット・距離・追加ビットで最大48ビット
+            if (bits.count < 48) bits.refill();
+            const std::uint32_t item(bits.decode(length));
+            const std::uint32_t kind((item >> 4) & 3);
+            if (kind == literal) {
+                if (out == stop) break;
+                *out++ = static_cast<std::uint8_t>(item >> 16);
+                continue;
+            }
+            if (kind != copy) {
+                ok = kind == end;
+                break;
+            }
+            const std::size_t size((item >> 16) + bits.take((item >> 8) & 31));
+            const std::uint32_t code(bits.decode(distance));
+            if (((code >> 4) & 3) != copy) break;
+            const std::size_t offset((code >> 16) + bits.take((code >> 8) & 31));
+            if (offset > static_cast<std::size_t>(out - begin) || size > static_cast<std::size_t>(stop - out)) break;
+
+            const std::uint8_t *from(out - offset);
+            std::uint8_t *const to(out + size);
+            if (offset >= 8) {
+                // 8バイトずつ写す (出力の後ろには8バイトの余白がある)
+                do {
+                    std::memcpy(out, from, 8);
+                    out += 8;
+                    from += 8;
+                } while (out < to);
+            }
+            else if (offset == 1) {
+                std::memset(out, out[-1], size);
+            }
+            else {
+                for (; out < to; ++out, ++from) *out = *from;
+            }
+            out = to;
+        }
+        state = bits;
+        position = out;
+        return ok;
+    }
+
+    /*
+     * @fn
+     * zlib のストリームを展開する
+     * @param data ストリーム
+     * @param size バイト数
+     * @param out 展開先 (size + 8 バイト以上)
+     * @param expected 展開したバイト数 (これと違えば失敗)
+     * @return 展開できたら true
+     */
+    static bool inflate(const std::uint8_t *data, std::size_t size, std::uint8_t *out, std::size_t expected) {
+        if (size < 2 || ((data[0] << 8) | data[1]) % 31 != 0 || (data[0] & 15) != 8 || (data[1] & 32) != 0)
+            return fail("bad zlib header");
+        static const Fixed fixed;
+        Bits bits = { data + 2, data + size, 0, 0, 0 };
+        std::uint8_t *position(out), *const stop(out + expected);
+        Huffman length, distance;
+        for (bool final(false); !final;) {
+            bits.refill();
+            final = bits.take(1) != 0;
+            const std::uint32_t type(bits.take(2));
+            if (type == 0) {
+                // 無圧縮のブロックはバイト境界にそろえ、ビットバッファに読み込み済みのバイトを戻してから写す
+                bits.take(bits.count & 7);
+                const int buffered(bits.count / 8 - bits.padding);
+                if (buffered < 0) return fail("corrupt deflate stream");
+                bits.in -= buffered;
+                bits.bits = 0;
+                bits.count = bits.padding = 0;
+                if (bits.last - bits.in < 4) return fail("corrupt deflate stream");
+                const std::size_t bytes(bits.in[0] | (bits.in[1] << 8));
+                if ((bytes ^ 0xffff) != static_cast<std::size_t>(bits.in[2] | (bits.in[3] << 8))) return fail("corrupt stored block");
+                bits.in += 4;
+                if (static_cast<std::size_t>(bits.last - bits.in) < bytes || static_cast<std::size_t>(stop - position) < bytes)
+                    return fail("corrupt stored block");
+                std::memcpy(position, bits.in, bytes);
+                position += bytes;
+                bits.in += bytes;
+            }
+            else if (type == 1) {
+                if (!inflateBlock(bits, fixed.length, fixed.distance, out, position, stop)) return fail("corrupt deflate stream");
+            }
+            else if (type == 2) {
+                if (!readTables(bits, length, distance)) return fail("bad huffman table");
+                if (!inflateBlock(bits, length, distance, out, position, stop)) return fail("corrupt deflate stream");
+            }
+            else {
+                return fail("bad block type");
+            }
+            if (bits.overrun()) return fail("unexpected end of deflate stream");
+        }
+        return position == stop ? true : fail("not enough pixels");
+    }
+
+    // Paeth の予測
+    static int paeth(int a, int b, int c) {
+        const int p(a + b - c), pa(std::abs(p - a)), pb(std::abs(p - b)), pc(std::abs(p - c));
+        return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+    }
+
+#if defined(PNG_DECODER_SSE2)
+    // 1画素(1-4バイト)を読む
+    static __m128i load(const std::uint8_t *p, int bytes) {
+        int value(0);
+        std::memcpy(&value, p, bytes);
+        return _mm_cvtsi32_si128(value);
+    }
+
+    // 1画素(1-4バイト)を書く
+    static void store(std::uint8_t *p, __m128i x, int bytes) {
+        const int value(_mm_cvtsi128_si32(x));
+        std::memcpy(p, &value, bytes);
+    }
+
+    // 3・4チャンネルの行のフィルタを画素ごとに全チャンネルまとめて戻す
+    static void unfilterPixels(int filter, std::uint8_t *dst, const std::uint8_t *src, const std::uint8_t *prev,
+                               std::size_t stride, int bpp) {
+        const __m128i zero(_mm_setzero_si128());
+        __m128i a(zero), c(zero);
+        switch (filter) {
+            case 1:
+                for (std::size_t i = 0; i < stride; i += bpp) {
+                    a = _mm_add_epi8(a, load(src + i, bpp));
+                    store(dst + i, a, bpp);
+                }
+                break;
+            case 3:
+                for (std::size_t i = 0; i < stride; i += bpp) {
+                    // _mm_avg_epu8() は切り上げるので、奇数の和なら1引いて切り捨てにする
+                    const __m128i b(load(prev + i, bpp));
+                    const __m128i average(_mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1))));
+                    a = _mm_add_epi8(load(src + i, bpp), average);
+                    store(dst + i, a, bpp);
+                }
+                break;
+            case 4:
+                for (std::size_t i = 0; i < stride; i += bpp) {
+                    // 16bitに広げて |p-a| = |b-c|, |p-b| = |a-c|, |p-c| = |a+b-2c| を比べる
+                    const __m128i b(_mm_unpacklo_epi8(load(prev + i, bpp), zero));
+                    __m128i pa(_mm_sub_epi16(b, c)), pb(_mm_sub_epi16(a, c));
+                    __m128i pc(_mm_add_epi16(pa, pb));
+                    pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+                    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+                    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+                    const __m128i smallest(_mm_min_epi16(pc, _mm_min_epi16(pa, pb)));
+                    const __m128i use_a(_mm_cmpeq_epi16(smallest, pa)), use_b(_mm_cmpeq_epi16(smallest, pb));
+                    const __m128i bc(_mm_or_si128(_mm_and_si128(use_b, b), _mm_andnot_si128(use_b, c)));
+                    const __m128i nearest(_mm_or_si128(_mm_and_si128(use_a, a), _mm_andnot_si128(use_a, bc)));
+                    const __m128i x(_mm_add_epi8(load(src + i, bpp), _mm_packus_epi16(nearest, nearest)));
+                    store(dst + i, x, bpp);
+                    a = _mm_unpacklo_epi8(x, zero);
+                    c = b;
+                }
+                break;
+        }
+    }
+#endif
+
+    // 1行のフィルタを戻す
+    static void unfilter(int filter, std::uint8_t *dst, const std::uint8_t *src, const std::uint8_t *prev,
+                         std::size_t stride, int bpp) {
+        std::size_t i(0);
+        switch (filter) {
+            case 0:
+                std::memcpy(dst, src, stride);
+                return;
+            case 2:
+#if defined(PNG_DECODER_SSE2)
+                for (; i + 16 <= stride; i += 16) {
+                    const __m128i x(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i)));
+                    const __m128i b(_mm_loadu_si128(reinterpret_cast<const __m128i *>(prev + i)));
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_add_epi8(x, b));
+                }
+#endif
+                for (; i < stride; ++i) dst[i] = static_cast<std::uint8_t>(src[i] + prev[i]);
+                return;
+        }
+#if defined(PNG_DECODER_SSE2)
+        if (bpp >= 3) {
+            unfilterPixels(filter, dst, src, prev, stride, bpp);
+            return;
+        }
+#endif
+        const std::size_t first(std::min<std::size_t>(bpp, stride));
+        switch (filter) {
+            case 1:
+                std::memcpy(dst, src, first);
+                for (i = first; i < stride; ++i) dst[i] = static_cast<std::uint8_t>(src[i] + dst[i - bpp]);
+                break;
+            case 3:
+                for (; i < first; ++i) dst[i] = static_cast<std::uint8_t>(src[i] + (prev[i] >> 1));
+                for (; i < stride; ++i) dst[i] = static_cast<std::uint8_t>(src[i] + ((dst[i - bpp] + prev[i]) >> 1));
+                break;
+            case 4:
+                for (; i < first; ++i) dst[i] = static_cast<std::uint8_t>(src[i] + prev[i]);
+                for (; i < stride; ++i) dst[i] = static_cast<std::uint8_t>(src[i] + paeth(dst[i - bpp], prev[i], prev[i - bpp]));
+                break;
+        }
+    }
+
+    // 輝度 (stb_image と同じ重み)
+    static std::uint8_t luma(const std::uint8_t *p) {
+        return static_cast<std::uint8_t>((p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8);
+    }
+
+    // チャンネル数を変換する (stb_image と同じ結果にする)
+    static void convert(const std::uint8_t *src, int from, std::uint8_t *dst, int to, std::size_t count) {
+        for (std::size_t i = 0; i < count; ++i, src += from, dst += to) {
+            const bool gray(from < 3);
+            const std::uint8_t alpha(from == 2 ? src[1] : from == 4 ? src[3] : 255);
+            switch (to) {
+                case 1:
+                    dst[0] = gray ? src[0] : luma(src);
+                    break;
+                case 2:
+                    dst[0] = gray ? src[0] : luma(src);
+                    dst[1] = alpha;
+                    break;
+                default:
+                    dst[0] = src[0];
+                    dst[1] = gray ? src[0] : src[1];
+                    dst[2] = gray ? src[0] : src[2];
+                    if (to == 4) dst[3] = alpha;
+                    break;
+            }
+        }
+    }
+
+    // このスレッドで最後に失敗した理由
+    static const char *&reason() {
+        static thread_local const char *value("");
+        return value;
+    }
+
+    // 失敗の理由を記録する
+    static bool fail(const char *message) {
+        reason() = message;
+        return false;
+    }
+
+    // ビッグエンディアンの32bit
+    static std::uint32_t read32(const std::uint8_t *p) {
+        return (static_cast<std::uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+public:
+    // PNGのシグネチャで始まるか
+    static bool isPng(const unsigned char *buffer, std::size_t len) {
+        static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+        return len >= 8 && std::memcmp(buffer, signature, 8) == 0;
+    }
+
+    /*
+     * @fn
+     * メモリにあるPNGをデコードする (stbi_load_from_memory() と同じ形)
+     * @param buffer ファイルの中身
+     * @param len バイト数
+     * @param x 幅を返す
+     * @param y 高さを返す
+     * @param comp ファイルのチャンネル数を返す (パレットは3か4)
+     * @param req_comp 出力のチャンネル数 (0ならファイルのまま)
+     * @return 画素 (対応しない形式か壊れていればnullptr, 理由は failureReason())
+     */
+    static unsigned char *loadFromMemory(const unsigned char *buffer, int len, int *x, int *y, int *comp, int req_comp) {
+        if (len < 0 || !isPng(buffer, static_cast<std::size_t>(len))) {
+            fail("not a PNG");
+            return nullptr;
+        }
+        if (req_comp < 0 || req_comp > 4) {
+            fail("bad req_comp");
+            return nullptr;
+        }
+
+        // チャンクを読む (CRCは調べない)
+        const std::uint8_t *p(buffer + 8), *const last(buffer + len);
+        std::uint32_t width(0), height(0);
+        int color(-1);
+        std::uint8_t palette[256 * 4] = {};
+        int palette_size(0);
+        bool transparent(false);
+        std::vector<std::uint8_t> compressed;
+        const std::uint8_t *single(nullptr);
+        std::size_t single_size(0), idats(0);
+        while (last - p >= 12) {
+            const std::uint32_t size(read32(p));
+            const std::uint8_t *const type(p + 4), *const data(p + 8);
+            if (size > static_cast<std::size_t>(last - data) - 4) break;
+            if (std::memcmp(type, "IHDR", 4) == 0) {
+                if (size != 13) break;
+                width = read32(data);
+                height = read32(data + 4);
+                color = data[9];
+                // 8bitでインターレースなしのものだけ
+                if (data[8] != 8 || data[10] != 0 || data[11] != 0 || data[12] != 0) {
+                    fail("unsupported PNG layout");
+                    return nullptr;
+                }
+            }
+            else if (std::memcmp(type, "CgBI", 4) == 0) {
+                fail("iPhone PNG");
+                return nullptr;
+            }
+            else if (std::memcmp(type, "PLTE", 4) == 0) {
+                palette_size = static_cast<int>(size / 3);
+                if (palette_size > 256 || size % 3 != 0) break;
+                for (int i = 0; i < palette_size; ++i) {
+                    std::memcpy(palette + i * 4, data + i * 3, 3);
+                    palette[i * 4 + 3] = 255;
+                }
+            }
+            else if (std::memcmp(type, "tRNS", 4) == 0) {
+                if (color != 3) {
+                    fail("unsupported transparency");
+                    return nullptr;
+                }
+                if (static_cast<int>(size) > palette_size) break;
+                for (std::uint32_t i = 0; i < size; ++i) palette[i * 4 + 3] = data[i];
+                transparent = true;
+            }
+            else if (std::memcmp(type, "IDAT", 4) == 0) {
+                // IDATが1つならコピーせずにそのまま展開する
+                if (idats++ == 0) {
+                    single = data;
+                    single_size = size;
+                }
+                else {
+                    if (idats == 2) compressed.assign(single, single + single_size);
+                    compressed.insert(compressed.end(), data, data + size);
+                }
+            }
+            else if (std::memcmp(type, "IEND", 4) == 0) {
+                break;
+            }
+            p = data + size + 4;
+        }
+        static const int channels_of[7] = { 1, 0, 3, 1, 2, 0, 4 };
+        if (color < 0 || color > 6 || channels_of[color] == 0 || idats == 0 || width == 0 || height == 0
+            || (color == 3 && palette_size == 0)) {
+            fail("corrupt PNG");
+            return nullptr;
+        }
+        if (width > (1u << 24) || height > (1u << 24) || static_cast<std::uint64_t>(width) * height > (1u << 28)) {
+            fail("too large");
+            return nullptr;
+        }
+
+        // 展開する (各行の先頭はフィルタの種類)
+        const int bpp(channels_of[color]);
+        const std::size_t stride(static_cast<std::size_t>(width) * bpp);
+        const std::size_t raw_size((stride + 1) * height);
+        std::vector<std::uint8_t> raw(raw_size + 8);
+        const bool inflated(idats == 1 ? inflate(single, single_size, raw.data(), raw_size)
+                                       : inflate(compressed.data(), compressed.size(), raw.data(), raw_size));
+        if (!inflated) return nullptr;
+
+        // フィルタを戻す
+        const int file_channels(color == 3 ? (transparent ? 4 : 3) : bpp);
+        const int out_channels(req_comp != 0 ? req_comp : file_channels);
+        const std::size_t count(static_cast<std::size_t>(width) * height);
+        const bool direct(color != 3 && out_channels == bpp);
+        unsigned char *const pixels(static_cast<unsigned char *>(std::malloc(count * out_channels)));
+        std::vector<std::uint8_t> rows(direct ? 0 : stride * height);
+        if (pixels == nullptr) {
+            fail("out of memory");
+            return nullptr;
+        }
+        std::uint8_t *const image(direct ? pixels : rows.data());
+        const std::vector<std::uint8_t> zero(stride, 0);
+        for (std::uint32_t row = 0; row < height; ++row) {
+            const std::uint8_t *const src(raw.data() + row * (stride + 1));
+            if (src[0] > 4) {
+                std::free(pixels);
+                fail("invalid filter");
+                return nullptr;
+            }
+            unfilter(src[0], image + row * stride, src + 1, row > 0 ? image + (row - 1) * stride : zero.data(), stride, bpp);
+        }
+
+        // パレットを引き、チャンネル数を合わせる
+        if (color == 3) {
+            std::vector<std::uint8_t> expanded(out_channels == 4 || out_channels == file_channels ? 0 : count * file_channels);
+            std::uint8_t *const target(expanded.empty() ? pixels : expanded.data());
+            const int channels(expanded.empty() ? out_channels : file_channels);
+            for (std::size_t i = 0; i < count; ++i) std::memcpy(target + i * channels, palette + rows[i] * 4, channels);
+            if (!expanded.empty()) convert(expanded.data(), file_channels, pixels, out_channels, count);
+        }
+        else if (!direct) {
+            convert(rows.data(), bpp, pixels, out_channels, count);
+        }
+        *x = static_cast<int>(width);
+        *y = static_cast<int>(height);
+        if (comp != nullptr) *comp = file_channels;
+        return pixels;
+    }
+
+    // このスレッドで最後に失敗した理由
+    static const char *failureReason() {
+        return reason();
+    }
+};
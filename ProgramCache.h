@@ -0,0 +1,297 @@
+/*
+ * @file ProgramCache.h
+ * @brief プログラムオブジェクトのバイナリをディスクに保存するクラス
+ * @detail シェーダのソースとドライバの情報から作ったキーでglGetProgramBinary()の結果を保存し、
+ *         次の起動時にはglProgramBinary()で読み込んでコンパイルとリンクを省略する
+ *         ドライバが変わったりバイナリが受け付けられなかったときは呼び出し側でコンパイルし直す
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <GL/glew.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+// プログラムオブジェクトのバイナリキャッシュ
+class ProgramCache {
+    // コピーコンストラクタによるコピー禁止
+    ProgramCache(const ProgramCache &c);
+
+    // 代入によるコピー禁止
+    ProgramCache &operator=(const ProgramCache &c);
+
+    // キャッシュファイルの先頭に置く識別子とファイル形式の版
+    static constexpr std::uint32_t magic = 0x42504c47; // "GLPB"
+    static constexpr std::uint32_t version = 1;
+
+    // キャッシュファイルを置くディレクトリ
+    const std::string directory;
+
+    // ドライバのベンダ・レンダラ・バージョンを連結した文字列
+    std::string driver;
+
+    // プログラムバイナリが使えるか (バイナリ形式が一つもなければ使えない)
+    bool enabled;
+
+    // キャッシュに見つかった数・見つからなかった数・見つかったがドライバに拒否された数
+    unsigned int hits, misses, rejects;
+
+    // キャッシュから読み込むのにかかった時間・コンパイルにかかった時間・節約できた時間 [ms]
+    double loadMillis, compileMillis, savedMillis;
+
+    // 計測中のキー・コンパイル開始時刻
+    std::string pending;
+    std::chrono::steady_clock::time_point start;
+
+    // FNV-1a 64bit ハッシュ
+    static std::uint64_t hash(const char *str, std::uint64_t h = 14695981039346656037ULL) {
+        if (str == nullptr) return h;
+        for (; *str != '\0'; ++str) {
+            h ^= static_cast<unsigned char>(*str);
+            h *= 1099511628211ULL;
+        }
+        // 文字列の区切りもハッシュに含める
+        h ^= 0xff;
+        return h * 1099511628211ULL;
+    }
+
+    // 経過時間 [ms]
+    static double elapsed(std::chrono::steady_clock::time_point from) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+    }
+
+    // キーに対応するキャッシュファイル名
+    std::string path(const std::string &key) const {
+        return directory + "/" + key + ".bin";
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param directory キャッシュファイルを置くディレクトリ
+     * @detail OpenGLのコンテキストを作成した後で呼び出す
+     */
+    explicit ProgramCache(const char *directory = "program_cache")
+    : directory(directory), enabled(false), hits(0), misses(0), rejects(0)
+    , loadMillis(0.0), compileMillis(0.0), savedMillis(0.0) {
+        // ドライバが変わったらキャッシュを使わないようにドライバの情報を記録する
+        const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (const GLenum name : names) {
+            const GLubyte *const str(glGetString(name));
+            if (str != nullptr) driver += reinterpret_cast<const char *>(str);
+            driver += '\n';
+        }
+
+        // プログラムバイナリの形式が一つもなければキャッシュは使えない
+        GLint formats(0);
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        enabled = formats > 0;
+
+        // キャッシュファイルを置くディレクトリを作成する (既にあれば何もしない)
+        if (enabled) {
+#ifdef _WIN32
+            _mkdir(directory);
+#else
+            mkdir(directory, 0755);
+#endif
+        }
+    }
+
+    // キャッシュが使えるか
+    bool isEnabled() const { return enabled; }
+
+    /*
+     * @fn
+     * シェーダのソースとドライバの情報からキーを作成する
+     * @param vsrc バーテックスシェーダのソースプログラムの文字列
+     * @param fsrc フラグメントシェーダのソースプログラムの文字列
+     * @param tag リンク前に設定するattribute変数やfragment変数の場所など、ソース以外でバイナリが変わる要素
+     * @return 16進数の文字列
+     */
+    std::string key(const char *vsrc, const char *fsrc, const char *tag = nullptr) const {
+        std::uint64_t h(hash(driver.c_str()));
+        h = hash(vsrc, h);
+        h = hash(fsrc, h);
+        h = hash(tag, h);
+
+        char str[17];
+        std::snprintf(str, sizeof str, "%016llx", static_cast<unsigned long long>(h));
+        return str;
+    }
+
+    /*
+     * @fn
+     * キャッシュからプログラムオブジェクトを作成する
+     * @param key key()で作成したキー
+     * @return 見つからないかドライバに拒否されたら0を返す
+     * @detail 0が返ったら呼び出し側でコンパイルしてstore()を呼ぶ
+     */
+    GLuint load(const std::string &key) {
+        const auto from(std::chrono::steady_clock::now());
+
+        // 見つからなかったときのためにコンパイルにかかる時間の計測を始めておく
+        pending = key;
+        start = from;
+
+        if (!enabled) return 0;
+
+        // キャッシュファイルを開く
+        std::ifstream file(path(key), std::ios::binary);
+        if (file.fail()) {
+            ++misses;
+            return 0;
+        }
+
+        // ヘッダを読み込む
+        std::uint32_t header[2], driverLength, binaryLength;
+        GLenum format;
+        double millis;
+        file.read(reinterpret_cast<char *>(header), sizeof header);
+        file.read(reinterpret_cast<char *>(&driverLength), sizeof driverLength);
+        if (file.fail() || header[0] != magic || header[1] != version || driverLength != driver.size()) {
+            ++misses;
+            return 0;
+        }
+
+        // キーの衝突に備えてドライバの情報を比較する
+        std::string stored(driverLength, '\0');
+        file.read(&stored[0], driverLength);
+        file.read(reinterpret_cast<char *>(&format), sizeof format);
+        file.read(reinterpret_cast<char *>(&millis), sizeof millis);
+        file.read(reinterpret_cast<char *>(&binaryLength), sizeof binaryLength);
+        if (file.fail() || stored != driver) {
+            ++misses;
+            return 0;
+        }
+
+        // プログラムバイナリを読み込む
+        std::vector<char> binary(binaryLength);
+        file.read(binary.data(), binaryLength);
+        if (file.fail()) {
+            ++misses;
+            return 0;
+        }
+
+        // プログラムバイナリからプログラムオブジェクトを作成する
+        const GLuint program(glCreateProgram());
+        glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binaryLength));
+
+        // ドライバに拒否されたらコンパイルし直してもらう
+        GLint status;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (status == GL_FALSE) {
+            glDeleteProgram(program);
+            ++rejects;
+            ++misses;
+            start = std::chrono::steady_clock::now();
+            return 0;
+        }
+
+        // 統計を更新する
+        const double spent(elapsed(from));
+        ++hits;
+        loadMillis += spent;
+        if (millis > spent) savedMillis += millis - spent;
+        pending.clear();
+
+        return program;
+    }
+
+    /*
+     * @fn
+     * プログラムオブジェクトのバイナリをキャッシュに保存する
+     * @param key key()で作成したキー
+     * @param program リンクに成功したプログラムオブジェクト名
+     * @return 保存できたらtrueを返す
+     * @detail 直前のload()からの経過時間をコンパイルにかかった時間として記録する
+     */
+    bool store(const std::string &key, GLuint program) {
+        // コンパイルにかかった時間
+        double millis(0.0);
+        if (key == pending) {
+            millis = elapsed(start);
+            compileMillis += millis;
+            pending.clear();
+        }
+
+        if (!enabled || program == 0) return false;
+
+        // プログラムバイナリを取り出す
+        GLint length(0);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return false;
+        std::vector<char> binary(length);
+        GLenum format;
+        GLsizei written;
+        glGetProgramBinary(program, length, &written, &format, binary.data());
+
+        // 書き込み途中のファイルを読まないように一時ファイルに書いてから名前を変える
+        const std::string name(path(key));
+        const std::string temporary(name + ".tmp");
+        std::ofstream file(temporary, std::ios::binary);
+        if (file.fail()) {
+            std::cerr << "Warning: Can't write program cache: " << temporary << std::endl;
+            return false;
+        }
+        const std::uint32_t header[] = { magic, version };
+        const auto driverLength(static_cast<std::uint32_t>(driver.size()));
+        const auto binaryLength(static_cast<std::uint32_t>(written));
+        file.write(reinterpret_cast<const char *>(header), sizeof header);
+        file.write(reinterpret_cast<const char *>(&driverLength), sizeof driverLength);
+        file.write(driver.data(), driverLength);
+        file.write(reinterpret_cast<const char *>(&format), sizeof format);
+        file.write(reinterpret_cast<const char *>(&millis), sizeof millis);
+        file.write(reinterpret_cast<const char *>(&binaryLength), sizeof binaryLength);
+        file.write(binary.data(), binaryLength);
+        file.close();
+        if (file.fail()) {
+            std::remove(temporary.c_str());
+            return false;
+        }
+
+        std::remove(name.c_str());
+        return std::rename(temporary.c_str(), name.c_str()) == 0;
+    }
+
+    // キャッシュに見つかった数
+    unsigned int getHits() const { return hits; }
+
+    // キャッシュに見つからなかった数
+    unsigned int getMisses() const { return misses; }
+
+    // キャッシュに見つかったがドライバに拒否された数
+    unsigned int getRejects() const { return rejects; }
+
+    // キャッシュから読み込むのにかかった時間 [ms]
+    double getLoadMillis() const { return loadMillis; }
+
+    // コンパイルにかかった時間 [ms]
+    double getCompileMillis() const { return compileMillis; }
+
+    // キャッシュを使ったことで節約できた時間 [ms]
+    double getSavedMillis() const { return savedMillis; }
+
+    // 統計を表示する
+    void printStatistics(std::ostream &out = std::cerr) const {
+        const unsigned int total(hits + misses);
+        out << "Program cache: " << hits << "/" << total << " hits";
+        if (total > 0) out << " (" << 100.0 * hits / total << "%)";
+        out << ", " << rejects << " rejected"
+            << ", load " << loadMillis << " ms"
+            << ", compile " << compileMillis << " ms"
+            << ", saved " << savedMillis << " ms";
+        if (!enabled) out << " [disabled: no program binary formats]";
+        out << std::endl;
+    }
+};
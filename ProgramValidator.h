@@ -0,0 +1,119 @@
+/*
+ * @file ProgramValidator.h
+ * @brief プログラムオブジェクトの検証を必要なときだけ行うクラス
+ * @detail glValidateProgram()はドライバを待たせるので毎フレーム実行しない
+ *         リンク後の最初の使用時と、検証結果に影響する状態(頂点配列オブジェクト・テクスチャ)が変わったときだけ検証する
+ *         状態は validate() を呼んだときに結合されているものを調べるので、描画に使うものを結合してから呼ぶ
+ *         (Shape::draw(validator, program) などが結合した直後に呼ぶ)
+ *         PROGRAM_VALIDATE_INTERVAL を定義するとデバッグ用にそのフレーム数ごとにも検証する
+ */
+
+#pragma once
+
+#include <chrono>
+#include <GL/glew.h>
+
+// 検証を強制するフレーム間隔 (0なら強制しない)
+#ifndef PROGRAM_VALIDATE_INTERVAL
+#define PROGRAM_VALIDATE_INTERVAL 0
+#endif
+
+// プログラムオブジェクトの検証
+class ProgramValidator {
+    // 検証を行う関数
+    GLboolean (*const check)(GLuint program);
+
+    // 検証を強制するフレーム間隔
+    const unsigned int interval;
+
+    // 最後に検証したときのプログラムオブジェクト・頂点配列オブジェクト・アクティブなテクスチャユニットとそのテクスチャ
+    GLuint program;
+    GLint vao, unit, texture;
+
+    // 最後の検証結果
+    GLboolean status;
+
+    // 状態が変わったことが通知された
+    bool dirty;
+
+    // 最後に検証してからのフレーム数
+    unsigned int frames;
+
+    // 検証した回数の合計・計測中の1秒間に検証した回数
+    unsigned int total, count;
+
+    // 1秒あたりの検証回数
+    double rate;
+
+    // 計測を始めた時刻
+    std::chrono::steady_clock::time_point start;
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param check 検証を行いエラーならば0を返す関数 (printValidateInfoLog)
+     * @param interval 検証を強制するフレーム間隔 (0なら強制しない)
+     */
+    explicit ProgramValidator(GLboolean (*check)(GLuint program), unsigned int interval = PROGRAM_VALIDATE_INTERVAL)
+    : check(check), interval(interval), program(0), vao(0), unit(0), texture(0)
+    , status(GL_FALSE), dirty(true), frames(0), total(0), count(0), rate(0.0)
+    , start(std::chrono::steady_clock::now()) {}
+
+    // 頂点配列の構成やテクスチャユニットの割り当てなど、結合名を変えずに検証結果に影響する状態を変えたときに呼ぶ
+    void invalidate() {
+        dirty = true;
+    }
+
+    /*
+     * @fn
+     * 必要ならプログラムオブジェクトを検証する
+     * @param program プログラムオブジェクト名
+     * @return エラーならば0を返す (検証しなかったときは前回の結果を返す)
+     */
+    GLboolean validate(GLuint program) {
+        // 現在結合されている頂点配列オブジェクトとテクスチャを調べる (ドライバの状態を読むだけなのでGPUを待たない)
+        GLint vao, unit, texture;
+        glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &vao);
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+
+        // 状態が変わっていなければ前回の結果を使う
+        if (!dirty && program == this->program && vao == this->vao && unit == this->unit && texture == this->texture
+            && (interval == 0 || frames < interval))
+            return status;
+
+        // 検証する
+        status = check(program);
+        this->program = program;
+        this->vao = vao;
+        this->unit = unit;
+        this->texture = texture;
+        dirty = false;
+        frames = 0;
+        ++total;
+        ++count;
+
+        return status;
+    }
+
+    // フレームの終わりに呼び出す
+    void frame() {
+        ++frames;
+
+        // 1秒ごとに検証の頻度を更新する
+        const auto now(std::chrono::steady_clock::now());
+        const double seconds(std::chrono::duration<double>(now - start).count());
+        if (seconds >= 1.0) {
+            rate = count / seconds;
+            count = 0;
+            start = now;
+        }
+    }
+
+    // 検証した回数の合計
+    unsigned int getValidations() const { return total; }
+
+    // 直前の1秒間に検証した回数
+    double getValidationsPerSecond() const { return rate; }
+};
@@ -0,0 +1,218 @@
+/*
+ * @file Quantize.h
+ * @brief 頂点属性を小さな型に詰めてGPUのメモリと転送量を減らす
+ * @detail 位置は half float、色は正規化した unsigned byte、テクスチャ座標は正規化した 16bit に変換する
+ *         テクスチャ座標は図形ごとの範囲で正規化するので、シェーダでは uvScaleOffset で元に戻す
+ *             texCoord = aTexCoord * uvScaleOffset.xy + uvScaleOffset.zw;
+ *         attribute 変数の場所(0: 位置, 1: 色, 2: テクスチャ座標)は Object::Vertex_Textrue と同じなので
+ *         createProgram() の glBindAttribLocation() はそのまま使える
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// 図形データ
+#include "Object.h"
+
+// 単精度浮動小数点数を半精度に変換する (最近接偶数丸め)
+inline GLhalf toHalf(GLfloat value) {
+    std::uint32_t f;
+    std::memcpy(&f, &value, sizeof f);
+    const std::uint32_t sign((f >> 16) & 0x8000);
+    const std::uint32_t exponent((f >> 23) & 0xff);
+    std::uint32_t mantissa(f & 0x7fffff);
+
+    // 無限大と非数
+    if (exponent == 0xff) return static_cast<GLhalf>(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+    // 半精度の指数に直す
+    const int e(static_cast<int>(exponent) - 127 + 15);
+    if (e >= 0x1f) return static_cast<GLhalf>(sign | 0x7c00);
+    if (e <= 0) {
+        // 非正規化数か0
+        if (e < -10) return static_cast<GLhalf>(sign);
+        mantissa |= 0x800000;
+        const int shift(14 - e);
+        std::uint32_t half(mantissa >> shift);
+        const std::uint32_t rest(mantissa & ((1u << shift) - 1)), halfway(1u << (shift - 1));
+        if (rest > halfway || (rest == halfway && (half & 1))) ++half;
+        return static_cast<GLhalf>(sign | half);
+    }
+
+    std::uint32_t half((static_cast<std::uint32_t>(e) << 10) | (mantissa >> 13));
+    const std::uint32_t rest(mantissa & 0x1fff);
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+    return static_cast<GLhalf>(sign | half);
+}
+
+// 半精度浮動小数点数を単精度に戻す
+inline GLfloat fromHalf(GLhalf value) {
+    const std::uint32_t sign((value & 0x8000u) << 16);
+    std::uint32_t exponent((value >> 10) & 0x1f);
+    std::uint32_t mantissa(value & 0x3ffu);
+    std::uint32_t f;
+    if (exponent == 0x1f) {
+        f = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else if (exponent == 0) {
+        if (mantissa == 0) {
+            f = sign;
+        }
+        else {
+            // 非正規化数を正規化する
+            exponent = 127 - 15 + 1;
+            while ((mantissa & 0x400) == 0) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            f = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    }
+    else {
+        f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+    GLfloat result;
+    std::memcpy(&result, &f, sizeof result);
+    return result;
+}
+
+// [0, 1] の値を n bit の正規化した整数にする
+template <typename T>
+inline T toUnorm(GLfloat value) {
+    const GLfloat maximum(static_cast<GLfloat>(static_cast<T>(~T(0))));
+    const GLfloat clamped(std::min(std::max(value, 0.0f), 1.0f));
+    return static_cast<T>(std::lround(clamped * maximum));
+}
+
+// 量子化した色付きの頂点 (8バイト, Object::Vertex_With_Color は20バイト)
+struct Quantized_Vertex_With_Color {
+    // 位置
+    GLhalf position[2];
+
+    // 色 RGBA
+    GLubyte color[4];
+
+    // 頂点の形式
+    typedef VertexFormat<Attribute<GL_HALF_FLOAT, 2>, Attribute<GL_UNSIGNED_BYTE, 4, GL_TRUE>> Format;
+};
+
+// 量子化したテクスチャ座標付きの頂点 (12バイト, Object::Vertex_Textrue は28バイト)
+struct Quantized_Vertex_Textrue {
+    // 位置
+    GLhalf position[2];
+
+    // 色 RGBA
+    GLubyte color[4];
+
+    // 図形ごとの範囲で正規化したテクスチャ座標
+    GLushort coord[2];
+
+    // 頂点の形式
+    typedef VertexFormat<Attribute<GL_HALF_FLOAT, 2>, Attribute<GL_UNSIGNED_BYTE, 4, GL_TRUE>,
+                         Attribute<GL_UNSIGNED_SHORT, 2, GL_TRUE>> Format;
+};
+
+// 量子化した図形
+template <typename V>
+struct QuantizedMesh {
+    // 量子化した頂点
+    std::vector<V> vertex;
+
+    // テクスチャ座標を元に戻す拡大率と平行移動量 (uvScaleOffset)
+    GLfloat uvScaleOffset[4];
+
+    // 元に戻したときの最大の誤差 (位置・色・テクスチャ座標)
+    GLfloat error[3];
+
+    // 頂点1つのバイト数
+    static constexpr GLsizei bytesPerVertex() { return sizeof(V); }
+
+    // 量子化したときにテクスチャ座標を元に戻す uniform 変数に値を設定する
+    void setUniform(GLint uvScaleOffsetLoc) const {
+        glUniform4fv(uvScaleOffsetLoc, 1, uvScaleOffset);
+    }
+};
+
+/*
+ * @fn
+ * 色付きの頂点を量子化する
+ * @param vertex_count 頂点の数
+ * @param vertex 頂点属性を格納した配列
+ * @return 量子化した図形
+ */
+inline QuantizedMesh<Quantized_Vertex_With_Color> quantize(GLsizei vertex_count, const Object::Vertex_With_Color *vertex) {
+    QuantizedMesh<Quantized_Vertex_With_Color> mesh;
+    mesh.vertex.resize(vertex_count);
+    mesh.uvScaleOffset[0] = mesh.uvScaleOffset[1] = 1.0f;
+    mesh.uvScaleOffset[2] = mesh.uvScaleOffset[3] = 0.0f;
+    mesh.error[0] = mesh.error[1] = mesh.error[2] = 0.0f;
+
+    for (GLsizei i = 0; i < vertex_count; ++i) {
+        const GLfloat *const src(vertex[i].position_color);
+        Quantized_Vertex_With_Color &dst(mesh.vertex[i]);
+        for (int k = 0; k < 2; ++k) {
+            dst.position[k] = toHalf(src[k]);
+            mesh.error[0] = std::max(mesh.error[0], std::fabs(fromHalf(dst.position[k]) - src[k]));
+        }
+        for (int k = 0; k < 3; ++k) {
+            dst.color[k] = toUnorm<GLubyte>(src[2 + k]);
+            mesh.error[1] = std::max(mesh.error[1], std::fabs(dst.color[k] / 255.0f - src[2 + k]));
+        }
+        dst.color[3] = 255;
+    }
+    return mesh;
+}
+
+/*
+ * @fn
+ * テクスチャ座標付きの頂点を量子化する
+ * @param vertex_count 頂点の数
+ * @param vertex 頂点属性を格納した配列
+ * @return 量子化した図形
+ */
+inline QuantizedMesh<Quantized_Vertex_Textrue> quantize(GLsizei vertex_count, const Object::Vertex_Textrue *vertex) {
+    QuantizedMesh<Quantized_Vertex_Textrue> mesh;
+    mesh.vertex.resize(vertex_count);
+    mesh.error[0] = mesh.error[1] = mesh.error[2] = 0.0f;
+
+    // テクスチャ座標の範囲を求める
+    GLfloat lower[2] = { 0.0f, 0.0f }, upper[2] = { 1.0f, 1.0f };
+    for (GLsizei i = 0; i < vertex_count; ++i) {
+        for (int k = 0; k < 2; ++k) {
+            const GLfloat uv(vertex[i].position_color_coord[5 + k]);
+            if (i == 0 || uv < lower[k]) lower[k] = uv;
+            if (i == 0 || uv > upper[k]) upper[k] = uv;
+        }
+    }
+    GLfloat scale[2];
+    for (int k = 0; k < 2; ++k) {
+        scale[k] = upper[k] > lower[k] ? upper[k] - lower[k] : 1.0f;
+        mesh.uvScaleOffset[k] = scale[k];
+        mesh.uvScaleOffset[2 + k] = lower[k];
+    }
+
+    for (GLsizei i = 0; i < vertex_count; ++i) {
+        const GLfloat *const src(vertex[i].position_color_coord);
+        Quantized_Vertex_Textrue &dst(mesh.vertex[i]);
+        for (int k = 0; k < 2; ++k) {
+            dst.position[k] = toHalf(src[k]);
+            mesh.error[0] = std::max(mesh.error[0], std::fabs(fromHalf(dst.position[k]) - src[k]));
+        }
+        for (int k = 0; k < 3; ++k) {
+            dst.color[k] = toUnorm<GLubyte>(src[2 + k]);
+            mesh.error[1] = std::max(mesh.error[1], std::fabs(dst.color[k] / 255.0f - src[2 + k]));
+        }
+        dst.color[3] = 255;
+        for (int k = 0; k < 2; ++k) {
+            dst.coord[k] = toUnorm<GLushort>((src[5 + k] - lower[k]) / scale[k]);
+            const GLfloat restored(dst.coord[k] / 65535.0f * scale[k] + lower[k]);
+            mesh.error[2] = std::max(mesh.error[2], std::fabs(restored - src[5 + k]));
+        }
+    }
+    return mesh;
+}
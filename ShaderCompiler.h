@@ -0,0 +1,334 @@
+/*
+ * @file ShaderCompiler.h
+ * @brief 複数のプログラムオブジェクトをまとめてコンパイルするクラス
+ * @detail createProgram() はシェーダを1つコンパイルするごとにログを問い合わせるので、ドライバはそのたびに
+ *         コンパイルが終わるまで待たせる ここでは全部のシェーダのコンパイルとリンクを先に始めてしまい、
+ *         KHR_parallel_shader_compile があれば GL_COMPLETION_STATUS_KHR で終わったかどうかだけを待たずに調べ、
+ *         全部終わってからまとめて結果とログを問い合わせる (拡張機能がなくてもドライバが裏でコンパイルできる)
+ *         それぞれのプログラムがいつ始まっていつ終わったかを記録し、コンパイルの待ち時間がどれだけ重なったかを表示する
+ *         attribute 変数と fragment 変数は指定がなければ createProgram() と同じく position と fragment を0番に結びつける
+ *         OpenGLの呼び出しはすべて描画スレッドで行う
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// シェーダのまとめたコンパイル
+class ShaderCompiler {
+    // コピーコンストラクタによるコピー禁止
+    ShaderCompiler(const ShaderCompiler &c);
+
+    // 代入によるコピー禁止
+    ShaderCompiler &operator=(const ShaderCompiler &c);
+
+    // コンパイルするプログラム
+    struct Job {
+        // プログラム名
+        std::string name;
+
+        // ソース (submit() した後は空にする)
+        std::string vsrc, fsrc;
+
+        // attribute 変数名 (番号が場所) と fragment 変数名
+        std::vector<std::string> attributes;
+        std::string fragment;
+
+        // プログラムオブジェクトとシェーダオブジェクト
+        GLuint program, vobj, fobj;
+
+        // コンパイルを始めた時刻・終わったことがわかった時刻 [ms] (始めてからの時間)
+        double submitted, completed;
+
+        // 終わったか・リンクに成功したか
+        bool done, linked;
+    };
+
+    // コンパイルするプログラム
+    std::vector<Job> jobs;
+
+    // submit() した時刻
+    std::chrono::steady_clock::time_point start;
+
+    // コンパイルを始めたか・結果を問い合わせたか
+    bool submitted, collected;
+
+    // 全部のコンパイルを始め終えた時刻・結果を問い合わせ終えた時刻 [ms]
+    double submitMillis, finishMillis;
+
+    // 経過時間 [ms]
+    double elapsed() const {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+public:
+    // コンストラクタ
+    ShaderCompiler()
+    : submitted(false), collected(false), submitMillis(0.0), finishMillis(0.0) {}
+
+    // デストラクタ (取り出していないプログラムオブジェクトは削除する)
+    virtual ~ShaderCompiler() {
+        for (auto &job : jobs) {
+            if (job.vobj != 0) glDeleteShader(job.vobj);
+            if (job.fobj != 0) glDeleteShader(job.fobj);
+            if (job.program != 0) glDeleteProgram(job.program);
+        }
+    }
+
+    // KHR_parallel_shader_compile か ARB_parallel_shader_compile があるか
+    static bool isParallel() {
+        return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+    }
+
+    // ドライバがコンパイルに使うスレッドの数をドライバに任せる
+    static void enableParallel() {
+        if (GLEW_KHR_parallel_shader_compile) glMaxShaderCompilerThreadsKHR(0xffffffff);
+        else if (GLEW_ARB_parallel_shader_compile) glMaxShaderCompilerThreadsARB(0xffffffff);
+    }
+
+    // シェーダのコンパイルを始める (結果は問い合わせない)
+    static GLuint compile(GLenum type, const std::string &source) {
+        const GLuint shader(glCreateShader(type));
+        const GLchar *const text(source.c_str());
+        glShaderSource(shader, 1, &text, nullptr);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    /*
+     * @fn
+     * シェーダオブジェクトを組み込んでリンクを始める (結果は問い合わせない)
+     * @param vobj バーテックスシェーダのシェーダオブジェクト名
+     * @param fobj フラグメントシェーダのシェーダオブジェクト名
+     * @param attributes attribute 変数名 (番号の場所に結びつける)
+     * @param fragment 0番に結びつける fragment 変数名
+     * @return プログラムオブジェクト名
+     */
+    static GLuint link(GLuint vobj, GLuint fobj, const std::vector<std::string> &attributes, const std::string &fragment) {
+        const GLuint program(glCreateProgram());
+        glAttachShader(program, vobj);
+        glAttachShader(program, fobj);
+        for (std::size_t i = 0; i < attributes.size(); ++i)
+            glBindAttribLocation(program, static_cast<GLuint>(i), attributes[i].c_str());
+        glBindFragDataLocation(program, 0, fragment.c_str());
+        // プログラムバイナリをキャッシュできるようにする
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(program);
+        return program;
+    }
+
+    // position と fragment を0番に結びつけてリンクを始める
+    static GLuint link(GLuint vobj, GLuint fobj) {
+        return link(vobj, fobj, std::vector<std::string>(1, "position"), "fragment");
+    }
+
+    // コンパイルとリンクが終わったかを待たずに調べる (調べられなければ true)
+    static bool isCompleted(GLuint program) {
+        if (!isParallel()) return true;
+        GLint done(GL_FALSE);
+        glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+        return done != GL_FALSE;
+    }
+
+    /*
+     * @fn
+     * シェーダオブジェクトのコンパイル結果を表示する
+     * @param shader シェーダオブジェクト名
+     * @param name プログラム名
+     * @param stage "vertex" か "fragment"
+     * @return 成功していれば true
+     */
+    static bool printShaderLog(GLuint shader, const std::string &name, const char *stage) {
+        GLint status, length;
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+        if (status == GL_FALSE) std::cerr << "Compile Error in " << stage << " shader of " << name << std::endl;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+        if (length > 1) {
+            std::vector<GLchar> log(length);
+            glGetShaderInfoLog(shader, length, nullptr, log.data());
+            std::cerr << log.data() << std::endl;
+        }
+        return status != GL_FALSE;
+    }
+
+    /*
+     * @fn
+     * プログラムオブジェクトのリンク結果を表示する
+     * @param program プログラムオブジェクト名
+     * @param name プログラム名
+     * @return 成功していれば true
+     */
+    static bool printProgramLog(GLuint program, const std::string &name) {
+        GLint status, length;
+        glGetProgramiv(program, GL_LINK_STATUS, &status);
+        if (status == GL_FALSE) std::cerr << "Link Error in " << name << std::endl;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+        if (length > 1) {
+            std::vector<GLchar> log(length);
+            glGetProgramInfoLog(program, length, nullptr, log.data());
+            std::cerr << log.data() << std::endl;
+        }
+        return status != GL_FALSE;
+    }
+
+    /*
+     * @fn
+     * コンパイルするプログラムを追加する
+     * @param name プログラム名 (ログと経過の表示に使う)
+     * @param vsrc バーテックスシェーダのソース
+     * @param fsrc フラグメントシェーダのソース
+     * @return 番号 (getProgram() などに使う)
+     */
+    std::size_t add(const std::string &name, const std::string &vsrc, const std::string &fsrc) {
+        return add(name, vsrc, fsrc, std::vector<std::string>(1, "position"), "fragment");
+    }
+
+    /*
+     * @fn
+     * 変数の場所を指定してコンパイルするプログラムを追加する
+     * @param name プログラム名
+     * @param vsrc バーテックスシェーダのソース
+     * @param fsrc フラグメントシェーダのソース
+     * @param attributes attribute 変数名 (番号の場所に結びつける)
+     * @param fragment 0番に結びつける fragment 変数名
+     * @return 番号
+     */
+    std::size_t add(const std::string &name, const std::string &vsrc, const std::string &fsrc,
+                    const std::vector<std::string> &attributes, const std::string &fragment) {
+        Job job = { name, vsrc, fsrc, attributes, fragment, 0, 0, 0, 0.0, 0.0, false, false };
+        jobs.push_back(job);
+        return jobs.size() - 1;
+    }
+
+    // 全部のシェーダのコンパイルを始めてから全部のリンクを始める
+    void submit() {
+        if (submitted) return;
+        submitted = true;
+        enableParallel();
+        start = std::chrono::steady_clock::now();
+        for (auto &job : jobs) {
+            job.submitted = elapsed();
+            job.vobj = compile(GL_VERTEX_SHADER, job.vsrc);
+            job.fobj = compile(GL_FRAGMENT_SHADER, job.fsrc);
+            job.vsrc.clear();
+            job.fsrc.clear();
+        }
+        // リンクはシェーダの結果を待つので、全部のシェーダを投げてから始める
+        for (auto &job : jobs) job.program = link(job.vobj, job.fobj, job.attributes, job.fragment);
+        submitMillis = elapsed();
+    }
+
+    /*
+     * @fn
+     * 終わったプログラムを待たずに調べる
+     * @return 全部終わっていれば true
+     * @detail 拡張機能がなければ待たずに調べられないので、いつも true を返して finish() で待つ
+     *         false の間はほかの読み込みを進めて、時々呼び出す
+     */
+    bool poll() {
+        submit();
+        if (!isParallel()) return true;
+        bool all(true);
+        for (auto &job : jobs) {
+            if (job.done) continue;
+            if (isCompleted(job.program)) {
+                job.done = true;
+                job.completed = elapsed();
+            }
+            else {
+                all = false;
+            }
+        }
+        return all;
+    }
+
+    /*
+     * @fn
+     * 全部終わるのを待って結果とログを問い合わせる
+     * @return 全部のリンクに成功したら true
+     */
+    bool finish() {
+        // 既に終わったものの時刻だけ記録する (終わるまで poll() を繰り返すと描画スレッドが空回りする)
+        poll();
+        if (collected) return std::all_of(jobs.begin(), jobs.end(), [](const Job &job) { return job.linked; });
+        collected = true;
+        bool ok(true);
+        for (auto &job : jobs) {
+            // 終わっていなければリンクの結果を問い合わせてドライバに1回だけ待たせ、その時刻を終わった時刻にする
+            if (!job.done) {
+                GLint status(GL_FALSE);
+                glGetProgramiv(job.program, GL_LINK_STATUS, &status);
+                job.done = true;
+                job.completed = elapsed();
+            }
+            const bool vstat(printShaderLog(job.vobj, job.name, "vertex"));
+            const bool fstat(printShaderLog(job.fobj, job.name, "fragment"));
+            job.linked = vstat && fstat && printProgramLog(job.program, job.name);
+            glDeleteShader(job.vobj);
+            glDeleteShader(job.fobj);
+            job.vobj = job.fobj = 0;
+            if (!job.linked) {
+                glDeleteProgram(job.program);
+                job.program = 0;
+                ok = false;
+            }
+        }
+        finishMillis = elapsed();
+        return ok;
+    }
+
+    // プログラムの数
+    std::size_t getCount() const { return jobs.size(); }
+
+    // プログラム名
+    const std::string &getName(std::size_t index) const { return jobs[index].name; }
+
+    // プログラムオブジェクト名 (finish() の後で有効, 失敗したら0)
+    GLuint getProgram(std::size_t index) const { return jobs[index].program; }
+
+    // プログラムオブジェクトを取り出す (取り出したものはデストラクタで削除しない)
+    GLuint release(std::size_t index) {
+        const GLuint program(jobs[index].program);
+        jobs[index].program = 0;
+        return program;
+    }
+
+    // 全部のコンパイルを始めてから結果を問い合わせ終えるまでの時間 [ms]
+    double getWallMillis() const { return finishMillis; }
+
+    // それぞれのプログラムのコンパイルの待ち時間の合計 [ms]
+    double getLatencyMillis() const {
+        double sum(0.0);
+        for (const auto &job : jobs) sum += job.completed - job.submitted;
+        return sum;
+    }
+
+    // 経過を表示する
+    void printTimeline(std::ostream &out = std::cerr) const {
+        out << "ShaderCompiler: " << jobs.size() << " programs, "
+            << (isParallel() ? "parallel (GL_COMPLETION_STATUS_KHR)" : "no parallel compile extension") << std::endl;
+        for (const auto &job : jobs) {
+            char line[160];
+            std::snprintf(line, sizeof line, "  %-24s submit %8.2f ms  ready %8.2f ms  latency %8.2f ms%s",
+                          job.name.c_str(), job.submitted, job.completed, job.completed - job.submitted,
+                          job.linked ? "" : "  FAILED");
+            out << line << std::endl;
+        }
+        // 待ち時間の合計が全体の時間より長ければ、その分だけ重なっていた
+        const double latency(getLatencyMillis());
+        const double overlapped(std::max(0.0, latency - finishMillis));
+        out << "  submit " << submitMillis << " ms, wall " << finishMillis << " ms, sum of latencies " << latency
+            << " ms, overlapped " << overlapped << " ms (" << (latency > 0.0 ? overlapped * 100.0 / latency : 0.0)
+            << "%)" << std::endl;
+    }
+};
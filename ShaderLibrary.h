@@ -0,0 +1,530 @@
+/*
+ * @file ShaderLibrary.h
+ * @brief シェーダのソースファイルを監視して変更されたプログラムオブジェクトを作り直すクラス
+ * @detail 監視は別スレッドで行う (Linux は inotify でディレクトリを監視し、それ以外は更新時刻を定期的に調べる)
+ *         ソースの #include は ShaderPreprocessor で展開し、取り込んだファイルも監視する
+ *         変更されたファイルは監視スレッドで読み込み、描画スレッドの update() でコンパイルとリンクを始める
+ *         結果はその場では問い合わせず、KHR_parallel_shader_compile があれば完了したことを確かめてから、
+ *         なければ次のフレームで調べるので、コンパイルを待って描画が止まらない
+ *         リンクに成功したときだけ描画に使うプログラムオブジェクト名を差し替えてuniform変数の場所を引き直す
+ *         起動時に複数のプログラムを add() するときは ShaderCompiler でまとめてコンパイルする
+ *         失敗したときはログを表示して前のプログラムオブジェクトを使い続ける
+ *         OpenGLの呼び出しはすべて描画スレッドで行う
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <GL/glew.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// プログラムバイナリのキャッシュ
+#include "ProgramCache.h"
+
+// シェーダのまとめたコンパイル
+#include "ShaderCompiler.h"
+
+// #include の展開
+#include "ShaderPreprocessor.h"
+
+// シェーダのライブラリ
+class ShaderLibrary {
+public:
+    // 差し替えられるプログラムオブジェクト
+    class Program {
+        friend class ShaderLibrary;
+
+        // コピーコンストラクタによるコピー禁止
+        Program(const Program &p);
+
+        // 代入によるコピー禁止
+        Program &operator=(const Program &p);
+
+        // 描画に使うプログラムオブジェクト名 (作れていなければ0)
+        GLuint program;
+
+        // 差し替えた回数
+        unsigned int generation;
+
+        // 問い合わせたuniform変数の場所 (差し替えたら引き直す)
+        mutable std::map<std::string, GLint> uniforms;
+
+        // コンパイル中のプログラムオブジェクトとシェーダオブジェクト・待ったフレーム数
+        GLuint pending, vobj, fobj;
+        unsigned int waited;
+
+        Program()
+        : program(0), generation(0), pending(0), vobj(0), fobj(0), waited(0) {}
+
+        // コンパイル中のオブジェクトを捨てる
+        void discard() {
+            if (pending != 0) glDeleteProgram(pending);
+            if (vobj != 0) glDeleteShader(vobj);
+            if (fobj != 0) glDeleteShader(fobj);
+            pending = vobj = fobj = 0;
+            waited = 0;
+        }
+
+    public:
+        // デストラクタ (描画スレッドで破棄する)
+        virtual ~Program() {
+            discard();
+            glDeleteProgram(program);
+        }
+
+        // 描画に使うプログラムオブジェクト名 (毎フレーム取り出す)
+        GLuint get() const { return program; }
+
+        /*
+         * @fn
+         * uniform変数の場所を取り出す
+         * @param name uniform変数名
+         * @return 場所への参照 (プログラムオブジェクトを差し替えると中身が更新されるので、保持して毎フレーム使える)
+         */
+        const GLint &uniform(const std::string &name) const {
+            const auto found(uniforms.find(name));
+            if (found != uniforms.end()) return found->second;
+            GLint &location(uniforms[name]);
+            location = program != 0 ? glGetUniformLocation(program, name.c_str()) : -1;
+            return location;
+        }
+
+        // 差し替えた回数 (uniform変数以外に覚えている状態を作り直すときに使う)
+        unsigned int getGeneration() const { return generation; }
+
+        // 作り直している途中か
+        bool isPending() const { return pending != 0; }
+    };
+
+private:
+    // コピーコンストラクタによるコピー禁止
+    ShaderLibrary(const ShaderLibrary &l);
+
+    // 代入によるコピー禁止
+    ShaderLibrary &operator=(const ShaderLibrary &l);
+
+public:
+    // プログラムのソースファイル
+    struct Source {
+        std::string vert, frag;
+    };
+
+private:
+
+    // 監視スレッドが読み込んだソース
+    struct Reload {
+        std::string name, vsrc, fsrc;
+    };
+
+    // プログラム (描画スレッドだけが使う)
+    std::map<std::string, std::unique_ptr<Program>> programs;
+
+    // プログラムバイナリのキャッシュ (使わなければnullptr)
+    ProgramCache *const cache;
+
+    // 以下を守る
+    std::mutex mutex;
+
+    // プログラムのソースファイル
+    std::map<std::string, Source> sources;
+
+    // ファイル名からそれを使っているプログラム名を引く
+    std::map<std::string, std::set<std::string>> users;
+
+    // inotify の監視記述子からディレクトリ名を引く
+    std::map<int, std::string> directories;
+
+    // 描画スレッドに渡すソース
+    std::deque<Reload> reloads;
+
+    // 監視スレッド
+    std::thread watcher;
+
+    // inotify のファイル記述子 (使わなければ-1)
+    int notify;
+
+    // 監視スレッドを止める
+    std::atomic<bool> stop;
+
+    // 更新時刻を調べる間隔 [ms]
+    const unsigned int interval;
+
+    // 差し替えた数・失敗した数
+    unsigned int swaps, failures;
+
+    // 直前の update() でかかった時間・一番長くかかった時間 [ms]
+    double lastUpdateMillis, maxUpdateMillis;
+
+    // 経過時間 [ms]
+    static double elapsed(std::chrono::steady_clock::time_point from) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+    }
+
+    // ファイル名をディレクトリ名とファイル名に分ける
+    static std::pair<std::string, std::string> split(const std::string &path) {
+        const std::string::size_type slash(path.find_last_of("/\\"));
+        if (slash == std::string::npos) return std::make_pair(std::string("."), path);
+        return std::make_pair(slash == 0 ? std::string("/") : path.substr(0, slash), path.substr(slash + 1));
+    }
+
+    // 監視スレッドと比べるときのファイル名
+    static std::string normalize(const std::string &path) {
+        const std::pair<std::string, std::string> parts(split(path));
+        return parts.first + "/" + parts.second;
+    }
+
+    // ソースファイルを読み込んで #include を展開し、取り込んだファイルも監視する
+    bool read(const std::string &path, std::string &source, const std::string &name) {
+        std::vector<std::string> files;
+        const bool ok(ShaderPreprocessor::load(path, source, &files));
+        for (std::size_t i = 1; i < files.size(); ++i) watchFile(files[i], name);
+        return ok;
+    }
+
+    // ファイルの更新時刻
+    static long long modified(const std::string &path) {
+        struct stat status;
+        if (stat(path.c_str(), &status) != 0) return -1;
+        return static_cast<long long>(status.st_mtime);
+    }
+
+    // コンパイルとリンクを始める (結果は問い合わせない)
+    static void submit(Program &program, const std::string &vsrc, const std::string &fsrc) {
+        program.discard();
+        program.vobj = ShaderCompiler::compile(GL_VERTEX_SHADER, vsrc);
+        program.fobj = ShaderCompiler::compile(GL_FRAGMENT_SHADER, fsrc);
+        program.pending = ShaderCompiler::link(program.vobj, program.fobj);
+    }
+
+    // コンパイルとリンクが終わったか (終わるまで待たずに調べられなければ1フレーム待つ)
+    static bool completed(const Program &program) {
+        if (ShaderCompiler::isParallel()) return ShaderCompiler::isCompleted(program.pending);
+        return program.waited > 0;
+    }
+
+    // 結果を調べて成功していれば差し替える
+    bool finish(Program &program, const std::string &name) {
+        const bool vstat(ShaderCompiler::printShaderLog(program.vobj, name, "vertex"));
+        const bool fstat(ShaderCompiler::printShaderLog(program.fobj, name, "fragment"));
+        const bool linked(vstat && fstat && ShaderCompiler::printProgramLog(program.pending, name));
+        if (!linked) {
+            program.discard();
+            ++failures;
+            return false;
+        }
+
+        // 描画に使うプログラムオブジェクトを差し替えてuniform変数の場所を引き直す
+        glDeleteProgram(program.program);
+        program.program = program.pending;
+        program.pending = 0;
+        program.discard();
+        for (auto &uniform : program.uniforms)
+            uniform.second = glGetUniformLocation(program.program, uniform.first.c_str());
+        ++program.generation;
+        return true;
+    }
+
+    // 変更されたファイルを使っているプログラムのソースを読み込んで描画スレッドに渡す
+    void dispatch(const std::set<std::string> &changed) {
+        std::vector<std::pair<std::string, Source>> affected;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::set<std::string> names;
+            for (const auto &path : changed) {
+                const auto found(users.find(path));
+                if (found != users.end()) names.insert(found->second.begin(), found->second.end());
+            }
+            for (const auto &name : names) affected.push_back(std::make_pair(name, sources[name]));
+        }
+
+        // ファイルの読み込みはロックの外で行い、描画スレッドを待たせない
+        for (const auto &program : affected) {
+            Reload reload;
+            reload.name = program.first;
+            if (!read(program.second.vert, reload.vsrc, reload.name) || !read(program.second.frag, reload.fsrc, reload.name)) continue;
+            std::lock_guard<std::mutex> lock(mutex);
+            reloads.push_back(reload);
+        }
+    }
+
+    // 監視スレッドの処理
+    void watch() {
+#ifdef __linux__
+        if (notify >= 0) {
+            pollfd descriptor = { notify, POLLIN, 0 };
+            while (!stop) {
+                if (poll(&descriptor, 1, 100) <= 0) continue;
+
+                // エディタは保存するときに複数のイベントを出すので、少し待ってからまとめて読む
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                std::set<std::string> changed;
+                alignas(inotify_event) char buffer[4096];
+                for (ssize_t length; (length = ::read(notify, buffer, sizeof buffer)) > 0;) {
+                    for (const char *p = buffer; p < buffer + length;) {
+                        const inotify_event *const event(reinterpret_cast<const inotify_event *>(p));
+                        if (event->len > 0) {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            const auto found(directories.find(event->wd));
+                            if (found != directories.end()) changed.insert(found->second + "/" + event->name);
+                        }
+                        p += sizeof(inotify_event) + event->len;
+                    }
+                }
+                if (!changed.empty()) dispatch(changed);
+            }
+            return;
+        }
+#endif
+        // inotify が使えなければ更新時刻を調べる
+        std::map<std::string, long long> times;
+        while (!stop) {
+            std::vector<std::string> paths;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (const auto &user : users) paths.push_back(user.first);
+            }
+            std::set<std::string> changed;
+            for (const auto &path : paths) {
+                const long long time(modified(path));
+                const auto found(times.find(path));
+                if (found == times.end()) times[path] = time;
+                else if (found->second != time) {
+                    found->second = time;
+                    changed.insert(path);
+                }
+            }
+            if (!changed.empty()) dispatch(changed);
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+        }
+    }
+
+    // プログラムを登録してソースファイルを監視の対象にする
+    Program &enter(const std::string &name, const std::string &vert, const std::string &frag) {
+        std::unique_ptr<Program> &slot(programs[name]);
+        if (!slot) slot.reset(new Program);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sources[name] = Source{ vert, frag };
+        }
+        watchFile(vert, name);
+        watchFile(frag, name);
+        return *slot;
+    }
+
+    // キャッシュのバイナリを使う (なければ false)
+    bool restore(Program &program, const std::string &key) {
+        const GLuint cached(cache != nullptr ? cache->load(key) : 0);
+        if (cached == 0) return false;
+        glDeleteProgram(program.program);
+        program.program = cached;
+        ++program.generation;
+        return true;
+    }
+
+    // ファイルを監視の対象にする
+    void watchFile(const std::string &path, const std::string &name) {
+        const std::string normalized(normalize(path));
+        std::lock_guard<std::mutex> lock(mutex);
+        users[normalized].insert(name);
+#ifdef __linux__
+        if (notify < 0) return;
+        // ファイルを置き換えて保存するエディタもあるので、ファイルではなくディレクトリを監視する
+        const std::string directory(split(path).first);
+        const int descriptor(inotify_add_watch(notify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE));
+        if (descriptor >= 0) directories[descriptor] = directory;
+#endif
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param cache プログラムバイナリのキャッシュ (add() で最初に作るときだけ使う, nullptrなら使わない)
+     * @param watch ファイルを監視するか
+     * @param interval inotify が使えないときに更新時刻を調べる間隔 [ms]
+     * @detail OpenGLのコンテキストを作成した後で描画スレッドで呼び出す
+     */
+    explicit ShaderLibrary(ProgramCache *cache = nullptr, bool watch = true, unsigned int interval = 250)
+    : cache(cache), notify(-1), stop(false), interval(interval), swaps(0), failures(0)
+    , lastUpdateMillis(0.0), maxUpdateMillis(0.0) {
+#ifdef __linux__
+        if (watch) notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+        if (watch) watcher = std::thread(&ShaderLibrary::watch, this);
+        ShaderCompiler::enableParallel();
+    }
+
+    // デストラクタ (描画スレッドで破棄する)
+    virtual ~ShaderLibrary() {
+        stop = true;
+        if (watcher.joinable()) watcher.join();
+#ifdef __linux__
+        if (notify >= 0) close(notify);
+#endif
+    }
+
+    /*
+     * @fn
+     * プログラムを追加して作成する (これだけはコンパイルとリンクが終わるまで待つ)
+     * @param name プログラム名
+     * @param vert バーテックスシェーダのソースファイル名
+     * @param frag フラグメントシェーダのソースファイル名
+     * @return プログラム (ライブラリが破棄されるまで有効, 作成に失敗しても get() が0のまま監視は続ける)
+     */
+    const Program &add(const std::string &name, const std::string &vert, const std::string &frag) {
+        Program &program(enter(name, vert, frag));
+        std::string vsrc, fsrc;
+        if (!read(vert, vsrc, name) || !read(frag, fsrc, name)) return program;
+
+        // ソースが同じならキャッシュのバイナリを使う
+        const std::string key(cache != nullptr ? cache->key(vsrc.c_str(), fsrc.c_str(), "position=0;fragment=0") : "");
+        if (restore(program, key)) return program;
+        submit(program, vsrc, fsrc);
+        if (finish(program, name) && cache != nullptr) cache->store(key, program.program);
+        return program;
+    }
+
+    /*
+     * @fn
+     * 複数のプログラムを追加してまとめて作成する
+     * @param list プログラム名とソースファイル名
+     * @param timeline コンパイルの経過を表示するか
+     * @return 全部作成できたら true (get() で取り出す)
+     * @detail 起動時にプログラムが多いときは add() を繰り返すより速い
+     *         全部のシェーダのコンパイルを始めてから ShaderCompiler で結果をまとめて問い合わせる
+     */
+    bool add(const std::map<std::string, Source> &list, bool timeline = false) {
+        ShaderCompiler compiler;
+        std::vector<std::pair<Program *, std::string>> compiling;
+        bool ok(true);
+        for (const auto &entry : list) {
+            Program &program(enter(entry.first, entry.second.vert, entry.second.frag));
+            std::string vsrc, fsrc;
+            if (!read(entry.second.vert, vsrc, entry.first) || !read(entry.second.frag, fsrc, entry.first)) {
+                ok = false;
+                continue;
+            }
+            const std::string key(cache != nullptr ? cache->key(vsrc.c_str(), fsrc.c_str(), "position=0;fragment=0") : "");
+            if (restore(program, key)) continue;
+            compiler.add(entry.first, vsrc, fsrc);
+            compiling.push_back(std::make_pair(&program, key));
+        }
+        if (compiling.empty()) return ok;
+
+        if (!compiler.finish()) ok = false;
+        for (std::size_t i = 0; i < compiling.size(); ++i) {
+            const GLuint linked(compiler.release(i));
+            if (linked == 0) continue;
+            Program &program(*compiling[i].first);
+            program.discard();
+            glDeleteProgram(program.program);
+            program.program = linked;
+            for (auto &uniform : program.uniforms)
+                uniform.second = glGetUniformLocation(program.program, uniform.first.c_str());
+            ++program.generation;
+            if (cache != nullptr) cache->store(compiling[i].second, program.program);
+        }
+        if (timeline) compiler.printTimeline();
+        return ok;
+    }
+
+    /*
+     * @fn
+     * プログラムを取り出す
+     * @param name プログラム名
+     * @return プログラム (なければnullptr)
+     */
+    const Program *get(const std::string &name) const {
+        const auto found(programs.find(name));
+        return found != programs.end() ? found->second.get() : nullptr;
+    }
+
+    /*
+     * @fn
+     * プログラムをソースファイルから作り直す
+     * @param name プログラム名
+     * @detail ファイルの監視とは関係なく作り直したいときに呼ぶ (次の update() から始まる)
+     */
+    void reload(const std::string &name) {
+        std::set<std::string> changed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const auto found(sources.find(name));
+            if (found == sources.end()) return;
+            changed.insert(normalize(found->second.vert));
+        }
+        dispatch(changed);
+    }
+
+    /*
+     * @fn
+     * 変更されたプログラムのコンパイルを始め、終わったものを差し替える
+     * @return 差し替えたプログラムの数
+     * @detail フレームごとに描画スレッドで呼び出す
+     */
+    unsigned int update() {
+        const auto from(std::chrono::steady_clock::now());
+        std::deque<Reload> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready.swap(reloads);
+        }
+
+        // 読み込んだソースのコンパイルを始める (コンパイル中にまた変更されたら古い方は捨てる)
+        for (const auto &reload : ready) {
+            const auto found(programs.find(reload.name));
+            if (found != programs.end()) submit(*found->second, reload.vsrc, reload.fsrc);
+        }
+
+        // 終わったものを差し替える
+        unsigned int count(0);
+        for (auto &entry : programs) {
+            Program &program(*entry.second);
+            if (program.pending == 0) continue;
+            if (!completed(program)) {
+                ++program.waited;
+                continue;
+            }
+            if (finish(program, entry.first)) {
+                std::cerr << "Reloaded " << entry.first << std::endl;
+                ++swaps;
+                ++count;
+            }
+        }
+        lastUpdateMillis = elapsed(from);
+        if (lastUpdateMillis > maxUpdateMillis) maxUpdateMillis = lastUpdateMillis;
+        return count;
+    }
+
+    // ファイルを inotify で監視しているか
+    bool isNotified() const { return notify >= 0; }
+
+    // 差し替えた数
+    unsigned int getSwaps() const { return swaps; }
+
+    // 作り直しに失敗した数
+    unsigned int getFailures() const { return failures; }
+
+    // 直前の update() でかかった時間 [ms]
+    double getLastUpdateMillis() const { return lastUpdateMillis; }
+
+    // update() で一番長くかかった時間 [ms]
+    double getMaxUpdateMillis() const { return maxUpdateMillis; }
+};
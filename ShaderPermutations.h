@@ -0,0 +1,204 @@
+/*
+ * @file ShaderPermutations.h
+ * @brief 1組のシェーダから機能の組み合わせごとに特化したプログラムオブジェクトを作るクラス
+ * @detail 頂点色・テクスチャなどの機能ごとにビットを割り当て、ビットの組み合わせで #define を変えてコンパイルする
+ *         シェーダの中では実行時に分岐せずに #ifdef で機能を切り替える
+ *             #ifdef TEXTURE
+ *             color *= texture(ourTexture, texCoord);
+ *             #endif
+ *         プログラムオブジェクトは最初に get() したときに作り、作ったもの (失敗したものも) は覚えておく
+ *         起動時にまとめて作っておきたい組み合わせは prepare() で ShaderCompiler を使ってまとめてコンパイルする
+ *         ソースファイルは ShaderPreprocessor で一度だけ読み込んで #include を展開しておく
+ *         OpenGLの呼び出しはすべて描画スレッドで行う
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+// プログラムバイナリのキャッシュ
+#include "ProgramCache.h"
+
+// シェーダのまとめたコンパイル
+#include "ShaderCompiler.h"
+
+// #include の展開と #define の差し込み
+#include "ShaderPreprocessor.h"
+
+// 機能の組み合わせごとのプログラム
+class ShaderPermutations {
+    // コピーコンストラクタによるコピー禁止
+    ShaderPermutations(const ShaderPermutations &p);
+
+    // 代入によるコピー禁止
+    ShaderPermutations &operator=(const ShaderPermutations &p);
+
+    // ソースファイル名
+    const std::string vert, frag;
+
+    // 機能の数の上限 (ビットの組み合わせは unsigned int に入れる)
+    static const std::size_t maxFeatures = 32;
+
+    // 機能のマクロ名 (番号がビットの位置, maxFeatures 個まで)
+    const std::vector<std::string> features;
+
+    // attribute 変数名 (番号が場所) と fragment 変数名
+    const std::vector<std::string> attributes;
+    const std::string fragment;
+
+    // プログラムバイナリのキャッシュ (使わなければnullptr)
+    ProgramCache *const cache;
+
+    // 展開したソース
+    std::string vsrc, fsrc;
+
+    // ソースを読み込んだか・読み込めたか
+    bool loaded, valid;
+
+    // ビットの組み合わせからプログラムオブジェクト名を引く (失敗したものは0)
+    std::map<unsigned int, GLuint> programs;
+
+    // キャッシュのキーに加える変数の場所
+    std::string bindings() const {
+        std::string tag;
+        for (std::size_t i = 0; i < attributes.size(); ++i) tag += attributes[i] + "=" + std::to_string(i) + ";";
+        return tag + fragment + "=0";
+    }
+
+    // 機能のマクロ名を上限までに切り詰める (1u << 32 以上のシフトは未定義動作になる)
+    static std::vector<std::string> limit(const std::vector<std::string> &features) {
+        if (features.size() <= maxFeatures) return features;
+        std::cerr << "Error: Too many shader features (" << features.size() << "), ignoring all after the first "
+                  << maxFeatures << std::endl;
+        return std::vector<std::string>(features.begin(), features.begin() + maxFeatures);
+    }
+
+    // ソースを読み込む
+    bool load() {
+        if (!loaded) {
+            loaded = true;
+            valid = ShaderPreprocessor::load(vert, vsrc) && ShaderPreprocessor::load(frag, fsrc);
+        }
+        return valid;
+    }
+
+    /*
+     * @fn
+     * 組み合わせをまとめて作る
+     * @param masks ビットの組み合わせ (まだ作っていないもの)
+     * @param timeline コンパイルの経過を表示するか
+     */
+    void build(const std::vector<unsigned int> &masks, bool timeline) {
+        ShaderCompiler compiler;
+        std::vector<std::pair<unsigned int, std::string>> compiling;
+        for (const unsigned int mask : masks) {
+            GLuint &program(programs[mask]);
+            if (!load()) continue;
+            const std::vector<std::string> defines(getDefines(mask));
+            const std::string vdefined(ShaderPreprocessor::define(vsrc, defines));
+            const std::string fdefined(ShaderPreprocessor::define(fsrc, defines));
+
+            // ソースが同じならキャッシュのバイナリを使う
+            const std::string key(cache != nullptr ? cache->key(vdefined.c_str(), fdefined.c_str(), bindings().c_str()) : "");
+            program = cache != nullptr ? cache->load(key) : 0;
+            if (program != 0) continue;
+            compiler.add(getName(mask), vdefined, fdefined, attributes, fragment);
+            compiling.push_back(std::make_pair(mask, key));
+        }
+        if (compiling.empty()) return;
+
+        if (!compiler.finish()) std::cerr << "Error: Can't build some permutations of " << vert << " and " << frag << std::endl;
+        for (std::size_t i = 0; i < compiling.size(); ++i) {
+            const GLuint program(compiler.release(i));
+            programs[compiling[i].first] = program;
+            if (program != 0 && cache != nullptr) cache->store(compiling[i].second, program);
+        }
+        if (timeline) compiler.printTimeline();
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param vert バーテックスシェーダのソースファイル名
+     * @param frag フラグメントシェーダのソースファイル名
+     * @param features 機能のマクロ名 (i番目がビット 1 << i に対応する, 32個まで, 超えた分は使わない)
+     * @param attributes attribute 変数名 (番号の場所に結びつける)
+     * @param fragment 0番に結びつける fragment 変数名
+     * @param cache プログラムバイナリのキャッシュ (nullptrなら使わない)
+     * @detail ソースファイルは最初にプログラムオブジェクトを作るときに読み込む
+     */
+    ShaderPermutations(const std::string &vert, const std::string &frag, const std::vector<std::string> &features,
+                       const std::vector<std::string> &attributes, const std::string &fragment = "fragment",
+                       ProgramCache *cache = nullptr)
+    : vert(vert), frag(frag), features(limit(features)), attributes(attributes), fragment(fragment), cache(cache)
+    , loaded(false), valid(false) {}
+
+    // デストラクタ (描画スレッドで破棄する)
+    virtual ~ShaderPermutations() {
+        for (const auto &program : programs) glDeleteProgram(program.second);
+    }
+
+    /*
+     * @fn
+     * 機能のビットを取り出す
+     * @param feature 機能のマクロ名
+     * @return ビット (なければ0)
+     */
+    unsigned int getBit(const std::string &feature) const {
+        for (std::size_t i = 0; i < features.size(); ++i) if (features[i] == feature) return 1u << i;
+        std::cerr << "Warning: Unknown shader feature: " << feature << std::endl;
+        return 0;
+    }
+
+    // ビットの組み合わせで定義するマクロ
+    std::vector<std::string> getDefines(unsigned int mask) const {
+        std::vector<std::string> defines;
+        for (std::size_t i = 0; i < features.size(); ++i) if (mask & (1u << i)) defines.push_back(features[i]);
+        return defines;
+    }
+
+    // ビットの組み合わせの名前 (ログと経過の表示に使う)
+    std::string getName(unsigned int mask) const {
+        std::string name(vert + "+" + frag);
+        for (const auto &define : getDefines(mask)) name += " " + define;
+        return name;
+    }
+
+    /*
+     * @fn
+     * ビットの組み合わせのプログラムオブジェクトを取り出す
+     * @param mask 機能のビットの組み合わせ
+     * @return プログラムオブジェクト名 (作れなければ0)
+     * @detail 初めての組み合わせならここでコンパイルが終わるまで待つ
+     */
+    GLuint get(unsigned int mask) {
+        const auto found(programs.find(mask));
+        if (found != programs.end()) return found->second;
+        build(std::vector<unsigned int>(1, mask), false);
+        return programs[mask];
+    }
+
+    /*
+     * @fn
+     * 使う組み合わせを前もってまとめて作る
+     * @param masks 機能のビットの組み合わせ
+     * @param timeline コンパイルの経過を表示するか
+     */
+    void prepare(const std::vector<unsigned int> &masks, bool timeline = false) {
+        std::vector<unsigned int> missing;
+        for (const unsigned int mask : masks) {
+            if (programs.find(mask) == programs.end() && std::find(missing.begin(), missing.end(), mask) == missing.end())
+                missing.push_back(mask);
+        }
+        if (!missing.empty()) build(missing, timeline);
+    }
+
+    // 作った組み合わせの数
+    std::size_t getCount() const { return programs.size(); }
+};
@@ -0,0 +1,143 @@
+/*
+ * @file ShaderPreprocessor.h
+ * @brief シェーダのソースファイルの #include を展開して #define を差し込むクラス
+ * @detail GLSL には #include がないので、ソースを読み込むときに展開する
+ *             #include "common.glsl"
+ *         ファイル名は取り込む側のファイルのあるディレクトリから探す 同じファイルは一度しか取り込まない
+ *         取り込んだ場所には #line を入れるので、コンパイルエラーの行番号はそれぞれのファイルの行番号になる
+ *         (ファイル名の代わりに load() が返すファイルの一覧の番号がソース番号になる)
+ *         define() は #version の次の行に #define を差し込むので、機能ごとに特化したシェーダを作れる
+ */
+
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// シェーダのプリプロセッサ
+class ShaderPreprocessor {
+    // ファイル名からディレクトリ名を取り出す (末尾の / を含む)
+    static std::string directory(const std::string &path) {
+        const std::string::size_type slash(path.find_last_of("/\\"));
+        return slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+    }
+
+    // 行が指令 name で始まっていれば、その後ろの位置を返す (でなければ npos)
+    static std::string::size_type directive(const std::string &line, const char *name) {
+        std::string::size_type p(line.find_first_not_of(" \t"));
+        if (p == std::string::npos || line[p] != '#') return std::string::npos;
+        p = line.find_first_not_of(" \t", p + 1);
+        const std::string::size_type length(std::char_traits<char>::length(name));
+        if (p == std::string::npos || line.compare(p, length, name) != 0) return std::string::npos;
+        return p + length;
+    }
+
+    // ファイルを展開して追加する
+    static bool expand(const std::string &path, std::string &source,
+                       std::vector<std::string> &files, std::vector<std::string> &stack) {
+        for (const auto &opened : stack) {
+            if (opened == path) {
+                std::cerr << "Error: Recursive #include: " << path << std::endl;
+                return false;
+            }
+        }
+        for (const auto &file : files) if (file == path) return true;
+
+        std::ifstream file(path, std::ios::binary);
+        if (file.fail()) {
+            std::cerr << "Error: Can't open source file: " << path << std::endl;
+            return false;
+        }
+        const std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        const std::size_t index(files.size());
+        files.push_back(path);
+        stack.push_back(path);
+
+        // 取り込んだファイルは1行目から数え直す (最初のファイルは #version を先頭に置くので入れない)
+        if (index > 0) source += "#line 1 " + std::to_string(index) + "\n";
+        std::istringstream lines(text);
+        std::string line;
+        for (int number = 1; std::getline(lines, line); ++number) {
+            const std::string::size_type include(directive(line, "include"));
+            if (include == std::string::npos) {
+                // 取り込んだファイルの #version は捨てる
+                if (index > 0 && directive(line, "version") != std::string::npos) line.clear();
+                source += line;
+                source += '\n';
+                continue;
+            }
+
+            const std::string::size_type open(line.find_first_of("\"<", include));
+            const std::string::size_type close(open != std::string::npos
+                                                ? line.find(line[open] == '"' ? '"' : '>', open + 1) : std::string::npos);
+            if (close == std::string::npos) {
+                std::cerr << "Error: Malformed #include in " << path << " line " << number << std::endl;
+                stack.pop_back();
+                return false;
+            }
+            if (!expand(directory(path) + line.substr(open + 1, close - open - 1), source, files, stack)) {
+                stack.pop_back();
+                return false;
+            }
+            source += "#line " + std::to_string(number + 1) + " " + std::to_string(index) + "\n";
+        }
+        stack.pop_back();
+        return true;
+    }
+
+public:
+    /*
+     * @fn
+     * ソースファイルを読み込んで #include を展開する
+     * @param path ソースファイル名
+     * @param source 展開したソース
+     * @param files 読み込んだファイルの一覧 (番号が #line のソース番号, 監視に使う, nullptrなら返さない)
+     * @return 読み込めたら true
+     */
+    static bool load(const std::string &path, std::string &source, std::vector<std::string> *files = nullptr) {
+        std::vector<std::string> opened, stack;
+        source.clear();
+        const bool ok(expand(path, source, opened, stack));
+        if (files != nullptr) files->swap(opened);
+        return ok;
+    }
+
+    /*
+     * @fn
+     * #version の次の行に #define を差し込む
+     * @param source ソース
+     * @param defines マクロ ("NAME" なら1に、"NAME VALUE" ならVALUEに定義する)
+     * @return 差し込んだソース
+     */
+    static std::string define(const std::string &source, const std::vector<std::string> &defines) {
+        std::string text;
+        for (const auto &name : defines) {
+            text += "#define " + name;
+            if (name.find(' ') == std::string::npos) text += " 1";
+            text += '\n';
+        }
+        if (text.empty()) return source;
+
+        // #version の行を探す (なければ先頭に置く)
+        std::string::size_type begin(0);
+        int number(1);
+        while (begin < source.size()) {
+            const std::string::size_type end(source.find('\n', begin));
+            const std::string line(source.substr(begin, end == std::string::npos ? std::string::npos : end - begin));
+            if (directive(line, "version") != std::string::npos) {
+                const std::string::size_type next(end == std::string::npos ? source.size() : end + 1);
+                return source.substr(0, next) + (end == std::string::npos ? "\n" : "") + text
+                       + "#line " + std::to_string(number + 1) + " 0\n" + source.substr(next);
+            }
+            if (end == std::string::npos) break;
+            begin = end + 1;
+            ++number;
+        }
+        return text + "#line 1 0\n" + source;
+    }
+};
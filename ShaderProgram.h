@@ -0,0 +1,307 @@
+/*
+ * @file ShaderProgram.h
+ * @brief プログラムオブジェクトのuniform変数の場所と値を覚えておくクラス
+ * @detail リンクした後に一度だけ glGetActiveUniform() でアクティブなuniform変数を全部調べて場所を覚える
+ *         uniform変数名は intern() で番号にしておき、描画ループでは文字列を使わずに番号で引く
+ *         設定した値をCPU側に控えておき、前と同じ値なら glProgramUniform*() を呼ばない
+ *         glProgramUniform*() (OpenGL 4.1) を使うので、値を設定するのに glUseProgram() しておく必要はない
+ *         プログラムオブジェクトは所有しない (削除は作った側で行う) OpenGLの呼び出しはすべて描画スレッドで行う
+ */
+
+#pragma once
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+// uniform変数の場所と値のキャッシュ
+class ShaderProgram {
+public:
+    // intern() したuniform変数名の番号
+    typedef unsigned int Name;
+
+private:
+    // コピーコンストラクタによるコピー禁止
+    ShaderProgram(const ShaderProgram &p);
+
+    // 代入によるコピー禁止
+    ShaderProgram &operator=(const ShaderProgram &p);
+
+    // アクティブなuniform変数
+    struct Uniform {
+        // 場所
+        GLint location;
+
+        // 型と配列の要素数
+        GLenum type;
+        GLint size;
+
+        // 要素あたりの成分の数と浮動小数点数か
+        GLint components;
+        bool real;
+
+        // 最後に設定した値
+        std::vector<GLfloat> reals;
+        std::vector<GLint> integers;
+
+        // 値を設定したことがあるか
+        bool set;
+    };
+
+    // プログラムオブジェクト名
+    GLuint program;
+
+    // アクティブなuniform変数
+    std::vector<Uniform> uniforms;
+
+    // 名前の番号からアクティブなuniform変数の番号を引く (なければ-1)
+    std::vector<int> slots;
+
+    // glProgramUniform*() を呼んだ回数・同じ値だったので呼ばなかった回数
+    unsigned long long issued, skipped;
+
+    // プログラムオブジェクトを作り直した回数
+    unsigned int reflections;
+
+    // uniform変数名の一覧 (番号が intern() の値)
+    static std::map<std::string, Name> &names() {
+        static std::map<std::string, Name> table;
+        return table;
+    }
+
+    // 型の成分の数と浮動小数点数か (扱えない型なら成分の数は0)
+    static GLint components(GLenum type, bool &real) {
+        real = true;
+        switch (type) {
+        case GL_FLOAT: return 1;
+        case GL_FLOAT_VEC2: return 2;
+        case GL_FLOAT_VEC3: return 3;
+        case GL_FLOAT_VEC4: return 4;
+        case GL_FLOAT_MAT2: return 4;
+        case GL_FLOAT_MAT3: return 9;
+        case GL_FLOAT_MAT4: return 16;
+        default: break;
+        }
+        real = false;
+        switch (type) {
+        case GL_INT: case GL_BOOL:
+        case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+        case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_BUFFER:
+        case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+            return 1;
+        case GL_INT_VEC2: case GL_BOOL_VEC2: return 2;
+        case GL_INT_VEC3: case GL_BOOL_VEC3: return 3;
+        case GL_INT_VEC4: case GL_BOOL_VEC4: return 4;
+        default: return 0;
+        }
+    }
+
+    // uniform変数を取り出す (なければnullptr)
+    Uniform *find(Name name) {
+        if (name >= slots.size() || slots[name] < 0) return nullptr;
+        return &uniforms[slots[name]];
+    }
+
+    // 浮動小数点数の値を送る
+    void send(const Uniform &uniform, const GLfloat *value, GLsizei count) const {
+        switch (uniform.type) {
+        case GL_FLOAT: glProgramUniform1fv(program, uniform.location, count, value); break;
+        case GL_FLOAT_VEC2: glProgramUniform2fv(program, uniform.location, count, value); break;
+        case GL_FLOAT_VEC3: glProgramUniform3fv(program, uniform.location, count, value); break;
+        case GL_FLOAT_VEC4: glProgramUniform4fv(program, uniform.location, count, value); break;
+        case GL_FLOAT_MAT2: glProgramUniformMatrix2fv(program, uniform.location, count, GL_FALSE, value); break;
+        case GL_FLOAT_MAT3: glProgramUniformMatrix3fv(program, uniform.location, count, GL_FALSE, value); break;
+        case GL_FLOAT_MAT4: glProgramUniformMatrix4fv(program, uniform.location, count, GL_FALSE, value); break;
+        default: break;
+        }
+    }
+
+    // 整数の値を送る
+    void send(const Uniform &uniform, const GLint *value, GLsizei count) const {
+        switch (uniform.components) {
+        case 1: glProgramUniform1iv(program, uniform.location, count, value); break;
+        case 2: glProgramUniform2iv(program, uniform.location, count, value); break;
+        case 3: glProgramUniform3iv(program, uniform.location, count, value); break;
+        case 4: glProgramUniform4iv(program, uniform.location, count, value); break;
+        default: break;
+        }
+    }
+
+    // 控えの値の配列
+    static GLfloat *shadowOf(Uniform &uniform, const GLfloat *) { return uniform.reals.data(); }
+    static GLint *shadowOf(Uniform &uniform, const GLint *) { return uniform.integers.data(); }
+
+    // 控えの値と比べて違っていれば送る (components が0でなければ成分の数が同じときだけ)
+    template <typename T>
+    bool store(Name name, const T *value, GLsizei count, bool real, GLint components = 0) {
+        Uniform *const uniform(find(name));
+        if (uniform == nullptr || uniform->real != real || count < 1) return false;
+        if (components != 0 && uniform->components != components) return false;
+        if (count > uniform->size) count = uniform->size;
+        const std::size_t length(static_cast<std::size_t>(count) * uniform->components);
+        T *const shadow(shadowOf(*uniform, value));
+        if (uniform->set && std::memcmp(shadow, value, length * sizeof(T)) == 0) {
+            ++skipped;
+            return true;
+        }
+        std::memcpy(shadow, value, length * sizeof(T));
+        // 配列の一部だけ設定したときは残りの控えが正しいとは限らないので、次は比べずに送る
+        uniform->set = count == uniform->size;
+        send(*uniform, value, count);
+        ++issued;
+        return true;
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param program プログラムオブジェクト名 (リンクした後のもの, 0なら後で reset() する)
+     */
+    explicit ShaderProgram(GLuint program = 0)
+    : program(0), issued(0), skipped(0), reflections(0) {
+        reset(program);
+    }
+
+    // デストラクタ
+    virtual ~ShaderProgram() {}
+
+    /*
+     * @fn
+     * uniform変数名を番号にする
+     * @param name uniform変数名
+     * @return 番号 (同じ名前ならどのプログラムでも同じ番号になる)
+     * @detail 描画ループの外で呼んでおく
+     */
+    static Name intern(const std::string &name) {
+        std::map<std::string, Name> &table(names());
+        const auto found(table.find(name));
+        if (found != table.end()) return found->second;
+        const Name id(static_cast<Name>(table.size()));
+        table.insert(std::make_pair(name, id));
+        return id;
+    }
+
+    /*
+     * @fn
+     * プログラムオブジェクトを調べ直す
+     * @param program プログラムオブジェクト名 (リンクした後のもの)
+     * @detail 控えの値は捨てるので、次に設定する値はすべて送る
+     */
+    void reset(GLuint program) {
+        this->program = program;
+        uniforms.clear();
+        slots.clear();
+        if (program == 0) return;
+        ++reflections;
+
+        GLint count(0), length(0);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &length);
+        std::vector<GLchar> buffer(length > 0 ? length : 1);
+        for (GLint i = 0; i < count; ++i) {
+            Uniform uniform;
+            GLsizei written(0);
+            glGetActiveUniform(program, static_cast<GLuint>(i), static_cast<GLsizei>(buffer.size()), &written,
+                               &uniform.size, &uniform.type, buffer.data());
+            std::string name(buffer.data(), written);
+
+            // uniformブロックの中の変数は場所を持たない
+            uniform.location = glGetUniformLocation(program, name.c_str());
+            if (uniform.location < 0) continue;
+            uniform.components = components(uniform.type, uniform.real);
+            if (uniform.components == 0) continue;
+
+            // 配列は "name[0]" と返るので名前から添字を取る
+            const std::string::size_type bracket(name.find('['));
+            if (bracket != std::string::npos) name.erase(bracket);
+
+            const std::size_t values(static_cast<std::size_t>(uniform.size) * uniform.components);
+            if (uniform.real) uniform.reals.resize(values);
+            else uniform.integers.resize(values);
+            uniform.set = false;
+
+            const Name id(intern(name));
+            if (id >= slots.size()) slots.resize(id + 1, -1);
+            slots[id] = static_cast<int>(uniforms.size());
+            uniforms.push_back(uniform);
+        }
+    }
+
+    /*
+     * @fn
+     * プログラムオブジェクトが替わっていれば調べ直す
+     * @param program プログラムオブジェクト名 (ShaderLibrary で差し替えたものを毎フレーム渡す)
+     * @return 調べ直したら true
+     */
+    bool update(GLuint program) {
+        if (program == this->program) return false;
+        reset(program);
+        return true;
+    }
+
+    // プログラムオブジェクト名
+    GLuint get() const { return program; }
+
+    // uniform変数の場所 (アクティブでなければ-1)
+    GLint location(Name name) const {
+        return name < slots.size() && slots[name] >= 0 ? uniforms[slots[name]].location : -1;
+    }
+
+    /*
+     * @fn
+     * 浮動小数点数のuniform変数に値を設定する (float, vec2-4, mat2-4)
+     * @param name intern() したuniform変数名
+     * @param value 値 (count × 成分の数 (float 1, vec2 2, vec3 3, vec4 と mat2 4, mat3 9, mat4 16) 個の要素がいる)
+     * @param count 配列の要素数 (uniform変数の配列の大きさを超えた分は使わない)
+     * @return 設定できたら true (アクティブでないか型が違えば false)
+     */
+    bool set(Name name, const GLfloat *value, GLsizei count = 1) {
+        return store(name, value, count, true);
+    }
+
+    /*
+     * @fn
+     * 整数のuniform変数に値を設定する (int, ivec2-4, bool, sampler)
+     * @param name intern() したuniform変数名
+     * @param value 値 (count × 成分の数 (int, bool, sampler 1, ivec2-4 2-4) 個の要素がいる)
+     * @param count 配列の要素数 (uniform変数の配列の大きさを超えた分は使わない)
+     * @return 設定できたら true
+     */
+    bool set(Name name, const GLint *value, GLsizei count = 1) {
+        return store(name, value, count, false);
+    }
+
+    // float のuniform変数に値を設定する (成分が1つでなければ false)
+    bool set(Name name, GLfloat value) { return store(name, &value, 1, true, 1); }
+
+    // vec4 のuniform変数に値を設定する (成分が4つでなければ false)
+    bool set(Name name, GLfloat x, GLfloat y, GLfloat z, GLfloat w) {
+        const GLfloat value[] = { x, y, z, w };
+        return store(name, value, 1, true, 4);
+    }
+
+    // int か sampler のuniform変数に値を設定する (成分が1つでなければ false)
+    bool set(Name name, GLint value) { return store(name, &value, 1, false, 1); }
+
+    // アクティブなuniform変数の数
+    std::size_t getCount() const { return uniforms.size(); }
+
+    // glProgramUniform*() を呼んだ回数
+    unsigned long long getIssued() const { return issued; }
+
+    // 同じ値だったので glProgramUniform*() を呼ばなかった回数
+    unsigned long long getSkipped() const { return skipped; }
+
+    // 統計を表示する
+    void printStatistics(std::ostream &out = std::cerr) const {
+        out << "ShaderProgram: " << uniforms.size() << " active uniforms, " << reflections << " reflections, "
+            << issued << " updates issued, " << skipped << " skipped";
+        const unsigned long long total(issued + skipped);
+        if (total > 0) out << " (" << skipped * 100 / total << "%)";
+        out << std::endl;
+    }
+};
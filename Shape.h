@@ -11,6 +11,9 @@
 // 図形データ
 #include "Object.h"
 
+// プログラムオブジェクトの検証
+#include "ProgramValidator.h"
+
 // 図形の描画
 class Shape {
     // 図形データ
@@ -28,13 +31,22 @@ public:
      * @param vertex_count 頂点の数
      * @param vertex 頂点属性を格納した配列
      */
-    Shape(GLint size, GLsizei vertex_count, const Object::Vertex *vertex)
+    template <typename V>
+    Shape(GLint size, GLsizei vertex_count, const V *vertex)
     : object(new Object(size, vertex_count, vertex))
     , vertex_count(vertex_count){}
 
-    Shape(GLint size, GLsizei vertex_count, const Object::Vertex_With_Color *vertex)
-            : object(new Object(size, vertex_count, vertex))
-            , vertex_count(vertex_count){}
+    /*
+     * @fn
+     * コンストラクタ
+     * @param size 頂点の位置の次元
+     * @param shared 頂点属性を格納しているバッファオブジェクト (StreamBuffer::getBuffer())
+     * @detail 描画はdraw(first, count)で範囲を指定して行う
+     */
+    template <typename V>
+    Shape(GLint size, Object::Shared<V> shared)
+            : object(new Object(size, shared))
+            , vertex_count(0){}
 
     // 描画
     void draw() const {
@@ -45,6 +57,39 @@ public:
         execute();
     }
 
+    /*
+     * @fn
+     * 結合してから必要ならプログラムオブジェクトを検証して描画
+     * @param validator 検証 (このオブジェクトが結合した状態で調べるので、同じプログラムで複数の図形を描いても検証し直さない)
+     * @param program 使用中のプログラムオブジェクト名
+     * @return 描画したら true (検証に失敗したら描画しない)
+     */
+    bool draw(ProgramValidator &validator, GLuint program) const {
+        // 頂点配列オブジェクトを結合する
+        object->bind();
+
+        // 結合した状態で検証する
+        if (!validator.validate(program)) return false;
+
+        // 描画の実行
+        execute();
+        return true;
+    }
+
+    /*
+     * @fn
+     * バッファの一部を使って描画
+     * @param first 最初の頂点の番号 (StreamBuffer::Range::first)
+     * @param count 頂点の数
+     */
+    void draw(GLint first, GLsizei count) const {
+        // 頂点配列オブジェクトを結合する
+        object->bind();
+
+        // 描画の実行
+        glDrawArrays(GL_TRIANGLES, first, count);
+    }
+
     // 描画の実行
     virtual void execute() const {
         glDrawArrays(GL_TRIANGLES, 0, vertex_count);
@@ -0,0 +1,202 @@
+/*
+ * @file SpriteBatch.h
+ * @brief テクスチャを貼った矩形(スプライト)をまとめて描画するクラス
+ * @detail スプライトの頂点(Object::Vertex_Textrue)をCPU側の配列に溜めておき、end()でテクスチャごとに並べ替えて
+ *         1つの頂点バッファにまとめて転送し、同じテクスチャが続く範囲を1回のglDrawElements()で描く
+ *         インデックスはあらかじめ全スプライト分を作っておいて共有する
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+// 図形データ
+#include "Object.h"
+
+// スプライトの一括描画
+class SpriteBatch {
+    // コピーコンストラクタによるコピー禁止
+    SpriteBatch(const SpriteBatch &b);
+
+    // 代入によるコピー禁止
+    SpriteBatch &operator=(const SpriteBatch &b);
+
+    // 頂点配列オブジェクト名 vertex array object
+    GLuint vao;
+
+    // 頂点バッファオブジェクト名 vertex buffer object
+    GLuint vbo;
+
+    // element buffer object
+    GLuint ebo;
+
+    // 一度に転送できるスプライトの数
+    const GLsizei capacity;
+
+    // スプライト1枚分の頂点
+    struct Sprite {
+        // 貼り付けるテクスチャオブジェクト名
+        GLuint texture;
+
+        // 追加した順番 (同じテクスチャの中では追加した順に描く)
+        GLsizei order;
+
+        // 矩形の4頂点
+        Object::Vertex_Textrue vertex[4];
+    };
+
+    // 溜めているスプライト
+    std::vector<Sprite> sprites;
+
+    // 転送用の頂点の配列
+    std::vector<Object::Vertex_Textrue> staging;
+
+    // 現在のフレームの描画命令の数・スプライトの数
+    unsigned int flushes, quads;
+
+    // 直前のフレームの描画命令の数・スプライトの数
+    unsigned int lastFlushes, lastQuads;
+
+    // 溜めているスプライトのうち first から count 枚を転送して描く
+    void flush(std::size_t first, std::size_t count) {
+        // 頂点の配列に詰める
+        staging.clear();
+        for (std::size_t i = first; i < first + count; ++i)
+            staging.insert(staging.end(), sprites[i].vertex, sprites[i].vertex + 4);
+
+        // 描画中の古い内容を待たないように捨ててから転送する
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, capacity * 4 * sizeof(Object::Vertex_Textrue), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, staging.size() * sizeof(Object::Vertex_Textrue), staging.data());
+
+        // 同じテクスチャが続く範囲ごとに描く
+        std::size_t start(0);
+        while (start < count) {
+            const GLuint texture(sprites[first + start].texture);
+            std::size_t end(start + 1);
+            while (end < count && sprites[first + end].texture == texture) ++end;
+
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glDrawElements(GL_TRIANGLES, static_cast<GLsizei>((end - start) * 6), GL_UNSIGNED_SHORT,
+                           (void*)(start * 6 * sizeof(GLushort)));
+            ++flushes;
+            start = end;
+        }
+        quads += static_cast<unsigned int>(count);
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param capacity 一度に転送できるスプライトの数 (1から、インデックスが16bitに収まるよう16384まで)
+     */
+    explicit SpriteBatch(GLsizei capacity = 16384)
+    : capacity(std::max<GLsizei>(1, std::min<GLsizei>(capacity, 16384)))
+    , flushes(0), quads(0), lastFlushes(0), lastQuads(0) {
+        // 頂点配列オブジェクト
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+
+        // 頂点バッファオブジェクト (毎フレーム書き換える)
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, this->capacity * 4 * sizeof(Object::Vertex_Textrue), nullptr, GL_STREAM_DRAW);
+
+        // 全スプライト分のインデックスを作っておく
+        std::vector<GLushort> indices(this->capacity * 6);
+        for (GLsizei i = 0; i < this->capacity; ++i) {
+            const auto base(static_cast<GLushort>(i * 4));
+            const GLushort quad[] = { base, GLushort(base + 1), GLushort(base + 3),
+                                      GLushort(base + 1), GLushort(base + 2), GLushort(base + 3) };
+            std::copy(quad, quad + 6, indices.begin() + i * 6);
+        }
+        glGenBuffers(1, &ebo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+
+        // 結合されている頂点バッファオブジェクトをin変数から参照できるようにする (Objectと同じ配置)
+        Object::Vertex_Textrue::Format::setup();
+
+        staging.reserve(this->capacity * 4);
+    }
+
+    // デストラクタ
+    virtual ~SpriteBatch() {
+        glDeleteVertexArrays(1, &vao);
+        glDeleteBuffers(1, &vbo);
+        glDeleteBuffers(1, &ebo);
+    }
+
+    // フレームの始めに溜めているスプライトを捨てる
+    void begin() {
+        sprites.clear();
+    }
+
+    /*
+     * @fn
+     * スプライトを追加する
+     * @param texture 貼り付けるテクスチャオブジェクト名 (Texture::getTexture())
+     * @param rect 矩形の範囲 (x0, y0, x1, y1)
+     * @param uv テクスチャ座標の範囲 (u0, v0, u1, v1)
+     * @param color 頂点の色 RGB
+     */
+    void draw(GLuint texture, const GLfloat rect[4], const GLfloat uv[4], const GLfloat color[3]) {
+        Sprite sprite;
+        sprite.texture = texture;
+        sprite.order = static_cast<GLsizei>(sprites.size());
+
+        // 右上・右下・左下・左上の順 (texture02.cpp の矩形と同じ)
+        const GLfloat corner[4][4] = {
+                { rect[2], rect[3], uv[2], uv[3] },
+                { rect[2], rect[1], uv[2], uv[1] },
+                { rect[0], rect[1], uv[0], uv[1] },
+                { rect[0], rect[3], uv[0], uv[3] }
+        };
+        for (int i = 0; i < 4; ++i) {
+            GLfloat *const v(sprite.vertex[i].position_color_coord);
+            v[0] = corner[i][0];
+            v[1] = corner[i][1];
+            v[2] = color[0];
+            v[3] = color[1];
+            v[4] = color[2];
+            v[5] = corner[i][2];
+            v[6] = corner[i][3];
+        }
+        sprites.push_back(sprite);
+    }
+
+    /*
+     * @fn
+     * 溜めたスプライトをテクスチャごとにまとめて描画する
+     * @detail プログラムオブジェクトは呼び出し側で使用開始しておく
+     *         違うテクスチャのスプライト同士の前後関係は保たれない
+     */
+    void end() {
+        // テクスチャごとに並べ替える
+        std::sort(sprites.begin(), sprites.end(), [](const Sprite &a, const Sprite &b) {
+            return a.texture != b.texture ? a.texture < b.texture : a.order < b.order;
+        });
+
+        // 一度に転送できる数ずつ描く
+        for (std::size_t first = 0; first < sprites.size(); first += capacity)
+            flush(first, std::min<std::size_t>(capacity, sprites.size() - first));
+        sprites.clear();
+
+        // 統計を更新する
+        lastFlushes = flushes;
+        lastQuads = quads;
+        flushes = quads = 0;
+    }
+
+    // 直前のフレームの描画命令の数
+    unsigned int getFlushesPerFrame() const { return lastFlushes; }
+
+    // 直前のフレームの描画命令1回あたりのスプライトの数
+    double getQuadsPerFlush() const { return lastFlushes > 0 ? static_cast<double>(lastQuads) / lastFlushes : 0.0; }
+
+    // 直前のフレームのスプライトの数
+    unsigned int getQuadsPerFrame() const { return lastQuads; }
+};
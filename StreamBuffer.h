@@ -0,0 +1,188 @@
+/*
+ * @file StreamBuffer.h
+ * @brief 毎フレーム書き換える頂点データのためのリングバッファのクラス
+ * @detail 大きなバッファオブジェクトを1つだけ確保してフレーム数分の区画に分け、フレームごとに順番に使う
+ *         区画を再び使う前にフェンス(glFenceSync)でGPUがその区画を読み終わるのを待つ
+ *         glBufferStorage()が使えるときは永続的にマップしたままにして、書き込んだ場所をそのまま描画に使う
+ *         使えないとき(OpenGL 4.1)は区画ごとに同期なしでマップし、描画前にアンマップする
+ */
+
+#pragma once
+
+#include <iostream>
+#include <GL/glew.h>
+
+// 頂点データのストリーミング用リングバッファ
+class StreamBuffer {
+    // コピーコンストラクタによるコピー禁止
+    StreamBuffer(const StreamBuffer &b);
+
+    // 代入によるコピー禁止
+    StreamBuffer &operator=(const StreamBuffer &b);
+
+    // 区画の数 (CPUが書いている区画・GPUが読んでいる区画・ドライバが待たせている区画)
+    static constexpr int segments = 3;
+
+    // バッファオブジェクトを結合するターゲット
+    const GLenum target;
+
+    // バッファオブジェクト名
+    GLuint buffer;
+
+    // 1区画のバイト数
+    const GLsizeiptr segment_size;
+
+    // 永続的にマップしているか
+    bool persistent;
+
+    // マップしている先頭のアドレス (永続的にマップしていないときは現在の区画の先頭)
+    char *mapped;
+
+    // 区画ごとのフェンス
+    GLsync fences[segments];
+
+    // 現在の区画の番号 (begin()を呼ぶまでは-1)
+    int current;
+
+    // 現在の区画の中で次に割り当てる位置
+    GLsizeiptr head;
+
+    // フェンスを待った回数 (GPUに追いついてしまった回数)
+    unsigned int stalls;
+
+    // 区画を使い終わるのを待つ
+    void wait(int segment) {
+        GLsync &fence(fences[segment]);
+        if (fence == nullptr) return;
+
+        // まず待たずに調べて、終わっていなければ命令を送り出してから待つ
+        GLenum result(glClientWaitSync(fence, 0, 0));
+        if (result == GL_TIMEOUT_EXPIRED) {
+            ++stalls;
+            do result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            while (result == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+public:
+    // 割り当てた範囲
+    template <typename T>
+    struct Range {
+        // 書き込み先 (割り当てられなければnullptr)
+        T *data;
+
+        // バッファの先頭から数えたTの番号 (glDrawArrays()のfirstにそのまま使える)
+        GLint first;
+
+        // Tの数
+        GLsizei count;
+    };
+
+    /*
+     * @fn
+     * コンストラクタ
+     * @param segment_size 1フレームで使う最大のバイト数
+     * @param target バッファオブジェクトを結合するターゲット
+     */
+    explicit StreamBuffer(GLsizeiptr segment_size, GLenum target = GL_ARRAY_BUFFER)
+    : target(target), segment_size(segment_size), persistent(false), mapped(nullptr)
+    , fences{}, current(-1), head(0), stalls(0) {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(target, buffer);
+
+        if (GLEW_ARB_buffer_storage) {
+            // 変更できない領域を確保して永続的にマップする
+            const GLbitfield flags(GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+            glBufferStorage(target, segments * segment_size, nullptr, flags);
+            mapped = static_cast<char *>(glMapBufferRange(target, 0, segments * segment_size, flags));
+            persistent = mapped != nullptr;
+            if (!persistent) std::cerr << "Warning: Can't map stream buffer persistently." << std::endl;
+        }
+        else {
+            glBufferData(target, segments * segment_size, nullptr, GL_STREAM_DRAW);
+        }
+    }
+
+    // デストラクタ
+    virtual ~StreamBuffer() {
+        for (GLsync fence : fences)
+            if (fence != nullptr) glDeleteSync(fence);
+        if (persistent || mapped != nullptr) {
+            glBindBuffer(target, buffer);
+            glUnmapBuffer(target);
+        }
+        glDeleteBuffers(1, &buffer);
+    }
+
+    // バッファオブジェクト名を取り出す (Objectの頂点バッファとして使う)
+    GLuint getBuffer() const { return buffer; }
+
+    // 永続的にマップしているか
+    bool isPersistent() const { return persistent; }
+
+    // フェンスを待った回数を取り出す
+    unsigned int getStalls() const { return stalls; }
+
+    /*
+     * @fn
+     * フレームの始めに次の区画に進む
+     * @detail 前の区画を読む描画命令の後ろにフェンスを置き、次の区画のフェンスを待つ
+     */
+    void begin() {
+        // 前の区画を使う命令はすべて発行済み
+        if (current >= 0) {
+            if (!persistent && mapped != nullptr) commit();
+            fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+
+        // 次の区画をGPUが読み終わるのを待つ
+        current = (current + 1) % segments;
+        head = 0;
+        wait(current);
+
+        if (!persistent) {
+            // 同期はフェンスで取っているので、ドライバには同期させずにマップする
+            glBindBuffer(target, buffer);
+            mapped = static_cast<char *>(glMapBufferRange(target, current * segment_size, segment_size,
+                    GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT));
+        }
+    }
+
+    /*
+     * @fn
+     * 現在の区画から書き込み先を割り当てる
+     * @param count Tの数
+     * @return 区画に収まらなければdataがnullptrの範囲を返す
+     * @detail 書き込んだ内容はcommit()の後でこのフレームの間だけ描画に使える
+     */
+    template <typename T>
+    Range<T> allocate(GLsizei count) {
+        if (current < 0 || mapped == nullptr) return Range<T>{ nullptr, 0, 0 };
+
+        // 先頭からの位置がTの大きさで割り切れるようにそろえる
+        const GLsizeiptr base(current * segment_size);
+        GLsizeiptr offset(base + head);
+        offset = (offset + sizeof(T) - 1) / sizeof(T) * sizeof(T);
+        const GLsizeiptr bytes(count * sizeof(T));
+        if (offset + bytes > base + segment_size)
+            return Range<T>{ nullptr, 0, 0 };
+
+        head = offset + bytes - base;
+        T *const data(reinterpret_cast<T *>(persistent ? mapped + offset : mapped + (offset - base)));
+        return Range<T>{ data, static_cast<GLint>(offset / sizeof(T)), count };
+    }
+
+    /*
+     * @fn
+     * 書き込みを終えて描画に使えるようにする
+     * @detail 永続的にマップしていれば何もしない (coherentなので書いた内容はそのまま見える)
+     */
+    void commit() {
+        if (persistent || mapped == nullptr) return;
+        glBindBuffer(target, buffer);
+        glUnmapBuffer(target);
+        mapped = nullptr;
+    }
+};
@@ -1,15 +1,20 @@
 /*
- * @file Shape.h
- * @brief 図形の描画を行うクラス
- * @detail 描画するObjectクラスのインスタンス(図形データ)を指すポインタを保持
+ * @file Texture.h
+ * @brief テクスチャを貼った図形の描画を行うクラス
+ * @detail 描画するObjectクラスのインスタンス(図形データ)を指すポインタとテクスチャオブジェクト名を保持
+ *         画像ファイルから作るときはファイルのチャンネル数のまま変換せずに転送する
  */
 
 #pragma once
 
+#include <iostream>
 #include <memory>
 
 // 図形データ
 #include "Object.h"
+#include "PixelFormat.h"
+#include "ProgramValidator.h"
+#include "TextureFile.h"
 #include "stb_image.h"
 
 // 図形の描画
@@ -23,6 +28,9 @@ protected:
 
     GLuint texture;
 
+    // テクスチャを共有しているときに持ち主を生かしておく (TextureCache のハンドルなど)
+    std::shared_ptr<const void> owner;
+
 public:
     /*
      * @fn
@@ -30,9 +38,14 @@ public:
      * @param size 頂点の位置の次元
      * @param vertex_count 頂点の数
      * @param vertex 頂点属性を格納した配列
+     * @param indices 頂点のインデックスを格納した配列
+     * @param index_count インデックスの数
+     * @param path 画像ファイル名 (テクスチャのファイルならデコードせずに全レベルを転送する)
+     * @param channels テクスチャのチャンネル数 (0ならファイルのまま, 1にするとマスク用の GL_R8 になる)
      */
-    Texture(GLint size, GLsizei vertex_count, const Object::Vertex_Textrue *vertex, const Object::indices *indices)
-            : object(new Object(size, vertex_count, vertex, indices))
+    Texture(GLint size, GLsizei vertex_count, const Object::Vertex_Textrue *vertex, const Object::indices *indices, GLsizei index_count,
+            const char *path = "Avicii.png", int channels = 0)
+            : object(new Object(size, vertex_count, vertex, indices, index_count))
             , vertex_count(vertex_count)
             {
                 GLuint texture;
@@ -45,22 +58,70 @@ public:
                 // set texture filtering parameters
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
                 glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                // 前もって作ったテクスチャのファイルはそのまま転送する
+                if (TextureFile::isTextureFile(path))
+                {
+                    TextureFile file;
+                    if (!file.load(path) || !file.upload(texture))
+                        std::cerr << "Failed to load texture: " << path << std::endl;
+                    return;
+                }
                 // load image, create texture and generate mipmaps
                 int width, height, nrChannels;
-                // The FileSystem::getPath(...) is part of the GitHub repository so we can find files on any IDE/platform; replace it with your own image path.
-                unsigned char *data = stbi_load("Avicii.png", &width, &height, &nrChannels, 0);
+                // テクスチャに必要なチャンネル数でデコードさせて、転送の前に変換しないようにする
+                unsigned char *data = stbi_load(path, &width, &height, &nrChannels, channels);
                 if (data)
                 {
-                    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+                    // デコードしたチャンネル数から形式と GL_UNPACK_ALIGNMENT を選ぶ
+                    const PixelFormat pixel(PixelFormat::fromChannels(channels != 0 ? channels : nrChannels, width));
+                    pixel.upload(0, width, height, data);
+                    pixel.setSwizzle();
                     glGenerateMipmap(GL_TEXTURE_2D);
                 }
                 else
                 {
-                    std::cout << "Failed to load texture" << std::endl;
+                    std::cerr << "Failed to load texture: " << path << std::endl;
                 }
                 stbi_image_free(data);
     }
 
+    /*
+     * @fn
+     * コンストラクタ
+     * @param size 頂点の位置の次元
+     * @param vertex_count 頂点の数
+     * @param vertex 頂点属性を格納した配列
+     * @param indices 頂点のインデックスを格納した配列
+     * @param index_count インデックスの数
+     * @param texture 貼り付けるテクスチャオブジェクト名 (TextureLoader::Handle::getTexture() など)
+     */
+    Texture(GLint size, GLsizei vertex_count, const Object::Vertex_Textrue *vertex, const Object::indices *indices, GLsizei index_count,
+            GLuint texture)
+            : object(new Object(size, vertex_count, vertex, indices, index_count))
+            , vertex_count(vertex_count)
+            , texture(texture) {}
+
+    /*
+     * @fn
+     * コンストラクタ
+     * @param size 頂点の位置の次元
+     * @param vertex_count 頂点の数
+     * @param vertex 頂点属性を格納した配列
+     * @param indices 頂点のインデックスを格納した配列
+     * @param index_count インデックスの数
+     * @param handle 貼り付けるテクスチャのハンドル (TextureCache::acquire() など, このインスタンスが持ち続ける)
+     */
+    template <typename H>
+    Texture(GLint size, GLsizei vertex_count, const Object::Vertex_Textrue *vertex, const Object::indices *indices, GLsizei index_count,
+            const std::shared_ptr<H> &handle)
+            : object(new Object(size, vertex_count, vertex, indices, index_count))
+            , vertex_count(vertex_count)
+            , texture(handle->getTexture())
+            , owner(handle) {}
+
+    // テクスチャオブジェクト名を取り出す
+    GLuint getTexture() const { return texture; }
+
     // 描画
     void draw() const {
         // bind Texture
@@ -72,8 +133,29 @@ public:
         execute();
     }
 
+    /*
+     * @fn
+     * 結合してから必要ならプログラムオブジェクトを検証して描画
+     * @param validator 検証 (このオブジェクトが結合した状態で調べるので、同じプログラムで複数の図形を描いても検証し直さない)
+     * @param program 使用中のプログラムオブジェクト名
+     * @return 描画したら true (検証に失敗したら描画しない)
+     */
+    bool draw(ProgramValidator &validator, GLuint program) const {
+        // bind Texture
+        glBindTexture(GL_TEXTURE_2D, texture);
+        // 頂点配列オブジェクトを結合する
+        object->bind();
+
+        // 結合した状態で検証する
+        if (!validator.validate(program)) return false;
+
+        // 描画の実行
+        execute();
+        return true;
+    }
+
     // 描画の実行
     virtual void execute() const {
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        glDrawElements(GL_TRIANGLES, object->getIndexCount(), object->getIndexType(), 0);
     }
 };
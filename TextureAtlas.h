@@ -0,0 +1,427 @@
+/*
+ * @file TextureAtlas.h
+ * @brief 小さな画像を大きなテクスチャ(ページ)に詰め込むクラス
+ * @detail 画像の配置はスカイライン法(bottom-left)で決める 追加した画像は動かさないので、後から画像を追加しても
+ *         すでに返したテクスチャ座標は変わらない 画像の周りには縁の画素を引き延ばした余白(bleed)を付けて、
+ *         ミップマップや線形補間で隣の画像の色が混ざらないようにする
+ *         実行時はページをテクスチャとして作り glTexSubImage2D() で書き込む
+ *         事前に作るときはページをCPU側に持っておき、TGAファイルと配置の一覧に書き出す
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include "stb_image.h"
+
+// スカイライン法による矩形の配置
+class SkylinePacker {
+    // スカイラインの区間 (x から width の幅で高さが y)
+    struct Segment {
+        int x, y, width;
+    };
+
+    // 配置する範囲の大きさ
+    int width, height;
+
+    // 左から順に並べたスカイライン
+    std::vector<Segment> skyline;
+
+    // 使っている面積
+    long long used;
+
+    // i 番目の区間から幅 w の矩形を置いたときの高さ (置けなければ-1)
+    int fit(std::size_t i, int w, int h) const {
+        if (skyline[i].x + w > width) return -1;
+        int y(0), remaining(w);
+        for (std::size_t j = i; remaining > 0; ++j) {
+            if (j >= skyline.size()) return -1;
+            y = std::max(y, skyline[j].y);
+            if (y + h > height) return -1;
+            remaining -= skyline[j].width;
+        }
+        return y;
+    }
+
+    // i 番目の区間の位置に矩形を置いてスカイラインを更新する
+    void place(std::size_t i, int x, int y, int w) {
+        const Segment segment = { x, y, w };
+        skyline.insert(skyline.begin() + i, segment);
+
+        // 新しい区間に隠れた区間を削る
+        const int right(x + w);
+        for (std::size_t j = i + 1; j < skyline.size();) {
+            Segment &next(skyline[j]);
+            if (next.x >= right) break;
+            const int cut(std::min(right - next.x, next.width));
+            next.x += cut;
+            next.width -= cut;
+            if (next.width > 0) break;
+            skyline.erase(skyline.begin() + j);
+        }
+
+        // 同じ高さの区間をまとめる
+        for (std::size_t j = 0; j + 1 < skyline.size();) {
+            if (skyline[j].y == skyline[j + 1].y) {
+                skyline[j].width += skyline[j + 1].width;
+                skyline.erase(skyline.begin() + j + 1);
+            }
+            else {
+                ++j;
+            }
+        }
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param width 配置する範囲の幅
+     * @param height 配置する範囲の高さ
+     */
+    SkylinePacker(int width, int height)
+    : width(width), height(height), used(0) {
+        const Segment segment = { 0, 0, width };
+        skyline.push_back(segment);
+    }
+
+    /*
+     * @fn
+     * 矩形を置く場所を探して置く
+     * @param w 矩形の幅
+     * @param h 矩形の高さ
+     * @param x 置いた位置 (左下)
+     * @param y 置いた位置 (左下)
+     * @return 置けたら true
+     * @detail 一番低い位置、同じ高さならすき間の一番少ない位置を選ぶ
+     */
+    bool insert(int w, int h, int &x, int &y) {
+        std::size_t best(skyline.size());
+        int bestY(height), bestWidth(width + 1);
+        for (std::size_t i = 0; i < skyline.size(); ++i) {
+            const int top(fit(i, w, h));
+            if (top < 0) continue;
+            if (top < bestY || (top == bestY && skyline[i].width < bestWidth)) {
+                best = i;
+                bestY = top;
+                bestWidth = skyline[i].width;
+            }
+        }
+        if (best == skyline.size()) return false;
+
+        x = skyline[best].x;
+        y = bestY;
+        place(best, x, y + h, w);
+        used += static_cast<long long>(w) * h;
+        return true;
+    }
+
+    // 使っている面積の割合
+    double getOccupancy() const { return static_cast<double>(used) / (static_cast<double>(width) * height); }
+};
+
+// テクスチャアトラス
+class TextureAtlas {
+public:
+    // ページの作り方
+    enum Mode {
+        // 実行時にテクスチャとして作る
+        runtime,
+
+        // CPU側で作ってファイルに書き出す
+        offline
+    };
+
+    // 詰め込んだ画像の場所
+    struct Region {
+        // ページの番号
+        std::size_t page;
+
+        // ページの中の位置と大きさ (余白を除く) [画素]
+        int x, y, width, height;
+
+        // テクスチャ座標の範囲 (u0, v0, u1, v1) Object::Vertex_Textrue や SpriteBatch::draw() にそのまま使える
+        GLfloat uv[4];
+    };
+
+private:
+    // コピーコンストラクタによるコピー禁止
+    TextureAtlas(const TextureAtlas &a);
+
+    // 代入によるコピー禁止
+    TextureAtlas &operator=(const TextureAtlas &a);
+
+    // ページ
+    struct Page {
+        // テクスチャオブジェクト名 (offline なら0)
+        GLuint texture;
+
+        // 画素 RGBA (runtime なら空)
+        std::vector<GLubyte> pixels;
+
+        // 配置
+        SkylinePacker packer;
+
+        // ミップマップを作り直す必要があるか
+        bool dirty;
+
+        explicit Page(int size) : texture(0), packer(size, size), dirty(false) {}
+    };
+
+    // ページの作り方
+    const Mode mode;
+
+    // ページの一辺の画素数
+    const int size;
+
+    // 画像の周りの余白 [画素]
+    const int padding;
+
+    // ミップマップを作るか
+    const bool mipmap;
+
+    // ページ
+    std::vector<Page> pages;
+
+    // 名前から詰め込んだ画像を引く表
+    std::map<std::string, Region> regions;
+
+    // ページを追加する
+    Page &addPage() {
+        pages.push_back(Page(size));
+        Page &page(pages.back());
+        if (mode == offline) {
+            page.pixels.assign(static_cast<std::size_t>(size) * size * 4, 0);
+        }
+        else {
+            // 余白の外が未定義の色にならないように0で埋めておく
+            const std::vector<GLubyte> zero(static_cast<std::size_t>(size) * size * 4, 0);
+            glGenTextures(1, &page.texture);
+            glBindTexture(GL_TEXTURE_2D, page.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmap ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, zero.data());
+            page.dirty = mipmap;
+        }
+        return page;
+    }
+
+    // 縁の画素を余白に引き延ばした画像を作る
+    std::vector<GLubyte> extrude(const GLubyte *pixels, int width, int height) const {
+        const int w(width + padding * 2), h(height + padding * 2);
+        std::vector<GLubyte> result(static_cast<std::size_t>(w) * h * 4);
+        for (int y = 0; y < h; ++y) {
+            const int sy(std::min(std::max(y - padding, 0), height - 1));
+            for (int x = 0; x < w; ++x) {
+                const int sx(std::min(std::max(x - padding, 0), width - 1));
+                std::copy(pixels + (static_cast<std::size_t>(sy) * width + sx) * 4,
+                          pixels + (static_cast<std::size_t>(sy) * width + sx) * 4 + 4,
+                          result.begin() + (static_cast<std::size_t>(y) * w + x) * 4);
+            }
+        }
+        return result;
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param mode ページの作り方
+     * @param size ページの一辺の画素数
+     * @param padding 画像の周りの余白 (ミップマップのレベル n まで混ざらないようにするには 2^n 画素)
+     * @param mipmap ミップマップを作るか
+     * @detail runtime のときは OpenGL のコンテキストを作成した後で呼び出す
+     */
+    explicit TextureAtlas(Mode mode = runtime, int size = 2048, int padding = 4, bool mipmap = true)
+    : mode(mode), size(size), padding(padding), mipmap(mipmap) {}
+
+    // デストラクタ
+    virtual ~TextureAtlas() {
+        for (const auto &page : pages)
+            if (page.texture != 0) glDeleteTextures(1, &page.texture);
+    }
+
+    /*
+     * @fn
+     * 画像を詰め込む
+     * @param name 画像の名前
+     * @param pixels 画素 RGBA
+     * @param width 画像の幅
+     * @param height 画像の高さ
+     * @return 詰め込んだ場所 (画像が空かページより大きければnullptr)
+     * @detail 空きのあるページに入らなければページを追加する 同じ名前の画像は一度しか詰め込まない
+     */
+    const Region *add(const std::string &name, const GLubyte *pixels, int width, int height) {
+        const auto found(regions.find(name));
+        if (found != regions.end()) return &found->second;
+
+        // 空の画像は余白を作るときに画素の外を読んでしまう
+        if (pixels == nullptr || width <= 0 || height <= 0) {
+            std::cerr << "Image is empty: " << name << std::endl;
+            return nullptr;
+        }
+
+        const int w(width + padding * 2), h(height + padding * 2);
+        if (w > size || h > size) {
+            std::cerr << "Image is too large for the atlas: " << name << std::endl;
+            return nullptr;
+        }
+
+        // 今あるページに順に入れてみる
+        int x(0), y(0);
+        std::size_t index(0);
+        while (index < pages.size() && !pages[index].packer.insert(w, h, x, y)) ++index;
+        if (index == pages.size()) addPage().packer.insert(w, h, x, y);
+        Page &page(pages[index]);
+
+        // 余白ごと書き込む
+        const std::vector<GLubyte> padded(extrude(pixels, width, height));
+        if (mode == offline) {
+            for (int row = 0; row < h; ++row)
+                std::copy(padded.begin() + static_cast<std::size_t>(row) * w * 4,
+                          padded.begin() + static_cast<std::size_t>(row + 1) * w * 4,
+                          page.pixels.begin() + (static_cast<std::size_t>(y + row) * size + x) * 4);
+        }
+        else {
+            glBindTexture(GL_TEXTURE_2D, page.texture);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, padded.data());
+            page.dirty = mipmap;
+        }
+
+        Region region;
+        region.page = index;
+        region.x = x + padding;
+        region.y = y + padding;
+        region.width = width;
+        region.height = height;
+        region.uv[0] = static_cast<GLfloat>(region.x) / size;
+        region.uv[1] = static_cast<GLfloat>(region.y) / size;
+        region.uv[2] = static_cast<GLfloat>(region.x + width) / size;
+        region.uv[3] = static_cast<GLfloat>(region.y + height) / size;
+        return &regions.emplace(name, region).first->second;
+    }
+
+    /*
+     * @fn
+     * 画像ファイルを読み込んで詰め込む
+     * @param path 画像ファイル名 (名前にも使う)
+     * @return 詰め込んだ場所 (読み込めなければnullptr)
+     */
+    const Region *add(const std::string &path) {
+        const auto found(regions.find(path));
+        if (found != regions.end()) return &found->second;
+
+        int width, height, channels;
+        stbi_uc *const pixels(stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha));
+        if (pixels == nullptr) {
+            std::cerr << "Failed to load texture: " << path << std::endl;
+            return nullptr;
+        }
+        const Region *const region(add(path, pixels, width, height));
+        stbi_image_free(pixels);
+        return region;
+    }
+
+    /*
+     * @fn
+     * 詰め込んだ画像を探す
+     * @param name 画像の名前
+     * @return 詰め込んだ場所 (なければnullptr)
+     */
+    const Region *find(const std::string &name) const {
+        const auto found(regions.find(name));
+        return found != regions.end() ? &found->second : nullptr;
+    }
+
+    /*
+     * @fn
+     * 書き込んだページのミップマップを作り直す
+     * @detail runtime のとき、画像を追加した後で描画の前に呼び出す
+     */
+    void update() {
+        for (auto &page : pages) {
+            if (!page.dirty) continue;
+            glBindTexture(GL_TEXTURE_2D, page.texture);
+            glGenerateMipmap(GL_TEXTURE_2D);
+            page.dirty = false;
+        }
+    }
+
+    // ページの数
+    std::size_t getPageCount() const { return pages.size(); }
+
+    // ページのテクスチャオブジェクト名 (offline なら0)
+    GLuint getTexture(std::size_t page) const { return pages[page].texture; }
+
+    // ページの画素 RGBA (runtime なら空)
+    const std::vector<GLubyte> &getPixels(std::size_t page) const { return pages[page].pixels; }
+
+    // ページの一辺の画素数
+    int getSize() const { return size; }
+
+    // ページの使っている面積の割合 (余白を含む)
+    double getOccupancy(std::size_t page) const { return pages[page].packer.getOccupancy(); }
+
+    /*
+     * @fn
+     * offline のページを非圧縮のTGAファイルに書き出す
+     * @param page ページの番号
+     * @param path ファイル名
+     * @return 書き出せたら true
+     */
+    bool savePage(std::size_t page, const std::string &path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file || pages[page].pixels.empty()) {
+            std::cerr << "Can't write atlas page: " << path << std::endl;
+            return false;
+        }
+
+        // 原点は左下 (テクスチャ座標と同じ向き), 32bit BGRA
+        const GLubyte header[18] = {
+                0, 0, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                GLubyte(size & 0xff), GLubyte(size >> 8), GLubyte(size & 0xff), GLubyte(size >> 8), 32, 8
+        };
+        file.write(reinterpret_cast<const char *>(header), sizeof header);
+        std::vector<GLubyte> bgra(pages[page].pixels);
+        for (std::size_t i = 0; i < bgra.size(); i += 4) std::swap(bgra[i], bgra[i + 2]);
+        file.write(reinterpret_cast<const char *>(bgra.data()), bgra.size());
+        return static_cast<bool>(file);
+    }
+
+    /*
+     * @fn
+     * 詰め込んだ画像の一覧をテキストファイルに書き出す
+     * @param path ファイル名
+     * @return 書き出せたら true
+     * @detail 1行に「名前 ページ x y 幅 高さ u0 v0 u1 v1」を空白区切りで書く
+     */
+    bool saveManifest(const std::string &path) const {
+        std::ofstream file(path);
+        if (!file) {
+            std::cerr << "Can't write atlas manifest: " << path << std::endl;
+            return false;
+        }
+        for (const auto &entry : regions) {
+            const Region &r(entry.second);
+            file << entry.first << ' ' << r.page << ' ' << r.x << ' ' << r.y << ' ' << r.width << ' ' << r.height
+                 << ' ' << r.uv[0] << ' ' << r.uv[1] << ' ' << r.uv[2] << ' ' << r.uv[3] << '\n';
+        }
+        return static_cast<bool>(file);
+    }
+
+    // 統計を表示する
+    void printStatistics(std::ostream &out = std::cerr) const {
+        out << "Texture atlas: " << regions.size() << " images in " << pages.size() << " pages of " << size << "x" << size;
+        for (std::size_t i = 0; i < pages.size(); ++i) out << (i == 0 ? ", occupancy " : " ") << getOccupancy(i) * 100.0 << "%";
+        out << std::endl;
+    }
+};
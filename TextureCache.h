@@ -0,0 +1,192 @@
+/*
+ * @file TextureCache.h
+ * @brief 同じ画像のテクスチャを共有するクラス
+ * @detail 画像ファイルの正規化したパスと読み込みの設定をキーにして、TextureLoader で読み込んだテクスチャを
+ *         参照カウント付きで使い回す 同じ画像を何度 acquire() してもデコードとテクスチャの作成は1回だけ
+ *         誰も使わなくなったテクスチャはすぐには破棄せず、バイト数の予算を超えたら古いものから破棄する (LRU)
+ *         キャッシュは返したハンドルよりも長く生きていなければならない
+ */
+
+#pragma once
+
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// 画像の非同期読み込み
+#include "TextureLoader.h"
+
+// 読み込んだテクスチャの共有
+class TextureCache {
+    // コピーコンストラクタによるコピー禁止
+    TextureCache(const TextureCache &c);
+
+    // 代入によるコピー禁止
+    TextureCache &operator=(const TextureCache &c);
+
+    // キャッシュの項目
+    struct Entry {
+        // テクスチャのハンドル (キャッシュが持つ強い参照)
+        std::shared_ptr<const TextureLoader::Handle> handle;
+
+        // 使っている数
+        unsigned int references;
+
+        // 使われていないときの LRU の位置
+        std::list<std::string>::iterator position;
+
+        // 使われなくなったときに unusedBytes に足したバイト数
+        std::size_t bytes;
+    };
+
+    // 読み込みに使うローダー
+    TextureLoader &loader;
+
+    // キーから項目を引く表
+    std::unordered_map<std::string, Entry> entries;
+
+    // 使われていない項目のキー (先頭が最近使われなくなったもの)
+    std::list<std::string> unused;
+
+    // 使われていないテクスチャに使ってよいバイト数
+    std::size_t budget;
+
+    // 使われていないテクスチャのバイト数 (trim() で毎回数え直さない)
+    std::size_t unusedBytes;
+
+    // 見つかった数・見つからなかった数・破棄した数
+    unsigned int hits, misses, evictions;
+
+    // パスを正規化する (ファイルがなければそのまま)
+    static std::string canonical(const std::string &path) {
+#ifdef _WIN32
+        char resolved[_MAX_PATH];
+        if (_fullpath(resolved, path.c_str(), _MAX_PATH) != nullptr) return resolved;
+#else
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved) != nullptr) return resolved;
+#endif
+        return path;
+    }
+
+    // 使われなくなった項目を LRU に入れる
+    void release(const std::string &key) {
+        const auto found(entries.find(key));
+        if (found == entries.end()) return;
+        Entry &entry(found->second);
+        if (--entry.references > 0) return;
+        unused.push_front(key);
+        entry.position = unused.begin();
+        entry.bytes = entry.handle->getBytes();
+        unusedBytes += entry.bytes;
+        trim();
+    }
+
+    // 使われていない項目を破棄する
+    void evict(std::list<std::string>::iterator position) {
+        const auto found(entries.find(*position));
+        unusedBytes -= found->second.bytes;
+        entries.erase(found);
+        unused.erase(position);
+        ++evictions;
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param loader 読み込みに使うローダー
+     * @param budget 使われていないテクスチャを残しておくバイト数
+     */
+    explicit TextureCache(TextureLoader &loader, std::size_t budget = 64 << 20)
+    : loader(loader), budget(budget), unusedBytes(0), hits(0), misses(0), evictions(0) {}
+
+    // デストラクタ
+    virtual ~TextureCache() {
+        if (entries.size() != unused.size())
+            std::cerr << "TextureCache destroyed with " << entries.size() - unused.size() << " textures in use" << std::endl;
+    }
+
+    /*
+     * @fn
+     * テクスチャを取り出す (なければ読み込みを始める)
+     * @param path 画像ファイル名
+     * @param options 読み込みの設定
+     * @return ハンドル (すべてのコピーが破棄されたらキャッシュに返る)
+     */
+    std::shared_ptr<const TextureLoader::Handle> acquire(const std::string &path,
+                                                         const TextureLoader::Options &options = TextureLoader::Options()) {
+        const std::string key(canonical(path) + "|" + options.key());
+        auto found(entries.find(key));
+        if (found != entries.end()) {
+            ++hits;
+            if (found->second.references == 0) {
+                unused.erase(found->second.position);
+                unusedBytes -= found->second.bytes;
+            }
+        }
+        else {
+            ++misses;
+            Entry entry;
+            entry.handle = loader.load(path, options);
+            entry.references = 0;
+            entry.bytes = 0;
+            found = entries.emplace(key, entry).first;
+        }
+        ++found->second.references;
+
+        // 返すポインタが破棄されたら参照を減らす
+        return std::shared_ptr<const TextureLoader::Handle>(found->second.handle.get(),
+                                                            [this, key](const TextureLoader::Handle *) { release(key); });
+    }
+
+    // 使われていないテクスチャを予算に収まるまで古いものから破棄する
+    void trim() {
+        while (!unused.empty() && unusedBytes > budget) evict(std::prev(unused.end()));
+    }
+
+    // 使われていないテクスチャをすべて破棄する
+    void purge() {
+        while (!unused.empty()) evict(std::prev(unused.end()));
+    }
+
+    // 使われていないテクスチャを残しておくバイト数を設定する
+    void setBudget(std::size_t bytes) {
+        budget = bytes;
+        trim();
+    }
+
+    // 見つかった数
+    unsigned int getHits() const { return hits; }
+
+    // 見つからなかった数
+    unsigned int getMisses() const { return misses; }
+
+    // 破棄した数
+    unsigned int getEvictions() const { return evictions; }
+
+    // キャッシュにあるテクスチャの数
+    std::size_t getSize() const { return entries.size(); }
+
+    // キャッシュにあるテクスチャのバイト数
+    std::size_t getResidentBytes() const {
+        std::size_t bytes(0);
+        for (const auto &entry : entries) bytes += entry.second.handle->getBytes();
+        return bytes;
+    }
+
+    // 使われていないテクスチャのバイト数 (読み込み中に使われなくなったものは0として数える)
+    std::size_t getUnusedBytes() const { return unusedBytes; }
+
+    // 統計を表示する
+    void printStatistics(std::ostream &out = std::cerr) const {
+        out << "Texture cache: " << entries.size() << " textures (" << unused.size() << " unused)"
+            << ", hits " << hits << ", misses " << misses << ", evictions " << evictions
+            << ", resident " << getResidentBytes() << " bytes (unused " << getUnusedBytes() << ")" << std::endl;
+    }
+};
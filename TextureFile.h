@@ -0,0 +1,339 @@
+/*
+ * @file TextureFile.h
+ * @brief ミップマップの全レベルをGPUにそのまま渡せる形で持つテクスチャのファイル
+ * @detail ヘッダ・レベルの表・各レベルのデータの順に並べる (数値はすべてリトルエンディアン)
+ *             Header      (48バイト)
+ *             Level[n]    (24バイト x レベルの数)
+ *             データ      (各レベルの先頭は16バイト境界)
+ *         ブロック圧縮(BC1/BC3/BC7)したものは glCompressedTexImage2D() でデコードせずに転送する
+ *         圧縮形式に対応しない環境では CPU でデコードして RGBA8 で転送する
+ *         ファイルはメモリにマップし、各レベルはヒープにコピーせずにマップした領域から直接
+ *         (PixelUploader を渡せばそのバッファを経由して) 転送する
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+// ブロック圧縮
+#include "BlockCompression.h"
+
+// ファイルのメモリへのマップ
+#include "MappedFile.h"
+
+// チャンネル数によるテクスチャの形式
+#include "PixelFormat.h"
+
+// ピクセルバッファによる転送
+#include "PixelUploader.h"
+
+// テクスチャのファイル
+class TextureFile {
+public:
+    // ファイルの先頭
+    struct Header {
+        // "GLTX"
+        char magic[4];
+
+        // 形式の版
+        std::uint32_t version;
+
+        // テクスチャの形式 (GL_RGBA8, GL_COMPRESSED_RGBA_BPTC_UNORM など)
+        std::uint32_t internal_format;
+
+        // 画素の形式と型 (圧縮していなければ GL_RGBA と GL_UNSIGNED_BYTE など, 圧縮していれば0)
+        std::uint32_t format, type;
+
+        // レベル0の大きさ
+        std::uint32_t width, height;
+
+        // レベルの数
+        std::uint32_t levels;
+
+        // ブロック圧縮の形式 (BlockCompression::Format, 圧縮していなければ0)
+        std::uint32_t compression;
+
+        // 1画素のチャンネル数 (圧縮していないとき)
+        std::uint32_t channels;
+
+        // 色がsRGBか
+        std::uint32_t srgb;
+
+        // 予約
+        std::uint32_t reserved;
+    };
+
+    // レベルの表の項目
+    struct Level {
+        // ファイルの先頭からの位置とバイト数
+        std::uint64_t offset, size;
+
+        // 大きさ
+        std::uint32_t width, height;
+    };
+
+    // 形式の版
+    static const std::uint32_t version = 1;
+
+private:
+    // コピーコンストラクタによるコピー禁止
+    TextureFile(const TextureFile &f);
+
+    // 代入によるコピー禁止
+    TextureFile &operator=(const TextureFile &f);
+
+    // メモリにマップしたファイル
+    MappedFile mapped;
+
+    // マップできなかったときに読み込んだファイルの中身
+    std::vector<GLubyte> contents;
+
+    // ファイルの中身の先頭とバイト数 (mapped か contents を指す)
+    const GLubyte *base;
+    std::size_t length;
+
+    // ヘッダ
+    Header header;
+
+    // レベルの表
+    std::vector<Level> levels;
+
+    // 1成分のバイト数 (扱えない型なら0)
+    static std::uint64_t componentBytes(std::uint32_t type) {
+        switch (type) {
+            case GL_UNSIGNED_BYTE: case GL_BYTE: return 1;
+            case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: return 2;
+            case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: return 4;
+            default: return 0;
+        }
+    }
+
+    // レベルに最低限いるバイト数 (形式が正しくなければ0)
+    std::uint64_t requiredBytes(const Level &level) const {
+        const std::uint64_t width(level.width), height(level.height);
+        if (header.compression == 0) {
+            if (header.channels < 1 || header.channels > 4) return 0;
+            return width * height * header.channels * componentBytes(header.type);
+        }
+        if (header.compression < BlockCompression::bc1 || header.compression > BlockCompression::bc7) return 0;
+        const std::uint64_t block(BlockCompression::blockBytes(static_cast<BlockCompression::Format>(header.compression)));
+        return (width + 3) / 4 * ((height + 3) / 4) * block;
+    }
+
+    // 中身を調べてヘッダとレベルの表を読み込む
+    bool parse(const std::string &path) {
+        if (length < sizeof(Header)) {
+            std::cerr << "Texture file is too small: " << path << std::endl;
+            return false;
+        }
+        std::memcpy(&header, base, sizeof header);
+        if (std::memcmp(header.magic, "GLTX", 4) != 0 || header.version != version) {
+            std::cerr << "Not a texture file: " << path << std::endl;
+            return false;
+        }
+        if (length < sizeof(Header) + static_cast<std::size_t>(header.levels) * sizeof(Level)) {
+            std::cerr << "Broken texture file: " << path << std::endl;
+            return false;
+        }
+        levels.resize(header.levels);
+        if (header.levels > 0) std::memcpy(levels.data(), base + sizeof(Header), header.levels * sizeof(Level));
+        for (const auto &level : levels) {
+            if (level.offset > length || level.size > length - level.offset) {
+                std::cerr << "Broken texture file: " << path << std::endl;
+                return false;
+            }
+
+            // 転送やデコードで読むバイト数に足りなければ壊れている
+            const std::uint64_t required(requiredBytes(level));
+            if (level.width == 0 || level.height == 0 || level.width > 65536 || level.height > 65536
+                || required == 0 || level.size < required) {
+                std::cerr << "Broken texture level (" << level.width << "x" << level.height << ", " << level.size
+                          << " bytes): " << path << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 圧縮形式に対応しているか (sRGBの S3TC は EXT_texture_sRGB もいる)
+    bool isSupported() const {
+        switch (header.compression) {
+            case 0: return true;
+            case BlockCompression::bc1:
+            case BlockCompression::bc3:
+                return GLEW_EXT_texture_compression_s3tc != GL_FALSE && (header.srgb == 0 || GLEW_EXT_texture_sRGB != GL_FALSE);
+            default: return GLEW_VERSION_4_2 != GL_FALSE || GLEW_ARB_texture_compression_bptc != GL_FALSE;
+        }
+    }
+
+public:
+    // コンストラクタ
+    TextureFile()
+    : base(nullptr), length(0) {
+        std::memset(&header, 0, sizeof header);
+    }
+
+    // ファイルがテクスチャのファイルか (先頭の4バイトを調べる)
+    static bool isTextureFile(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        char magic[4];
+        return file.read(magic, sizeof magic) && std::memcmp(magic, "GLTX", 4) == 0;
+    }
+
+    /*
+     * @fn
+     * ファイルを読み込む
+     * @param path ファイル名
+     * @return 読み込めたら true
+     * @detail ファイルはメモリにマップする マップできなければ中身をすべて読み込む
+     */
+    bool load(const std::string &path) {
+        levels.clear();
+        contents.clear();
+        if (mapped.open(path)) {
+            base = mapped.getData();
+            length = mapped.getSize();
+        }
+        else {
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (!file) {
+                std::cerr << "Can't open texture file: " << path << std::endl;
+                return false;
+            }
+            contents.resize(static_cast<std::size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(reinterpret_cast<char *>(contents.data()), contents.size());
+            base = contents.data();
+            length = contents.size();
+        }
+        return parse(path);
+    }
+
+    // 各レベルのデータを先読みするようにOSに伝える (ワーカースレッドで呼び出しておくと転送でページフォールトを待たない)
+    void prefetch() const {
+        if (!levels.empty() && mapped.getData() != nullptr)
+            mapped.prefetch(static_cast<std::size_t>(levels.front().offset), length - static_cast<std::size_t>(levels.front().offset));
+    }
+
+    // ファイルをメモリにマップしているか
+    bool isMapped() const { return mapped.getData() != nullptr; }
+
+    /*
+     * @fn
+     * ファイルに書き出す
+     * @param path ファイル名
+     * @param header ヘッダ (magic・version・levels は書き換える)
+     * @param data 各レベルのデータ
+     * @param size 各レベルの大きさ (幅, 高さ)
+     * @return 書き出せたら true
+     */
+    static bool save(const std::string &path, Header header, const std::vector<std::vector<GLubyte>> &data,
+                     const std::vector<std::pair<std::uint32_t, std::uint32_t>> &size) {
+        std::memcpy(header.magic, "GLTX", 4);
+        header.version = version;
+        header.levels = static_cast<std::uint32_t>(data.size());
+
+        // 各レベルの先頭を16バイト境界にそろえる
+        std::vector<Level> table(data.size());
+        std::uint64_t offset(sizeof(Header) + table.size() * sizeof(Level));
+        for (std::size_t i = 0; i < data.size(); ++i) {
+            offset = (offset + 15) & ~std::uint64_t(15);
+            table[i].offset = offset;
+            table[i].size = data[i].size();
+            table[i].width = size[i].first;
+            table[i].height = size[i].second;
+            offset += data[i].size();
+        }
+
+        std::ofstream file(path, std::ios::binary);
+        if (!file) {
+            std::cerr << "Can't write texture file: " << path << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof header);
+        file.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(Level));
+        std::uint64_t position(sizeof(Header) + table.size() * sizeof(Level));
+        static const char zero[16] = {};
+        for (std::size_t i = 0; i < data.size(); ++i) {
+            file.write(zero, static_cast<std::streamsize>(table[i].offset - position));
+            file.write(reinterpret_cast<const char *>(data[i].data()), data[i].size());
+            position = table[i].offset + data[i].size();
+        }
+        return static_cast<bool>(file);
+    }
+
+    // ヘッダ
+    const Header &getHeader() const { return header; }
+
+    // レベルの数
+    std::size_t getLevelCount() const { return levels.size(); }
+
+    // レベルの表の項目
+    const Level &getLevel(std::size_t level) const { return levels[level]; }
+
+    // レベルのデータ
+    const GLubyte *getData(std::size_t level) const { return base + levels[level].offset; }
+
+    /*
+     * @fn
+     * 全レベルをテクスチャに転送する (描画スレッドで呼び出す)
+     * @param texture テクスチャオブジェクト名
+     * @param uploader nullptr でなければ空きのあるバッファにデータを書き込んで転送する
+     * @return 転送できたら true
+     */
+    bool upload(GLuint texture, PixelUploader *uploader = nullptr) const {
+        if (levels.empty()) return false;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        if (header.compression == 0) PixelFormat::fromChannels(header.channels, header.width).setSwizzle();
+        const bool supported(isSupported());
+        std::vector<GLubyte> decoded;
+        for (std::size_t i = 0; i < levels.size(); ++i) {
+            const Level &level(levels[i]);
+            const GLint index(static_cast<GLint>(i));
+            if (uploader != nullptr && (header.compression == 0 ? header.type == GL_UNSIGNED_BYTE : supported)) {
+                // マップした領域からバッファに直接書き込む (空きがなければ下で直接転送する)
+                const PixelUploader::Staging staging(uploader->claim(static_cast<std::size_t>(level.size)));
+                if (staging.data != nullptr) {
+                    std::memcpy(staging.data, getData(i), static_cast<std::size_t>(level.size));
+                    if (header.compression == 0)
+                        uploader->upload(staging, texture, 0, 0, level.width, level.height, header.format,
+                                         header.internal_format, index);
+                    else
+                        uploader->uploadCompressed(staging, texture, index, level.width, level.height, header.internal_format,
+                                                   static_cast<GLsizei>(level.size));
+                    glBindTexture(GL_TEXTURE_2D, texture);
+                    continue;
+                }
+            }
+            if (header.compression == 0) {
+                // 圧縮していないものはそのまま転送する
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                glTexImage2D(GL_TEXTURE_2D, index, header.internal_format, level.width, level.height, 0,
+                             header.format, header.type, getData(i));
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            }
+            else if (supported) {
+                // デコードせずに転送する
+                glCompressedTexImage2D(GL_TEXTURE_2D, index, header.internal_format, level.width, level.height, 0,
+                                       static_cast<GLsizei>(level.size), getData(i));
+            }
+            else {
+                // 対応していなければCPUでデコードする
+                decoded.resize(static_cast<std::size_t>(level.width) * level.height * 4);
+                BlockCompression::decode(static_cast<BlockCompression::Format>(header.compression), getData(i),
+                                         level.width, level.height, decoded.data());
+                glTexImage2D(GL_TEXTURE_2D, index, header.srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8, level.width, level.height, 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, decoded.data());
+            }
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(levels.size()) - 1);
+        return true;
+    }
+};
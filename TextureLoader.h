@@ -0,0 +1,540 @@
+/*
+ * @file TextureLoader.h
+ * @brief 画像の読み込みを別スレッドで行うクラス
+ * @detail 画像ファイルのデコード(stb_image)をワーカースレッドのプールで行い、呼び出し側にはすぐにハンドルを返す
+ *         ハンドルのテクスチャは最初は代わりの模様で描画され、描画スレッドで update() を呼んだときに
+ *         1フレームあたりの時間の予算の中で本当の画像に置き換わる (テクスチャオブジェクト名は変わらない)
+ *         OpenGLの呼び出しはすべて描画スレッドで行う
+ *         PixelUploader を渡すと、ワーカースレッドがマップしたピクセルバッファに直接書き込み、
+ *         バッファに入らない大きな画像は行の帯に分けて数フレームに渡って転送する
+ *         Options::cpu_mipmap を指定するとミップマップもワーカースレッドで作り、全レベルを明示的に転送する
+ *         TextureFile の形式のファイルはデコードせずにワーカースレッドでメモリにマップし、そこから直接転送する
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <GL/glew.h>
+
+// スレッドごとの設定による画像のデコード
+#include "ImageDecoder.h"
+
+// ピクセルバッファオブジェクトによる転送
+#include "PixelUploader.h"
+
+// CPUによるミップマップの生成
+#include "MipGenerator.h"
+
+// 全レベルを持つテクスチャのファイル
+#include "TextureFile.h"
+
+// 画像の非同期読み込み
+class TextureLoader {
+public:
+    // 読み込みの設定
+    struct Options {
+        // テクスチャ座標が範囲外のときの扱い
+        GLint wrap;
+
+        // 縮小・拡大するときのフィルタ
+        GLint min_filter, mag_filter;
+
+        // ミップマップを作るか
+        bool mipmap;
+
+        // 上下を反転するか (ImageDecoder でスレッドごとに設定するので他の読み込みには影響しない)
+        bool flip;
+
+        // ミップマップを glGenerateMipmap() ではなくワーカースレッドで作るか
+        bool cpu_mipmap;
+
+        // ワーカースレッドでミップマップを作るときの設定 (srgb ならテクスチャも GL_SRGB8_ALPHA8 などにする)
+        MipGenerator::Options mip;
+
+        // テクスチャのチャンネル数 (0ならファイルのまま, 1・2にするとマスク用の GL_R8・GL_RG8 になる)
+        int channels;
+
+        // Texture と同じ設定
+        Options()
+        : wrap(GL_REPEAT), min_filter(GL_LINEAR), mag_filter(GL_LINEAR), mipmap(true), flip(false), cpu_mipmap(false)
+        , channels(4) {}
+
+        // キャッシュのキーに使う文字列
+        std::string key() const {
+            return std::to_string(wrap) + ":" + std::to_string(min_filter) + ":" + std::to_string(mag_filter)
+                   + ":" + std::to_string(mipmap) + ":" + std::to_string(flip) + ":" + std::to_string(cpu_mipmap)
+                   + ":" + std::to_string(mip.filter) + ":" + std::to_string(mip.srgb)
+                   + ":" + std::to_string(mip.alpha_coverage) + ":" + std::to_string(mip.alpha_reference)
+                   + ":" + std::to_string(channels);
+        }
+    };
+
+    // 読み込み中のテクスチャのハンドル
+    class Handle {
+        friend class TextureLoader;
+
+        // コピーコンストラクタによるコピー禁止
+        Handle(const Handle &h);
+
+        // 代入によるコピー禁止
+        Handle &operator=(const Handle &h);
+
+        // テクスチャオブジェクト名 (読み込み前から最後まで同じ)
+        GLuint texture;
+
+        // 画像ファイル名
+        const std::string path;
+
+        // 読み込みの設定
+        const Options options;
+
+        // 画像の大きさ (読み込みが終わるまでは0)
+        GLsizei width, height;
+
+        // 1画素のチャンネル数 (読み込みが終わるまでは0)
+        GLint channels;
+
+        // 状態
+        enum State { pending, ready, failed } state;
+
+        Handle(const std::string &path, const Options &options)
+        : texture(0), path(path), options(options), width(0), height(0), channels(0), state(pending) {
+            glGenTextures(1, &texture);
+        }
+
+    public:
+        // デストラクタ (描画スレッドで破棄する)
+        virtual ~Handle() {
+            glDeleteTextures(1, &texture);
+        }
+
+        // テクスチャオブジェクト名を取り出す (読み込みが終わるまでは代わりの模様)
+        GLuint getTexture() const { return texture; }
+
+        // 画像ファイル名を取り出す
+        const std::string &getPath() const { return path; }
+
+        // 画像の幅を取り出す
+        GLsizei getWidth() const { return width; }
+
+        // 画像の高さを取り出す
+        GLsizei getHeight() const { return height; }
+
+        // テクスチャが使っているバイト数 (読み込みが終わるまでは0)
+        std::size_t getBytes() const {
+            const std::size_t bytes(static_cast<std::size_t>(width) * height * channels);
+            return options.mipmap ? bytes * 4 / 3 : bytes;
+        }
+
+        // 読み込みが終わったか
+        bool isReady() const { return state == ready; }
+
+        // 読み込みに失敗したか
+        bool isFailed() const { return state == failed; }
+    };
+
+private:
+    // コピーコンストラクタによるコピー禁止
+    TextureLoader(const TextureLoader &l);
+
+    // 代入によるコピー禁止
+    TextureLoader &operator=(const TextureLoader &l);
+
+    // デコードを待っている画像
+    struct Job {
+        // 読み込みの番号
+        unsigned int id;
+
+        // 画像ファイル名
+        std::string path;
+
+        // 読み込みの設定
+        Options options;
+    };
+
+    // デコードが終わった画像
+    struct Decoded {
+        // 読み込みの番号
+        unsigned int id;
+
+        // 画素 (失敗したらnullptr)
+        stbi_uc *pixels;
+
+        // 画像の大きさとチャンネル数
+        int width, height, channels;
+
+        // デコードにかかった時間 [ms]
+        double millis;
+
+        // ピクセルバッファに書き込んだときの領域 (書き込んだら pixels は nullptr)
+        PixelUploader::Staging staging;
+
+        // ワーカースレッドで作ったミップマップ (作ったら pixels は nullptr)
+        std::shared_ptr<const MipGenerator::Chain> mips;
+
+        // デコードに失敗した理由
+        std::string error;
+
+        // メモリにマップしたテクスチャのファイル (TextureFile の形式なら pixels は nullptr)
+        std::shared_ptr<const TextureFile> file;
+    };
+
+    // ワーカースレッド
+    std::vector<std::thread> workers;
+
+    // jobs と decoded を守る
+    std::mutex mutex;
+
+    // ジョブが追加されたことをワーカースレッドに知らせる
+    std::condition_variable condition;
+
+    // デコードを待っている画像
+    std::deque<Job> jobs;
+
+    // アップロードを待っている画像
+    std::deque<Decoded> decoded;
+
+    // ワーカースレッドを止める
+    bool stop;
+
+    // 読み込み中のハンドル (ハンドルを破棄するのは描画スレッドなので弱い参照で持つ)
+    std::map<unsigned int, std::weak_ptr<Handle>> handles;
+
+    // ピクセルバッファオブジェクトによる転送 (使わなければnullptr)
+    PixelUploader *const uploader;
+
+    // 帯に分けて転送しているハンドルとそのテクスチャオブジェクト名
+    std::vector<std::pair<GLuint, std::weak_ptr<Handle>>> streaming;
+
+    // 次の読み込みの番号
+    unsigned int next;
+
+    // デコードした数・デコードにかかった時間の合計 [ms]
+    unsigned int decodes;
+    double decodeMillis;
+
+    // アップロードした数・アップロードにかかった時間の合計 [ms]・直前の update() でかかった時間 [ms]
+    unsigned int uploads;
+    double uploadMillis, lastUpdateMillis;
+
+    // 経過時間 [ms]
+    static double elapsed(std::chrono::steady_clock::time_point from) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+    }
+
+    // ワーカースレッドの処理
+    void work() {
+        for (;;) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this] { return stop || !jobs.empty(); });
+                if (stop) return;
+                job = jobs.front();
+                jobs.pop_front();
+            }
+
+            const auto from(std::chrono::steady_clock::now());
+            Decoded image = { job.id, nullptr, 0, 0, 0, 0.0, { 0, nullptr }, nullptr, std::string(), nullptr };
+            if (TextureFile::isTextureFile(job.path)) {
+                // 焼き込んだファイルはデコードせずにマップし、転送の前にページを読み込ませておく
+                std::shared_ptr<TextureFile> file(std::make_shared<TextureFile>());
+                if (file->load(job.path)) {
+                    file->prefetch();
+                    image.width = static_cast<int>(file->getHeader().width);
+                    image.height = static_cast<int>(file->getHeader().height);
+                    image.channels = file->getHeader().compression != 0 ? 4 : static_cast<int>(file->getHeader().channels);
+                    image.file = file;
+                }
+                image.millis = elapsed(from);
+                std::lock_guard<std::mutex> lock(mutex);
+                decoded.push_back(image);
+                continue;
+            }
+
+            // テクスチャのチャンネル数でデコードして、転送の前に変換しないようにする
+            ImageDecoder::Options decode;
+            decode.flip = job.options.flip;
+            decode.channels = job.options.channels;
+            ImageDecoder::Image result(ImageDecoder::load(job.path, decode));
+            image.width = result.width;
+            image.height = result.height;
+            image.channels = result.channels;
+            image.error = result.error;
+            image.pixels = result.release();
+
+            if (image.pixels != nullptr && job.options.mipmap && job.options.cpu_mipmap) {
+                // ミップマップの全レベルを作っておく
+                image.mips = std::make_shared<const MipGenerator::Chain>(
+                        MipGenerator::generate(image.pixels, image.width, image.height, image.channels, job.options.mip));
+                stbi_image_free(image.pixels);
+                image.pixels = nullptr;
+            }
+            else if (image.pixels != nullptr && uploader != nullptr) {
+                // ピクセルバッファに空きがあればそこに書き込んでおく
+                const std::size_t bytes(static_cast<std::size_t>(image.width) * image.height * image.channels);
+                image.staging = uploader->claim(bytes);
+                if (image.staging.data != nullptr) {
+                    std::memcpy(image.staging.data, image.pixels, bytes);
+                    stbi_image_free(image.pixels);
+                    image.pixels = nullptr;
+                }
+            }
+            image.millis = elapsed(from);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            decoded.push_back(image);
+        }
+    }
+
+    // テクスチャの設定を行い代わりの模様(マゼンタと黒の市松模様)を入れる
+    static void placeholder(GLuint texture, const Options &options) {
+        static const GLubyte checker[] = {
+                255, 0, 255, 255,   0, 0,   0, 255,
+                  0, 0,   0, 255, 255, 0, 255, 255
+        };
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, options.wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, options.wrap);
+        // 代わりの模様にはミップマップがないので縮小はミップマップを使わないフィルタにしておく
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, options.mag_filter);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 2, 2, 0, GL_RGBA, GL_UNSIGNED_BYTE, checker);
+    }
+
+    // デコードした画像をテクスチャに転送する
+    void upload(const Decoded &image) {
+        const auto found(handles.find(image.id));
+        std::shared_ptr<Handle> handle;
+        if (found != handles.end()) {
+            handle = found->second.lock();
+            handles.erase(found);
+        }
+
+        // ハンドルが既に破棄されていたら捨てる
+        if (!handle) {
+            if (uploader != nullptr) uploader->cancel(image.staging);
+            stbi_image_free(image.pixels);
+            return;
+        }
+
+        const auto from(std::chrono::steady_clock::now());
+        const std::size_t bytes(static_cast<std::size_t>(image.width) * image.height * image.channels);
+        const PixelFormat pixel(PixelFormat::fromChannels(image.channels, image.width, handle->options.mip.srgb));
+        handle->channels = pixel.channels;
+        glBindTexture(GL_TEXTURE_2D, handle->texture);
+        pixel.setSwizzle();
+        if (image.file) {
+            // マップしたファイルから全レベルを転送する (1レベルしかなければミップマップを作る)
+            image.file->upload(handle->texture, uploader);
+            glBindTexture(GL_TEXTURE_2D, handle->texture);
+            const bool complete(image.file->getLevelCount() > 1 || image.file->getHeader().compression != 0);
+            if (handle->options.mipmap && !complete) {
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+                glGenerateMipmap(GL_TEXTURE_2D);
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, handle->options.min_filter);
+            handle->width = image.width;
+            handle->height = image.height;
+            handle->state = Handle::ready;
+            ++uploads;
+        }
+        else if (image.mips) {
+            // ワーカースレッドで作った全レベルを転送する
+            MipGenerator::upload(handle->texture, *image.mips);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, handle->options.min_filter);
+            handle->width = image.width;
+            handle->height = image.height;
+            handle->state = Handle::ready;
+            ++uploads;
+        }
+        else if (image.staging.data != nullptr) {
+            // ワーカースレッドが書き込んだピクセルバッファから転送する
+            uploader->upload(image.staging, handle->texture, 0, 0, image.width, image.height, pixel.format, pixel.internal_format);
+            finish(*handle, image.width, image.height);
+        }
+        else if (image.pixels != nullptr && uploader != nullptr && bytes > uploader->getSlotBytes()) {
+            // バッファに入らない大きな画像は帯に分けて転送し、終わるまでは代わりの模様のまま読み込み中にしておく
+            if (uploader->enqueue(handle->texture, image.width, image.height, pixel.format,
+                                  std::vector<GLubyte>(image.pixels, image.pixels + bytes), false, pixel.internal_format)) {
+                streaming.push_back(std::make_pair(handle->texture, std::weak_ptr<Handle>(handle)));
+                handle->width = image.width;
+                handle->height = image.height;
+            }
+            else handle->state = Handle::failed;
+        }
+        else if (image.pixels != nullptr) {
+            pixel.upload(0, image.width, image.height, image.pixels);
+            finish(*handle, image.width, image.height);
+        }
+        else {
+            std::cerr << "Failed to load texture: " << handle->path;
+            if (!image.error.empty()) std::cerr << " (" << image.error << ")";
+            std::cerr << std::endl;
+            handle->state = Handle::failed;
+        }
+        uploadMillis += elapsed(from);
+        stbi_image_free(image.pixels);
+    }
+
+    // 転送が終わったテクスチャのミップマップを作って使えるようにする
+    void finish(Handle &handle, GLsizei width, GLsizei height) {
+        glBindTexture(GL_TEXTURE_2D, handle.texture);
+        if (handle.options.mipmap) glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, handle.options.min_filter);
+        handle.width = width;
+        handle.height = height;
+        handle.state = Handle::ready;
+        ++uploads;
+    }
+
+    // 帯に分けた転送が終わったハンドルを使えるようにする
+    void stream() {
+        for (std::size_t i = 0; i < streaming.size();) {
+            const std::shared_ptr<Handle> handle(streaming[i].second.lock());
+            if (!handle) {
+                // 破棄されたテクスチャには転送しない
+                uploader->discard(streaming[i].first);
+            }
+            else if (uploader->isPending(handle->texture)) {
+                ++i;
+                continue;
+            }
+            else {
+                finish(*handle, handle->width, handle->height);
+            }
+            streaming.erase(streaming.begin() + i);
+        }
+    }
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param threads ワーカースレッドの数 (0なら描画スレッド以外のコアの数)
+     * @param uploader ピクセルバッファオブジェクトによる転送 (nullptrなら glTexImage2D() で直接転送する)
+     * @detail OpenGLのコンテキストを作成した後で描画スレッドで呼び出す
+     *         uploader はこのインスタンスより長く生きていなければならず、update() の中で更新する
+     */
+    explicit TextureLoader(unsigned int threads = 0, PixelUploader *uploader = nullptr)
+    : stop(false), uploader(uploader), next(0), decodes(0), decodeMillis(0.0), uploads(0), uploadMillis(0.0), lastUpdateMillis(0.0) {
+        if (threads == 0) {
+            // hardware_concurrency() は分からなければ0を返す
+            const unsigned int cores(std::thread::hardware_concurrency());
+            threads = cores > 1 ? cores - 1 : 1;
+        }
+        for (unsigned int i = 0; i < threads; ++i) workers.emplace_back(&TextureLoader::work, this);
+    }
+
+    // デストラクタ
+    virtual ~TextureLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        condition.notify_all();
+        for (auto &worker : workers) worker.join();
+        for (const auto &image : decoded) {
+            if (uploader != nullptr) uploader->cancel(image.staging);
+            stbi_image_free(image.pixels);
+        }
+        if (uploader != nullptr)
+            for (const auto &handle : streaming) uploader->discard(handle.first);
+    }
+
+    /*
+     * @fn
+     * 画像の読み込みを始める
+     * @param path 画像ファイル名
+     * @param options 読み込みの設定
+     * @return ハンドル (すぐに描画に使える)
+     */
+    std::shared_ptr<const Handle> load(const std::string &path, const Options &options = Options()) {
+        std::shared_ptr<Handle> handle(new Handle(path, options));
+        placeholder(handle->texture, options);
+
+        const unsigned int id(next++);
+        handles[id] = handle;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(Job{ id, path, options });
+        }
+        condition.notify_one();
+        return handle;
+    }
+
+    /*
+     * @fn
+     * デコードが終わった画像をテクスチャに転送する
+     * @param budget 1フレームで転送に使ってよい時間 [ms]
+     * @return 転送した画像の数
+     * @detail フレームごとに描画スレッドで呼び出す 予算を超えても少なくとも1枚は転送する
+     */
+    unsigned int update(double budget = 2.0) {
+        const auto from(std::chrono::steady_clock::now());
+        unsigned int count(0);
+
+        // 帯に分けた転送を進め、転送の終わったピクセルバッファをワーカースレッドに渡せるようにする
+        if (uploader != nullptr) {
+            stream();
+            uploader->update();
+        }
+
+        for (;;) {
+            Decoded image;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (decoded.empty()) break;
+                image = decoded.front();
+                decoded.pop_front();
+            }
+            ++decodes;
+            decodeMillis += image.millis;
+            upload(image);
+            ++count;
+            if (elapsed(from) >= budget) break;
+        }
+        lastUpdateMillis = elapsed(from);
+        return count;
+    }
+
+    // デコードを待っている画像の数
+    std::size_t getQueueDepth() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return jobs.size();
+    }
+
+    // アップロードを待っている画像の数
+    std::size_t getPendingUploads() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return decoded.size();
+    }
+
+    // 1枚あたりのデコードにかかった時間 [ms]
+    double getAverageDecodeMillis() const { return decodes > 0 ? decodeMillis / decodes : 0.0; }
+
+    // 1枚あたりのアップロードにかかった時間 [ms]
+    double getAverageUploadMillis() const { return uploads > 0 ? uploadMillis / uploads : 0.0; }
+
+    // 直前の update() でかかった時間 [ms]
+    double getLastUpdateMillis() const { return lastUpdateMillis; }
+
+    // 統計を表示する
+    void printStatistics(std::ostream &out = std::cerr) {
+        out << "Texture loader: queue " << getQueueDepth() << ", pending uploads " << getPendingUploads()
+            << ", decode " << getAverageDecodeMillis() << " ms/image (" << decodes << ")"
+            << ", upload " << getAverageUploadMillis() << " ms/image (" << uploads << ")"
+            << ", last update " << lastUpdateMillis << " ms" << std::endl;
+    }
+};
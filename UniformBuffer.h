@@ -0,0 +1,132 @@
+/*
+ * @file UniformBuffer.h
+ * @brief C++の構造体をそのままuniformブロックに写すバッファオブジェクトのクラス
+ * @detail 構造体は std140 のレイアウトに合わせて作る (vec2 は8バイト、vec3/vec4 と配列の要素は16バイト境界に置く)
+ *         バッファオブジェクトは固定の結合ポイントに結合したままにしておき、プログラムオブジェクトのuniformブロックは
+ *         attach() でその結合ポイントにつなぐので、プログラムを切り替えても値を送り直す必要はない
+ *         OpenGL 4.1 のシェーダでは layout(binding = n) が使えないので、リンクした後に attach() を呼ぶ
+ *         update() は1フレームに1回、前と違うときだけバッファ全体を1回で書き換える
+ */
+
+#pragma once
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <GL/glew.h>
+
+// uniformブロックのバッファオブジェクト
+template <typename T>
+class UniformBuffer {
+    static_assert(std::is_trivially_copyable<T>::value, "uniform block must be trivially copyable");
+    static_assert(sizeof(T) % 16 == 0, "std140 uniform block must be padded to a multiple of 16 bytes");
+
+    // コピーコンストラクタによるコピー禁止
+    UniformBuffer(const UniformBuffer &b);
+
+    // 代入によるコピー禁止
+    UniformBuffer &operator=(const UniformBuffer &b);
+
+    // uniformブロック名
+    const std::string block;
+
+    // 結合ポイント
+    const GLuint binding;
+
+    // バッファオブジェクト名
+    GLuint buffer;
+
+    // 最後に書き込んだ値
+    T shadow;
+
+    // 書き込んだことがあるか
+    bool written;
+
+    // 書き込んだ回数・同じ値だったので書き込まなかった回数
+    unsigned long long writes, skips;
+
+public:
+    /*
+     * @fn
+     * コンストラクタ
+     * @param block シェーダのuniformブロック名
+     * @param binding 結合ポイント (GL_MAX_UNIFORM_BUFFER_BINDINGS 未満でほかのブロックと重ならないもの)
+     */
+    UniformBuffer(const std::string &block, GLuint binding)
+    : block(block), binding(binding), buffer(0), shadow(), written(false), writes(0), skips(0) {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+    }
+
+    // デストラクタ
+    virtual ~UniformBuffer() {
+        glDeleteBuffers(1, &buffer);
+    }
+
+    /*
+     * @fn
+     * プログラムオブジェクトのuniformブロックを結合ポイントにつなぐ
+     * @param program プログラムオブジェクト名 (リンクした後のもの)
+     * @return uniformブロックがあってつないだら true
+     * @detail プログラムオブジェクトを作り直したら、また呼ぶ
+     */
+    bool attach(GLuint program) const {
+        if (program == 0) return false;
+        const GLuint index(glGetUniformBlockIndex(program, block.c_str()));
+        if (index == GL_INVALID_INDEX) return false;
+
+        // シェーダのブロックが構造体より大きければレイアウトが合っていない
+        GLint size(0);
+        glGetActiveUniformBlockiv(program, index, GL_UNIFORM_BLOCK_DATA_SIZE, &size);
+        if (size > static_cast<GLint>(sizeof(T))) {
+            std::cerr << "Error: Uniform block " << block << " needs " << size << " bytes but the buffer has "
+                      << sizeof(T) << std::endl;
+            return false;
+        }
+        glUniformBlockBinding(program, index, binding);
+        return true;
+    }
+
+    /*
+     * @fn
+     * 値を書き込む
+     * @param data 値
+     * @return 書き込んだら true (前と同じ値なら書き込まない)
+     * @detail フレームの始めに1回呼ぶ 使っている最中のバッファを待たないように、確保し直して書き込む
+     */
+    bool update(const T &data) {
+        if (written && std::memcmp(&shadow, &data, sizeof(T)) == 0) {
+            ++skips;
+            return false;
+        }
+        shadow = data;
+        written = true;
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &shadow, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        ++writes;
+        return true;
+    }
+
+    // バッファオブジェクト名
+    GLuint getBuffer() const { return buffer; }
+
+    // 結合ポイント
+    GLuint getBinding() const { return binding; }
+
+    // 書き込んだ回数
+    unsigned long long getWrites() const { return writes; }
+
+    // 同じ値だったので書き込まなかった回数
+    unsigned long long getSkips() const { return skips; }
+
+    // 統計を表示する
+    void printStatistics(std::ostream &out = std::cerr) const {
+        out << "UniformBuffer " << block << " (binding " << binding << ", " << sizeof(T) << " bytes): "
+            << writes << " writes, " << skips << " skipped" << std::endl;
+    }
+};
@@ -0,0 +1,133 @@
+/*
+ * @file VertexFormat.h
+ * @brief 頂点属性の並びをコンパイル時に記述するテンプレート
+ * @detail 属性ごとの型・要素数・正規化の有無を並べるだけで、頂点1つ分のバイト数と各属性の位置を
+ *         コンパイル時に求め、glVertexAttribPointer()/glVertexAttribFormat()の呼び出しを展開する
+ *         half float・正規化した整数・10_10_10_2 の詰め込み形式も同じ書き方で追加できる
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <GL/glew.h>
+
+// 詰め込み形式 (4要素を32bitに詰める) か
+constexpr bool isPackedType(GLenum type) {
+    return type == GL_INT_2_10_10_10_REV || type == GL_UNSIGNED_INT_2_10_10_10_REV
+        || type == GL_UNSIGNED_INT_10F_11F_11F_REV;
+}
+
+// 型の1要素のバイト数
+constexpr GLsizei attributeTypeSize(GLenum type) {
+    switch (type) {
+        case GL_BYTE:
+        case GL_UNSIGNED_BYTE:
+            return 1;
+        case GL_SHORT:
+        case GL_UNSIGNED_SHORT:
+        case GL_HALF_FLOAT:
+            return 2;
+        case GL_INT:
+        case GL_UNSIGNED_INT:
+        case GL_FLOAT:
+        case GL_FIXED:
+            return 4;
+        case GL_DOUBLE:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * 頂点属性1つの記述
+ * @param Type 要素の型 (GL_FLOAT, GL_HALF_FLOAT, GL_UNSIGNED_BYTE, GL_INT_2_10_10_10_REV など)
+ * @param Count 要素数 (1〜4)
+ * @param Normalized 整数を [0, 1] または [-1, 1] に正規化するか
+ */
+template <GLenum Type, GLint Count, GLboolean Normalized = GL_FALSE>
+struct Attribute {
+    static constexpr GLenum type = Type;
+    static constexpr GLint count = Count;
+    static constexpr GLboolean normalized = Normalized;
+
+    // 属性1つのバイト数
+    static constexpr GLsizei size = isPackedType(Type) ? 4 : Count * attributeTypeSize(Type);
+
+    static_assert(Count >= 1 && Count <= 4, "Attribute count must be 1 to 4.");
+    static_assert(size > 0, "Unsupported attribute type.");
+    static_assert(!isPackedType(Type) || Count == 4 || (Type == GL_UNSIGNED_INT_10F_11F_11F_REV && Count == 3),
+                  "Packed attribute types need 4 components (3 for 10F_11F_11F).");
+};
+
+/*
+ * 頂点の形式の記述
+ * @param A 先頭から順に並ぶ Attribute (location は先頭から 0, 1, 2, ...)
+ */
+template <typename... A>
+struct VertexFormat {
+    // 属性の数
+    static constexpr std::size_t attributes = sizeof...(A);
+
+    // i番目の属性の頂点の先頭からのバイト数
+    static constexpr GLsizei offset(std::size_t i) {
+        constexpr GLsizei sizes[] = { A::size..., 0 };
+        GLsizei o(0);
+        for (std::size_t k = 0; k < i; ++k) o += sizes[k];
+        return o;
+    }
+
+    // 頂点1つのバイト数
+    static constexpr GLsizei stride = offset(sizeof...(A));
+
+private:
+    // 属性を頂点配列オブジェクトに設定する
+    template <typename T>
+    static void pointer(GLuint location, GLint count, GLsizei offset) {
+        glVertexAttribPointer(location, count, T::type, T::normalized, stride,
+                              reinterpret_cast<const void *>(static_cast<std::uintptr_t>(offset)));
+        glEnableVertexAttribArray(location);
+    }
+
+    template <typename T>
+    static void format(GLuint location, GLint count, GLsizei offset, GLuint binding) {
+        glVertexAttribFormat(location, count, T::type, T::normalized, offset);
+        glVertexAttribBinding(location, binding);
+        glEnableVertexAttribArray(location);
+    }
+
+    template <std::size_t... I>
+    static void setup(GLint size, GLuint first, std::index_sequence<I...>) {
+        const int expand[] = { 0, (pointer<A>(first + I, I == 0 && size > 0 ? size : A::count, offset(I)), 0)... };
+        (void)expand;
+    }
+
+    template <std::size_t... I>
+    static void setupFormat(GLuint binding, GLuint first, std::index_sequence<I...>) {
+        const int expand[] = { 0, (format<A>(first + I, A::count, offset(I), binding), 0)... };
+        (void)expand;
+    }
+
+public:
+    /*
+     * @fn
+     * 結合されている頂点バッファオブジェクトをin変数から参照できるようにする (glVertexAttribPointer)
+     * @param size 先頭の属性(位置)の要素数 (0なら記述どおり)
+     * @param first 先頭の属性の location
+     */
+    static void setup(GLint size = 0, GLuint first = 0) {
+        setup(size, first, std::index_sequence_for<A...>());
+    }
+
+    /*
+     * @fn
+     * 属性の形式だけを設定して頂点バッファの結合点に結びつける (glVertexAttribFormat, OpenGL 4.3)
+     * @param binding 頂点バッファの結合点 (glBindVertexBuffer()で頂点バッファを結合する)
+     * @param first 先頭の属性の location
+     */
+    static void setupFormat(GLuint binding = 0, GLuint first = 0) {
+        setupFormat(binding, first, std::index_sequence_for<A...>());
+    }
+};
@@ -13,6 +13,17 @@
 
 // ウィンドウ関連処理
 class Window {
+public:
+    // シェーダの uniform ブロックに合わせた std140 のレイアウト (UniformBuffer で結合する)
+    //     layout(std140) uniform View { vec2 size; vec2 location; float scale; };
+    struct View {
+        GLfloat size[2];
+        GLfloat location[2];
+        GLfloat scale;
+        GLfloat padding[3];
+    };
+
+private:
     // ウィンドウのハンドル
     GLFWwindow *const window;
 
@@ -121,6 +132,12 @@ public:
     // 位置を取り出す
     const GLfloat *getLocation() const { return location; }
 
+    // uniform ブロックに書き込む値を取り出す
+    View getView() const {
+        const View view = { { size[0], size[1] }, { location[0], location[1] }, scale, { 0.0f, 0.0f, 0.0f } };
+        return view;
+    }
+
     // ウィンドウのサイズ変更時の処理
     static void resize(GLFWwindow *const window, int width, int height) {
         // ウィンドウ全体をビューポートに設定する
@@ -0,0 +1,249 @@
+/*
+ * @file decode_stress.cpp
+ * @brief ImageDecoder を複数のスレッドから同時に使っても結果が変わらないことを確かめる
+ * @detail 大きさ・チャンネル数・形式 (PngDecoder で読むPNGと stb_image で読むPNM) の違う画像と、
+ *         壊れたファイル・ないファイルを作業用のディレクトリに書き出し、呼び出しごとに上下の反転と
+ *         出力のチャンネル数を変えながら何千回もスレッドに分けてデコードする
+ *         画素・大きさ・失敗の理由 (Image::error と failureReason()) を1スレッドでデコードした結果と比べ、
+ *         1つでも違えば0以外で終わる OpenGLのコンテキストは使わない
+ *             decode_stress [-n デコードする回数] [-t スレッド数] [-d 作業用のディレクトリ]
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#define STB_IMAGE_IMPLEMENTATION
+#include "ImageDecoder.h"
+
+// デコードの結果 (1スレッドで求めた正解と比べる)
+struct Result {
+    // 画素 (失敗したら空)
+    std::vector<unsigned char> pixels;
+
+    // 大きさとチャンネル数
+    int width, height, channels;
+
+    // Image::error とデコードした直後の failureReason()
+    std::string error, reason;
+};
+
+// ビッグエンディアンの32bitの値を追加する
+static void put32(std::vector<unsigned char> &out, std::uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back(static_cast<unsigned char>(value >> shift));
+}
+
+// PNGのチャンクを追加する
+static void chunk(std::vector<unsigned char> &out, const char *type, const std::vector<unsigned char> &data) {
+    put32(out, static_cast<std::uint32_t>(data.size()));
+    const std::size_t begin(out.size());
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+
+    // CRC は種類とデータから求める
+    std::uint32_t crc(0xffffffffu);
+    for (std::size_t i = begin; i < out.size(); ++i) {
+        crc ^= out[i];
+        for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1u)));
+    }
+    put32(out, crc ^ 0xffffffffu);
+}
+
+/*
+ * @fn
+ * 乱数の画素でPNGを作る (無圧縮のブロックで、行ごとにフィルタを変える)
+ * @param width 幅
+ * @param height 高さ
+ * @param channels チャンネル数 (1-4)
+ * @param random 乱数
+ * @return ファイルの中身
+ */
+static std::vector<unsigned char> makePng(int width, int height, int channels, std::mt19937 &random) {
+    static const unsigned char color_types[] = { 0, 0, 4, 2, 6 };
+    std::vector<unsigned char> raw;
+    for (int y = 0; y < height; ++y) {
+        // フィルタの種類 0-4 (フィルタした後の値が乱数なので、どれでも正しいデータになる)
+        raw.push_back(static_cast<unsigned char>(y % 5));
+        for (int x = 0; x < width * channels; ++x) raw.push_back(static_cast<unsigned char>(random()));
+    }
+
+    // zlib の無圧縮のブロックに入れる
+    std::vector<unsigned char> zlib = { 0x78, 0x01 };
+    for (std::size_t offset = 0; offset < raw.size();) {
+        const std::size_t length(std::min<std::size_t>(raw.size() - offset, 65535));
+        zlib.push_back(offset + length == raw.size() ? 1 : 0);
+        zlib.push_back(static_cast<unsigned char>(length));
+        zlib.push_back(static_cast<unsigned char>(length >> 8));
+        zlib.push_back(static_cast<unsigned char>(~length));
+        zlib.push_back(static_cast<unsigned char>(~length >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+        offset += length;
+    }
+    std::uint32_t a(1), b(0);
+    for (const unsigned char c : raw) {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    put32(zlib, (b << 16) | a);
+
+    std::vector<unsigned char> header;
+    put32(header, static_cast<std::uint32_t>(width));
+    put32(header, static_cast<std::uint32_t>(height));
+    header.push_back(8);
+    header.push_back(color_types[channels]);
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+
+    std::vector<unsigned char> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    chunk(png, "IHDR", header);
+    chunk(png, "IDAT", zlib);
+    chunk(png, "IEND", std::vector<unsigned char>());
+    return png;
+}
+
+/*
+ * @fn
+ * 乱数の画素でPNM (グレーならPGM, カラーならPPM) を作る
+ * @param width 幅
+ * @param height 高さ
+ * @param channels チャンネル数 (1か3)
+ * @param random 乱数
+ * @return ファイルの中身
+ */
+static std::vector<unsigned char> makePnm(int width, int height, int channels, std::mt19937 &random) {
+    const std::string header((channels == 1 ? "P5\n" : "P6\n") + std::to_string(width) + " " + std::to_string(height)
+                             + "\n255\n");
+    std::vector<unsigned char> pnm(header.begin(), header.end());
+    for (int i = 0; i < width * height * channels; ++i) pnm.push_back(static_cast<unsigned char>(random()));
+    return pnm;
+}
+
+// ファイルに書き出す
+static bool write(const std::string &path, const std::vector<unsigned char> &data) {
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+    return !file.fail();
+}
+
+// 呼び出しごとに変える設定 (番号の偶奇で上下の反転、その次で出力のチャンネル数 0-4 を選ぶ)
+static ImageDecoder::Options options(std::size_t variant) {
+    ImageDecoder::Options options;
+    options.flip = variant % 2 != 0;
+    options.channels = static_cast<int>(variant / 2 % 5);
+    return options;
+}
+
+// 設定の種類の数
+static const std::size_t variants = 10;
+
+// デコードして結果をまとめる
+static Result decode(const std::string &path, std::size_t variant) {
+    const ImageDecoder::Image image(ImageDecoder::load(path, options(variant)));
+    Result result;
+    result.width = image.width;
+    result.height = image.height;
+    result.channels = image.channels;
+    result.error = image.error;
+    if (image) {
+        result.pixels.assign(image.pixels.get(),
+                             image.pixels.get() + static_cast<std::size_t>(image.width) * image.height * image.channels);
+    }
+    else {
+        const char *const reason(ImageDecoder::failureReason());
+        result.reason = reason != nullptr ? reason : "";
+    }
+    return result;
+}
+
+// 結果が同じか
+static bool same(const Result &a, const Result &b) {
+    return a.width == b.width && a.height == b.height && a.channels == b.channels && a.pixels == b.pixels
+           && a.error == b.error && a.reason == b.reason;
+}
+
+int main(int argc, char *argv[]) {
+    // 引数を読む
+    std::size_t count(4800);
+    unsigned int threads(8);
+    std::string directory(".");
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "-n" && i + 1 < argc) count = static_cast<std::size_t>(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "-t" && i + 1 < argc) threads = static_cast<unsigned int>(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "-d" && i + 1 < argc) directory = argv[++i];
+        else {
+            std::cerr << "usage: decode_stress [-n decodes] [-t threads] [-d directory]" << std::endl;
+            return 1;
+        }
+    }
+
+    // 画像を書き出す (大きさとチャンネル数を変え、壊れたものも混ぜる)
+    std::mt19937 random(1);
+    std::vector<std::string> paths;
+    std::vector<std::string> written;
+    for (int i = 0; i < 24; ++i) {
+        const int width(1 + static_cast<int>(random() % 96)), height(1 + static_cast<int>(random() % 96));
+        const bool png(i % 3 != 2);
+        const int channels(png ? 1 + i % 4 : (i % 2 != 0 ? 3 : 1));
+        std::vector<unsigned char> data(png ? makePng(width, height, channels, random) : makePnm(width, height, channels, random));
+        if (i == 7) data.resize(data.size() / 2);                 // 途中で切れたPNG
+        if (i == 11) data.resize(data.size() - 1);                // 画素が1バイト足りないPNM
+        const std::string path(directory + "/decode_stress_" + std::to_string(i) + (png ? ".png" : ".pnm"));
+        if (!write(path, data)) {
+            std::cerr << "Can't write " << path << std::endl;
+            return 1;
+        }
+        paths.push_back(path);
+        written.push_back(path);
+    }
+    const std::string garbage(directory + "/decode_stress_garbage.png");
+    write(garbage, std::vector<unsigned char>(64, 0x5a));
+    paths.push_back(garbage);
+    written.push_back(garbage);
+    paths.push_back(directory + "/decode_stress_missing.png");
+
+    // 1スレッドで正解を求める
+    std::vector<Result> expected;
+    std::size_t failures(0);
+    for (const auto &path : paths) {
+        for (std::size_t v = 0; v < variants; ++v) {
+            expected.push_back(decode(path, v));
+            if (expected.back().pixels.empty()) ++failures;
+        }
+    }
+
+    // 設定を1回ずつ変えながら、スレッドに分けて何度もデコードする
+    std::atomic<std::size_t> next(0), mismatches(0);
+    const auto work = [&]() {
+        for (std::size_t i; (i = next++) < count;) {
+            const std::size_t file(i / variants % paths.size()), variant(i % variants);
+            const Result result(decode(paths[file], variant));
+            const Result &answer(expected[file * variants + variant]);
+            if (!same(result, answer)) {
+                if (mismatches++ < 10) {
+                    std::cerr << "MISMATCH " << paths[file] << " flip " << options(variant).flip << " channels "
+                              << options(variant).channels << ": " << result.width << "x" << result.height << "x"
+                              << result.channels << " \"" << result.reason << "\", expected " << answer.width << "x"
+                              << answer.height << "x" << answer.channels << " \"" << answer.reason << "\"" << std::endl;
+                }
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned int t = 0; t < threads; ++t) workers.emplace_back(work);
+    for (auto &worker : workers) worker.join();
+
+    for (const auto &path : written) std::remove(path.c_str());
+    std::cout << "decode_stress: " << count << " decodes of " << paths.size() << " files (" << failures << " of "
+              << expected.size() << " file/option pairs fail) on " << threads << " threads, " << mismatches
+              << " mismatches" << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
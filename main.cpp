@@ -5,69 +5,18 @@
 
 #include <cstdlib>
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <memory>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include "Window.h"
+#include "ProgramCache.h"
+#include "ProgramValidator.h"
+#include "ShaderLibrary.h"
+#include "ShaderProgram.h"
+#include "UniformBuffer.h"
 #include "Shape.h"
 
-/*
- * @fn
- * シェーダオブジェクトのコンパイル結果を表示する
- * @param shader シェーダオブジェクト名
- * @param str コンパイルエラーが発生した場所を示す文字列
- * @return エラーならば0を返す
- */
-GLboolean printShaderInfoLog(GLuint shader, const char *str) {
-    // コンパイル結果を取得する
-    GLint status;
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-    if (status == GL_FALSE) std::cerr << "Compile Error in " << str << std::endl;
-
-    // シェーダのコンパイル時のログの長さを取得する
-    GLsizei bufSize;
-    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &bufSize);
-
-    if (bufSize > 1) {
-        // シェーダのコンパイル時のログの内容を取得する
-        std::vector<GLchar> infoLog(bufSize);
-        GLsizei length;
-        glGetShaderInfoLog(shader, bufSize, &length, &infoLog[0]);
-        std::cerr << &infoLog[0] << std::endl;
-    }
-
-    return static_cast<GLboolean>(status);
-}
-
-/*
- * @fn
- * プログラムオブジェクトのリンク結果を表示する
- * @param program プログラムオブジェクト名
- * @return エラーならば0を返す
- */
-GLboolean printProgramInfoLog(GLuint program) {
-    // リンク結果を取得する
-    GLint status;
-    glGetProgramiv(program, GL_LINK_STATUS, &status);
-    if (status == GL_FALSE) std::cerr << "Link Error." << std::endl;
-
-    // シェーダのリンク時のログの長さを取得する
-    GLsizei bufSize;
-    glGetProgramiv(program, GL_INFO_LOG_LENGTH, &bufSize);
-
-    if (bufSize > 1) {
-        // シェーダのリンク時のログ内容を取得する
-        std::vector<GLchar> infoLog(bufSize);
-        GLsizei length;
-        glGetProgramInfoLog(program, bufSize, &length, &infoLog[0]);
-        std::cerr << &infoLog[0] << std::endl;
-    }
-
-    return static_cast<GLboolean>(status);
-}
-
 /*
  * @fn
  * プログラムオブジェクトの実行可能結果を表示する
@@ -96,116 +45,6 @@ GLboolean printValidateInfoLog(GLuint program) {
     return static_cast<GLboolean>(status);
 }
 
-/*
- * @fn
- * プログラムオブジェクトを作成する
- * @param vsrc バーテックスシェーダのソースプログラムの文字列
- * @param gsrc フラグメントシェーダのソースプログラムの文字列
- * @return シェーダプログラムオブジェクト
- */
-GLuint createProgram(const char *vsrc, const char *fsrc) {
-    // 空のプログラムオブジェクトを作成する
-    const GLuint program(glCreateProgram());
-
-    if (vsrc != nullptr) {
-        // バーテックスシェーダのシェーダオブジェクトを作成する
-        const GLuint vobj(glCreateShader(GL_VERTEX_SHADER));
-        glShaderSource(vobj, 1, &vsrc, nullptr);
-        glCompileShader(vobj);
-
-        // バーテックスシェーダのシェーダオブジェクトをプログラムオブジェクトに組み込む
-        if (printShaderInfoLog(vobj, "vertex shader"))
-            glAttachShader(program, vobj);
-        glDeleteShader(vobj);
-    }
-
-    if (fsrc != nullptr) {
-        // フラグメントシェーダのシェーダオブジェクトを作成する
-        const GLuint fobj(glCreateShader(GL_FRAGMENT_SHADER));
-        glShaderSource(fobj, 1, &fsrc, nullptr);
-        glCompileShader(fobj);
-
-        // フラグメントシェーダのシェーダオブジェクトをプログラムオブジェクトに組み込む
-        if (printShaderInfoLog(fobj, "fragment shader"))
-            glAttachShader(program, fobj);
-        glDeleteShader(fobj);
-    }
-
-    // プログラムオブジェクトをリンクする
-    glBindAttribLocation(program, 0, "position");
-    glBindFragDataLocation(program, 0, "fragment");
-    glLinkProgram(program);
-
-    // 作成したプログラムオブジェクトを返す
-    if (printProgramInfoLog(program) /*&& printValidateInfoLog(program)*/)
-        return program;
-
-    // プログラムオブジェクトが作成できなければ0を返す
-    glDeleteProgram(program);
-    return 0;
-}
-
-/*
- * @fn
- * シェーダのソースファイルを読み込んだメモリを返す
- * @param name シェーダのソースファイル名
- * @param buffer 読み込んだソースファイルのテキスト
- * @return 読み込み成功時のみtrueを返す
- */
-bool readShaderSource(const char *name, std::vector<GLchar> &buffer) {
-    // ファイル名がNULLだった
-    if (name == nullptr) return false;
-
-    // ソースファイルを開く
-    std::ifstream file(name, std::ios::binary);
-    if (file.fail()) {
-        // 開けなかった
-        std::cerr << "Error: Can't open source file: " << name << std::endl;
-        return false;
-    }
-
-    // ファイルの末尾に移動し現在位置(=ファイルサイズ)を得る
-    file.seekg(0L, std::ios::end);
-    auto length = static_cast<GLsizei>(file.tellg());
-
-    // ファイルサイズのメモリを確保
-    buffer.resize(length + 1);
-
-    // ファイルを先頭から読み込む
-    file.seekg(0L, std::ios::beg);
-    file.read(buffer.data(), length);
-    buffer[length] = '\0';
-
-    if (file.fail()) {
-        // うまく読み込めなかった
-        std::cerr << "Error; Could not read source file: " << name << std::endl;
-        file.close();
-        return false;
-    }
-
-    // 読み込み成功
-    file.close();
-    return true;
-}
-
-/*
- * @fn
- * シェーダのソースファイルを読み込んでプログラムオブジェクトを作成する
- * @param vert バーテックスシェーダのソースファイル名
- * @param frag フラグメントシェーダのソースファイル名
- * @return エラーならば0を返す
- */
-GLuint loadProgram(const char *vert, const char *frag) {
-    // シェーダのソースファイルを読み込む
-    std::vector<GLchar> vsrc;
-    const bool vstat(readShaderSource(vert, vsrc));
-    std::vector<GLchar> fsrc;
-    const bool fstat(readShaderSource(frag, fsrc));
-
-    // プログラムオブジェクトを作成する
-    return vstat && fstat ? createProgram(vsrc.data(), fsrc.data()) : 0;
-}
-
 // 矩形の頂点の位置
 constexpr Object::Vertex rectangleVertex[] =
         {
@@ -238,13 +77,27 @@ int main(int argc, char * argv[]) {
     // 背景色を指定する
     glClearColor(1.0f, 1.0f, 1.0f, 0.0f);
 
-    // プログラムオブジェクトを作成する
-    const GLuint program(loadProgram("point.vert", "point.frag"));
+    // プログラムバイナリのキャッシュを用意する
+    ProgramCache cache;
+
+    // プログラムオブジェクトをまとめて作成する (ソースファイルを保存すると実行したまま作り直す)
+    ShaderLibrary shaders(&cache);
+    shaders.add({ { "point", { "point.vert", "point.frag" } } }, true);
+    const ShaderLibrary::Program &point(*shaders.get("point"));
+    cache.printStatistics();
+
+    // プログラムオブジェクトの検証は状態が変わったときだけ行う
+    ProgramValidator validator(printValidateInfoLog);
 
-    // プログラムオブジェクトからuniform変数の場所を取得する
-    const GLint sizeLoc(glGetUniformLocation(program, "size"));
-    const GLint scaleLoc(glGetUniformLocation(program, "scale"));
-    const GLint locationLoc(glGetUniformLocation(program, "location"));
+    // uniform変数名を番号にしておく (場所はプログラムオブジェクトを作り直すと調べ直す)
+    const ShaderProgram::Name sizeName(ShaderProgram::intern("size"));
+    const ShaderProgram::Name scaleName(ShaderProgram::intern("scale"));
+    const ShaderProgram::Name locationName(ShaderProgram::intern("location"));
+    ShaderProgram uniforms;
+
+    // ウィンドウの値は uniform ブロック View にまとめて0番の結合ポイントから全部のプログラムで共有する
+    UniformBuffer<Window::View> view("View", 0);
+    bool shared(false);
 
     // 図形データを作成する
     std::unique_ptr<const Shape> shape(new Shape(2, 4, rectangleVertex));
@@ -254,21 +107,35 @@ int main(int argc, char * argv[]) {
         // ウィンドウを削除する
         glClear(GL_COLOR_BUFFER_BIT);
 
+        // 変更されたシェーダのコンパイルを進め、終わっていれば差し替える
+        shaders.update();
+        const GLuint program(point.get());
+        if (uniforms.update(program)) shared = view.attach(program);
+
+        // ウィンドウの値はフレームの始めに1回だけ (変わったときだけ) 書き込む
+        view.update(window.getView());
+
         // シェーダプログラムの使用開始
         glUseProgram(program);
 
-        // uniform変数に値を設定する
-        glUniform2fv(sizeLoc, 1, window.getSize());
-        glUniform1f(scaleLoc, window.getScale());
-        glUniform2fv(locationLoc, 1, window.getLocation());
+        // uniform ブロックを使っていないシェーダには uniform変数で設定する (前のフレームと同じなら送らない)
+        if (!shared) {
+            uniforms.set(sizeName, window.getSize());
+            uniforms.set(scaleName, window.getScale());
+            uniforms.set(locationName, window.getLocation());
+        }
 
         // ここで描画処理を行う
         // 図形を描画する
-        if (printValidateInfoLog(program))
-            shape->draw();
+        shape->draw(validator, program);
+
+        // フレームの終わりを通知する
+        validator.frame();
 
         // カラーバッファを入れ替えて、イベントを取り出す
         window.swapBuffers();
     }
+    uniforms.printStatistics();
+    view.printStatistics();
 }
 
@@ -0,0 +1,153 @@
+/*
+ * @file mip_bench.cpp
+ * @brief CPUで作るミップマップと glGenerateMipmap() の速度を比べる
+ * @detail 画像ファイル(指定がなければ乱数の画像)について、glTexImage2D() + glGenerateMipmap() と
+ *         MipGenerator::generate() + MipGenerator::upload() にかかる時間を測る
+ *         CPUの生成はワーカースレッドで並べて実行したときの1枚あたりの時間も測る
+ *         ウィンドウは表示しない (llvmpipe などのソフトウェアのドライバでも動く)
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MipGenerator.h"
+#include "Window.h"
+#include <GLFW/glfw3.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+// 経過時間 [ms]
+static double millis(std::chrono::steady_clock::time_point from) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+}
+
+/*
+ * @fn
+ * CPUでミップマップを作って転送する時間を測る
+ * @param name 表示する名前
+ * @param pixels レベル0の画素 RGBA
+ * @param width 画像の幅
+ * @param height 画像の高さ
+ * @param options 生成の設定
+ * @param texture 転送先のテクスチャオブジェクト名
+ * @param repeat 繰り返す回数
+ */
+static void measure(const char *name, const std::vector<GLubyte> &pixels, GLsizei width, GLsizei height,
+                    const MipGenerator::Options &options, GLuint texture, int repeat) {
+    double generate(0.0), upload(0.0);
+    for (int i = 0; i < repeat; ++i) {
+        auto from(std::chrono::steady_clock::now());
+        const MipGenerator::Chain chain(MipGenerator::generate(pixels.data(), width, height, 4, options));
+        generate += millis(from);
+
+        from = std::chrono::steady_clock::now();
+        MipGenerator::upload(texture, chain);
+        glFinish();
+        upload += millis(from);
+    }
+    std::cout << name << ": generate " << generate / repeat << " ms, upload " << upload / repeat << " ms, total "
+              << (generate + upload) / repeat << " ms" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    // GLFW を初期化する
+    if (glfwInit() == GL_FALSE) {
+        // 初期化に失敗した
+        std::cerr << "Can't initialize GLFW" << std::endl;
+        return 1;
+    }
+
+    // プログラム終了時の処理を登録する
+    atexit(glfwTerminate);
+
+    // OpenGL Version 4.1 Core Profile を選択する
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    // ウィンドウは表示しない
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    Window window;
+    std::cout << "renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+    // 画像を用意する
+    GLsizei width(2048), height(2048);
+    std::vector<GLubyte> pixels;
+    if (argc > 1) {
+        int w, h, channels;
+        stbi_uc *const data(stbi_load(argv[1], &w, &h, &channels, STBI_rgb_alpha));
+        if (data == nullptr) {
+            std::cerr << "Failed to load texture: " << argv[1] << std::endl;
+            return 1;
+        }
+        width = w;
+        height = h;
+        pixels.assign(data, data + static_cast<std::size_t>(w) * h * 4);
+        stbi_image_free(data);
+    }
+    else {
+        std::mt19937 random(1);
+        pixels.resize(static_cast<std::size_t>(width) * height * 4);
+        for (auto &p : pixels) p = static_cast<GLubyte>(random());
+    }
+    const int repeat(argc > 2 ? std::atoi(argv[2]) : 10);
+    std::cout << "image: " << width << "x" << height << ", " << MipGenerator::levelCount(width, height) << " levels" << std::endl;
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    // glGenerateMipmap()
+    {
+        double upload(0.0), generate(0.0);
+        for (int i = 0; i < repeat; ++i) {
+            auto from(std::chrono::steady_clock::now());
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            glFinish();
+            upload += millis(from);
+
+            from = std::chrono::steady_clock::now();
+            glGenerateMipmap(GL_TEXTURE_2D);
+            glFinish();
+            generate += millis(from);
+        }
+        std::cout << "glGenerateMipmap: upload " << upload / repeat << " ms, generate " << generate / repeat << " ms, total "
+                  << (upload + generate) / repeat << " ms" << std::endl;
+    }
+
+    // CPUで作る
+    MipGenerator::Options options;
+    measure("box", pixels, width, height, options, texture, repeat);
+    options.srgb = true;
+    measure("box sRGB", pixels, width, height, options, texture, repeat);
+    options.alpha_coverage = true;
+    measure("box sRGB + alpha coverage", pixels, width, height, options, texture, repeat);
+    options = MipGenerator::Options();
+    options.filter = MipGenerator::kaiser;
+    measure("kaiser", pixels, width, height, options, texture, repeat);
+    options.srgb = true;
+    measure("kaiser sRGB", pixels, width, height, options, texture, repeat);
+
+    // ワーカースレッドで並べて作る
+    {
+        const unsigned int threads(std::max(1u, std::thread::hardware_concurrency()));
+        const auto from(std::chrono::steady_clock::now());
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; ++t)
+            workers.emplace_back([&] {
+                MipGenerator::Options o;
+                o.srgb = true;
+                for (int i = 0; i < repeat; ++i) MipGenerator::generate(pixels.data(), width, height, 4, o);
+            });
+        for (auto &worker : workers) worker.join();
+        std::cout << "box sRGB on " << threads << " threads: " << millis(from) / (threads * repeat) << " ms/image" << std::endl;
+    }
+
+    glDeleteTextures(1, &texture);
+    return 0;
+}
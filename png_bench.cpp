@@ -0,0 +1,114 @@
+/*
+ * @file png_bench.cpp
+ * @brief PngDecoder と stb_image のPNGのデコードの速度を比べる
+ * @detail 指定したPNGファイルそれぞれについて、stbi_load_from_memory() と PngDecoder::loadFromMemory() で
+ *         デコードする時間を測り、画素が同じことを確かめる
+ *         すべてのファイルを ImageDecoder::loadAll() で1スレッドと複数スレッドでデコードする時間も測る
+ *         OpenGLのコンテキストは使わない
+ *             png_bench [-r 回数] [-t スレッド数] ファイル...
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#define STB_IMAGE_IMPLEMENTATION
+#include "ImageDecoder.h"
+
+// 経過時間 [ms]
+static double millis(std::chrono::steady_clock::time_point from) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+}
+
+int main(int argc, char *argv[]) {
+    // 引数を読む
+    int repeat(10);
+    unsigned int threads(0);
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "-r" && i + 1 < argc) repeat = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-t" && i + 1 < argc) threads = static_cast<unsigned int>(std::atoi(argv[++i]));
+        else files.push_back(arg);
+    }
+    if (files.empty()) {
+        std::cerr << "usage: png_bench [-r repeat] [-t threads] file.png..." << std::endl;
+        return 1;
+    }
+
+    bool ok(true);
+    double total_stb(0.0), total_fast(0.0);
+    for (const auto &path : files) {
+        std::ifstream file(path, std::ios::binary);
+        const std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (data.empty()) {
+            std::cerr << "Can't read " << path << std::endl;
+            ok = false;
+            continue;
+        }
+        const int size(static_cast<int>(data.size()));
+
+        // stb_image
+        int width(0), height(0), channels(0);
+        stbi_uc *expected(nullptr);
+        auto from(std::chrono::steady_clock::now());
+        for (int i = 0; i < repeat; ++i) {
+            stbi_image_free(expected);
+            expected = stbi_load_from_memory(data.data(), size, &width, &height, &channels, 0);
+        }
+        const double stb(millis(from) / repeat);
+        if (expected == nullptr) {
+            std::cerr << path << ": stb_image failed (" << stbi_failure_reason() << ")" << std::endl;
+            ok = false;
+            continue;
+        }
+
+        // PngDecoder
+        int fast_width(0), fast_height(0), fast_channels(0);
+        unsigned char *pixels(nullptr);
+        from = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeat; ++i) {
+            std::free(pixels);
+            pixels = PngDecoder::loadFromMemory(data.data(), size, &fast_width, &fast_height, &fast_channels, 0);
+        }
+        const double fast(millis(from) / repeat);
+        if (pixels == nullptr) {
+            std::cout << path << ": " << width << "x" << height << "x" << channels << ", stb_image " << stb
+                      << " ms, PngDecoder does not support it (" << PngDecoder::failureReason() << ")" << std::endl;
+            stbi_image_free(expected);
+            continue;
+        }
+
+        const bool same(fast_width == width && fast_height == height && fast_channels == channels
+                        && std::memcmp(pixels, expected, static_cast<std::size_t>(width) * height * channels) == 0);
+        const double megapixels(static_cast<double>(width) * height / 1.0e6);
+        std::cout << path << ": " << width << "x" << height << "x" << channels << ", stb_image " << stb << " ms ("
+                  << megapixels / stb * 1000.0 << " Mpixels/s), PngDecoder " << fast << " ms ("
+                  << megapixels / fast * 1000.0 << " Mpixels/s), x" << stb / fast << (same ? "" : " MISMATCH") << std::endl;
+        if (!same) ok = false;
+        total_stb += stb;
+        total_fast += fast;
+        std::free(pixels);
+        stbi_image_free(expected);
+    }
+    if (total_fast > 0.0) std::cout << "total: stb_image " << total_stb << " ms, PngDecoder " << total_fast << " ms, x"
+                                    << total_stb / total_fast << std::endl;
+
+    // 独立した画像をスレッドに分けてデコードする
+    std::vector<std::string> batch;
+    for (int i = 0; i < repeat; ++i) batch.insert(batch.end(), files.begin(), files.end());
+    auto from(std::chrono::steady_clock::now());
+    ImageDecoder::loadAll(batch, ImageDecoder::Options(), 1);
+    const double single(millis(from));
+    from = std::chrono::steady_clock::now();
+    ImageDecoder::loadAll(batch, ImageDecoder::Options(), threads);
+    const double parallel(millis(from));
+    std::cout << "ImageDecoder::loadAll (" << batch.size() << " images): 1 thread " << single << " ms, "
+              << (threads != 0 ? threads : std::thread::hardware_concurrency()) << " threads " << parallel << " ms, x"
+              << single / parallel << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,158 @@
+/*
+ * @file quantize_bench.cpp
+ * @brief 頂点の量子化の効果を測る
+ * @detail 頂点1つあたりのバイト数と量子化にかかる時間 (CPU) と、頂点データを glBufferSubData() で転送して
+ *         全部の頂点を描画するのにかかるGPUの時間 (GL_TIME_ELAPSED のタイマークエリ) を量子化前と後で比較する
+ *         ラスタライズは止めるので、測る時間は転送と頂点の読み込みとバーテックスシェーダの分になる
+ *         ウィンドウは表示しない (llvmpipe などのソフトウェアのドライバでも動くが、GPUの帯域の差は出ない)
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "Quantize.h"
+#include "ShaderCompiler.h"
+#include "Window.h"
+#include <GLFW/glfw3.h>
+
+// 経過時間 [s]
+static double seconds(std::chrono::steady_clock::time_point from) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - from).count();
+}
+
+// 量子化前と後のどちらの頂点も読み込むシェーダ (正規化した整数の属性も float で受け取る)
+static const char vsrc[] =
+        "#version 410 core\n"
+        "in vec2 position;\n"
+        "in vec4 color;\n"
+        "in vec2 coord;\n"
+        "out vec4 vertexColor;\n"
+        "void main() {\n"
+        "  vertexColor = color * vec4(coord, 1.0, 1.0);\n"
+        "  gl_Position = vec4(position, 0.0, 1.0);\n"
+        "}\n";
+static const char fsrc[] =
+        "#version 410 core\n"
+        "in vec4 vertexColor;\n"
+        "out vec4 fragment;\n"
+        "void main() {\n"
+        "  fragment = vertexColor;\n"
+        "}\n";
+
+/*
+ * @fn
+ * 頂点データを転送して描画するGPUの時間を測る
+ * @param vertex 頂点属性を格納した配列
+ * @param count 頂点の数
+ * @param repeat 繰り返す回数
+ * @return 1回あたりのGPUの時間 [ms]
+ */
+template <typename V>
+static double measure(const V *vertex, GLsizei count, int repeat) {
+    GLuint vao, vbo, query;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    const GLsizeiptr bytes(static_cast<GLsizeiptr>(count) * sizeof(V));
+    glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+    V::Format::setup();
+    glGenQueries(1, &query);
+
+    // 1回目はドライバの準備の時間が入るので測らない
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, vertex);
+    glDrawArrays(GL_POINTS, 0, count);
+    glFinish();
+
+    GLuint64 total(0);
+    for (int i = 0; i < repeat; ++i) {
+        glBeginQuery(GL_TIME_ELAPSED, query);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, vertex);
+        glDrawArrays(GL_POINTS, 0, count);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        // 結果が出るまで待つ [ns]
+        GLuint64 elapsed(0);
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        total += elapsed;
+    }
+
+    glDeleteQueries(1, &query);
+    glBindVertexArray(0);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    return static_cast<double>(total) / repeat / 1.0e6;
+}
+
+int main(int argc, char *argv[]) {
+    // 頂点の数
+    const GLsizei count(argc > 1 ? std::atoi(argv[1]) : 1 << 20);
+    const int repeat(argc > 2 ? std::atoi(argv[2]) : 20);
+
+    // GLFW を初期化する
+    if (glfwInit() == GL_FALSE) {
+        // 初期化に失敗した
+        std::cerr << "Can't initialize GLFW" << std::endl;
+        return 1;
+    }
+
+    // プログラム終了時の処理を登録する
+    atexit(glfwTerminate);
+
+    // OpenGL Version 4.1 Core Profile を選択する
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+    // ウィンドウは表示しない
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    Window window;
+    std::cout << "renderer: " << glGetString(GL_RENDERER) << std::endl;
+
+    // 乱数で頂点を作る
+    std::mt19937 random(1);
+    std::uniform_real_distribution<GLfloat> position(-1.0f, 1.0f), unit(0.0f, 1.0f);
+    std::vector<Object::Vertex_Textrue> vertex(count);
+    for (auto &v : vertex) {
+        GLfloat *const p(v.position_color_coord);
+        p[0] = position(random);
+        p[1] = position(random);
+        for (int k = 2; k < 7; ++k) p[k] = unit(random);
+    }
+
+    // 量子化する
+    const auto from(std::chrono::steady_clock::now());
+    const auto mesh(quantize(count, vertex.data()));
+    const double quantizeSeconds(seconds(from));
+
+    // 同じシェーダで量子化前と後の頂点を描く
+    ShaderCompiler compiler;
+    compiler.add("quantize_bench", vsrc, fsrc, std::vector<std::string>{ "position", "color", "coord" }, "fragment");
+    if (!compiler.finish()) return 1;
+    const GLuint program(compiler.release(0));
+    glUseProgram(program);
+    glEnable(GL_RASTERIZER_DISCARD);
+    const double beforeMillis(measure(vertex.data(), count, repeat));
+    const double afterMillis(measure(mesh.vertex.data(), count, repeat));
+    glDisable(GL_RASTERIZER_DISCARD);
+    glUseProgram(0);
+    glDeleteProgram(program);
+
+    const std::size_t before(count * sizeof(Object::Vertex_Textrue));
+    const std::size_t after(mesh.vertex.size() * sizeof(Quantized_Vertex_Textrue));
+    std::cout << "vertices: " << count << std::endl;
+    std::cout << "bytes per vertex: " << sizeof(Object::Vertex_Textrue) << " -> " << sizeof(Quantized_Vertex_Textrue)
+              << " (" << 100.0 * after / before << "%)" << std::endl;
+    std::cout << "total bytes: " << before << " -> " << after << std::endl;
+    std::cout << "quantize (CPU): " << quantizeSeconds * 1000.0 << " ms ("
+              << count / quantizeSeconds / 1.0e6 << " Mvertices/s)" << std::endl;
+    std::cout << "upload + draw (GPU): " << beforeMillis << " ms -> " << afterMillis << " ms ("
+              << before / beforeMillis / 1.0e6 << " GB/s -> " << after / afterMillis / 1.0e6 << " GB/s)" << std::endl;
+    std::cout << "max error: position " << mesh.error[0] << ", color " << mesh.error[1]
+              << ", texture coordinate " << mesh.error[2] << std::endl;
+    return 0;
+}
@@ -4,6 +4,10 @@
 #include <iostream>
 #include "Texture.h"
 #include "Window.h"
+#include "ProgramCache.h"
+#include "ProgramValidator.h"
+#include "ShaderPreprocessor.h"
+#include "ShaderProgram.h"
 //#include "include/glad/glad.h"
 #include <GLFW/glfw3.h>
 #include <cmath>
@@ -133,6 +137,8 @@ GLuint createProgram(const char *vsrc, const char *fsrc) {
     glBindAttribLocation(program, 1, "aColor");
     glBindAttribLocation(program, 2, "aTexCoord");
     glBindFragDataLocation(program, 0, "FragColor");
+    // プログラムバイナリをキャッシュできるようにする
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(program);
 
     // 作成したプログラムオブジェクトを返す
@@ -148,42 +154,18 @@ GLuint createProgram(const char *vsrc, const char *fsrc) {
  * @fn
  * シェーダのソースファイルを読み込んだメモリを返す
  * @param name シェーダのソースファイル名
- * @param buffer 読み込んだソースファイルのテキスト
+ * @param buffer 読み込んだソースファイルのテキスト (#include は展開する)
  * @return 読み込み成功時のみtrueを返す
  */
 bool readShaderSource(const char *name, std::vector<GLchar> &buffer) {
     // ファイル名がNULLだった
     if (name == nullptr) return false;
 
-    // ソースファイルを開く
-    std::ifstream file(name, std::ios::binary);
-    if (file.fail()) {
-        // 開けなかった
-        std::cerr << "Error: Can't open source file: " << name << std::endl;
-        return false;
-    }
-
-    // ファイルの末尾に移動し現在位置(=ファイルサイズ)を得る
-    file.seekg(0L, std::ios::end);
-    auto length = static_cast<GLsizei>(file.tellg());
-
-    // ファイルサイズのメモリを確保
-    buffer.resize(length + 1);
-
-    // ファイルを先頭から読み込む
-    file.seekg(0L, std::ios::beg);
-    file.read(buffer.data(), length);
-    buffer[length] = '\0';
-
-    if (file.fail()) {
-        // うまく読み込めなかった
-        std::cerr << "Error; Could not read source file: " << name << std::endl;
-        file.close();
-        return false;
-    }
-
-    // 読み込み成功
-    file.close();
+    // ソースファイルを読み込んで #include を展開する
+    std::string source;
+    if (!ShaderPreprocessor::load(name, source)) return false;
+    buffer.assign(source.begin(), source.end());
+    buffer.push_back('\0');
     return true;
 }
 
@@ -192,17 +174,26 @@ bool readShaderSource(const char *name, std::vector<GLchar> &buffer) {
  * シェーダのソースファイルを読み込んでプログラムオブジェクトを作成する
  * @param vert バーテックスシェーダのソースファイル名
  * @param frag フラグメントシェーダのソースファイル名
+ * @param cache プログラムバイナリのキャッシュ
  * @return エラーならば0を返す
  */
-GLuint loadProgram(const char *vert, const char *frag) {
+GLuint loadProgram(const char *vert, const char *frag, ProgramCache &cache) {
     // シェーダのソースファイルを読み込む
     std::vector<GLchar> vsrc;
     const bool vstat(readShaderSource(vert, vsrc));
     std::vector<GLchar> fsrc;
     const bool fstat(readShaderSource(frag, fsrc));
+    if (!vstat || !fstat) return 0;
 
-    // プログラムオブジェクトを作成する
-    return vstat && fstat ? createProgram(vsrc.data(), fsrc.data()) : 0;
+    // ソースとcreateProgram()で設定する変数の場所が同じならキャッシュのバイナリを使う
+    const std::string key(cache.key(vsrc.data(), fsrc.data(), "position=0;aColor=1;aTexCoord=2;FragColor=0"));
+    const GLuint cached(cache.load(key));
+    if (cached != 0) return cached;
+
+    // プログラムオブジェクトを作成してキャッシュに保存する
+    const GLuint program(createProgram(vsrc.data(), fsrc.data()));
+    cache.store(key, program);
+    return program;
 }
 
 // 矩形の頂点の位置
@@ -243,17 +234,25 @@ int main(int argc, char * argv[]) {
     // 背景色を指定する
     glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 
+    // プログラムバイナリのキャッシュを用意する
+    ProgramCache cache;
+
     // プログラムオブジェクトを作成する
-    const GLuint program(loadProgram("texture.vert", "texture.frag"));
+    const GLuint program(loadProgram("texture.vert", "texture.frag", cache));
+    cache.printStatistics();
+
+    // プログラムオブジェクトの検証は状態が変わったときだけ行う
+    ProgramValidator validator(printValidateInfoLog);
 
-    // プログラムオブジェクトからuniform変数の場所を取得する
-    const GLint sizeLoc(glGetUniformLocation(program, "size"));
-    const GLint scaleLoc(glGetUniformLocation(program, "scale"));
-    const GLint locationLoc(glGetUniformLocation(program, "location"));
+    // プログラムオブジェクトのuniform変数を調べて、名前を番号にしておく
+    ShaderProgram uniforms(program);
+    const ShaderProgram::Name sizeName(ShaderProgram::intern("size"));
+    const ShaderProgram::Name scaleName(ShaderProgram::intern("scale"));
+    const ShaderProgram::Name locationName(ShaderProgram::intern("location"));
 //    const GLint textureLoc(glGetUniformLocation(program, "ourTexture"));
 
     // 図形データを作成する
-    std::unique_ptr<const Texture> texture(new Texture(2, 4, rectangleVertex, indicaces));
+    std::unique_ptr<const Texture> texture(new Texture(2, 4, rectangleVertex, indicaces, 6));
 
     // このPCの最大vertex attribute数
     int nrAttributes;
@@ -269,14 +268,16 @@ int main(int argc, char * argv[]) {
         glUseProgram(program);
 
         // uniform変数に値を設定する
-        glUniform2fv(sizeLoc, 1, window.getSize());
-        glUniform1f(scaleLoc, window.getScale());
-        glUniform2fv(locationLoc, 1, window.getLocation());
+        uniforms.set(sizeName, window.getSize());
+        uniforms.set(scaleName, window.getScale());
+        uniforms.set(locationName, window.getLocation());
 
         // ここで描画処理を行う
         // 図形を描画する
-        if (printValidateInfoLog(program))
-            texture->draw();
+        texture->draw(validator, program);
+
+        // フレームの終わりを通知する
+        validator.frame();
 
         // カラーバッファを入れ替えて、イベントを取り出す
         window.swapBuffers();
@@ -0,0 +1,169 @@
+/*
+ * @file texture_compress.cpp
+ * @brief 画像をブロック圧縮したテクスチャのファイルを作る
+ * @detail stb_image で読み込んだ画像のミップマップを MipGenerator で作り、各レベルを BC1/BC3/BC7 で圧縮して
+ *         (raw なら圧縮せずに) TextureFile の形式で書き出す OpenGLのコンテキストは使わない
+ *         stb_image が読めるどの形式の画像からも、実行時にデコードせずにマップして転送できるファイルを作れる
+ *             texture_compress [-f bc1|bc3|bc7|raw] [-c 1-4] [-q] [-s] [-n] [--verify] [--min-psnr dB] 入力 出力
+ *                 -f 圧縮形式 (省略時は bc7, raw は圧縮しない)
+ *                 -c raw のときのチャンネル数 (省略時はファイルのまま)
+ *                 -q 品質モード (遅い)
+ *                 -s 色をsRGBとして扱う
+ *                 -n ミップマップを作らない
+ *                 --verify 書き出したファイルを読み直してCPUでデコードし、元の画像とのPSNRを表示する
+ *                 --min-psnr --verify でこれより低いレベルがあれば失敗にする
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "BlockCompression.h"
+#include "MipGenerator.h"
+#include "PixelFormat.h"
+#include "TextureFile.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+/*
+ * @fn
+ * 2つの画像のPSNRを求める
+ * @param a 画素
+ * @param b 画素
+ * @param count 画素の値の数 (画素の数 x チャンネル数)
+ * @return PSNR [dB] (同じなら99)
+ */
+static double psnr(const GLubyte *a, const GLubyte *b, std::size_t count) {
+    double error(0.0);
+    for (std::size_t i = 0; i < count; ++i) {
+        const double d(static_cast<double>(a[i]) - b[i]);
+        error += d * d;
+    }
+    error /= count;
+    return error > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / error) : 99.0;
+}
+
+// 使い方を表示する
+static int usage() {
+    std::cerr << "usage: texture_compress [-f bc1|bc3|bc7|raw] [-c 1-4] [-q] [-s] [-n] [--verify] [--min-psnr dB] input output" << std::endl;
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    // 引数を読む
+    // 圧縮形式 (0なら圧縮しない)
+    int format(BlockCompression::bc7), requested(0);
+    bool quality(false), srgb(false), mipmap(true), verify(false);
+    double minimum(0.0);
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg(argv[i]);
+        if (arg == "-f" && i + 1 < argc) {
+            const std::string name(argv[++i]);
+            if (name == "bc1") format = BlockCompression::bc1;
+            else if (name == "bc3") format = BlockCompression::bc3;
+            else if (name == "bc7") format = BlockCompression::bc7;
+            else if (name == "raw") format = 0;
+            else return usage();
+        }
+        else if (arg == "-c" && i + 1 < argc) {
+            requested = std::atoi(argv[++i]);
+            if (requested < 1 || requested > 4) return usage();
+        }
+        else if (arg == "-q") quality = true;
+        else if (arg == "-s") srgb = true;
+        else if (arg == "-n") mipmap = false;
+        else if (arg == "--verify") verify = true;
+        else if (arg == "--min-psnr" && i + 1 < argc) minimum = std::atof(argv[++i]);
+        else files.push_back(arg);
+    }
+    if (files.size() != 2) return usage();
+
+    // 画像を読み込んでミップマップを作る (圧縮するときは RGBA にする)
+    int width, height, channels;
+    const int wanted(format != 0 ? STBI_rgb_alpha : requested);
+    stbi_uc *const pixels(stbi_load(files[0].c_str(), &width, &height, &channels, wanted));
+    if (pixels == nullptr) {
+        std::cerr << "Failed to load texture: " << files[0] << std::endl;
+        return 1;
+    }
+    if (wanted != 0) channels = wanted;
+    MipGenerator::Options options;
+    options.srgb = srgb;
+    MipGenerator::Chain chain(MipGenerator::generate(pixels, width, height, channels, options));
+    stbi_image_free(pixels);
+    if (!mipmap) chain.levels.resize(1);
+
+    // 各レベルを圧縮する
+    const auto from(std::chrono::steady_clock::now());
+    std::vector<std::vector<GLubyte>> data;
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> size;
+    std::size_t before(0), after(0);
+    for (const auto &level : chain.levels) {
+        if (format != 0)
+            data.push_back(BlockCompression::encode(static_cast<BlockCompression::Format>(format), level.pixels.data(),
+                                                    level.width, level.height, quality));
+        else
+            data.push_back(level.pixels);
+        size.push_back(std::make_pair(static_cast<std::uint32_t>(level.width), static_cast<std::uint32_t>(level.height)));
+        before += level.pixels.size();
+        after += data.back().size();
+    }
+    const double seconds(std::chrono::duration<double>(std::chrono::steady_clock::now() - from).count());
+
+    TextureFile::Header header;
+    std::memset(&header, 0, sizeof header);
+    if (format != 0) {
+        header.internal_format = BlockCompression::internalFormat(static_cast<BlockCompression::Format>(format), srgb);
+    }
+    else {
+        // 圧縮しないものはチャンネル数のまま転送できる形式にする
+        const PixelFormat pixel(PixelFormat::fromChannels(channels, width, srgb));
+        header.internal_format = static_cast<std::uint32_t>(pixel.internal_format);
+        header.format = pixel.format;
+        header.type = GL_UNSIGNED_BYTE;
+    }
+    header.width = static_cast<std::uint32_t>(width);
+    header.height = static_cast<std::uint32_t>(height);
+    header.compression = static_cast<std::uint32_t>(format);
+    header.channels = static_cast<std::uint32_t>(channels);
+    header.srgb = srgb ? 1 : 0;
+    if (!TextureFile::save(files[1], header, data, size)) return 1;
+
+    std::cout << files[0] << ": " << width << "x" << height << ", " << chain.levels.size() << " levels, "
+              << before << " -> " << after << " bytes, " << seconds * 1000.0 << " ms ("
+              << before / channels / seconds / 1.0e6 << " Mpixels/s)" << std::endl;
+    if (!verify) return 0;
+
+    // 書き出したファイルを読み直してデコードし、元の画像と比べる
+    TextureFile file;
+    if (!file.load(files[1]) || file.getLevelCount() != chain.levels.size()) {
+        std::cerr << "Verify failed: can't read back " << files[1] << std::endl;
+        return 1;
+    }
+    bool ok(true);
+    for (std::size_t i = 0; i < chain.levels.size(); ++i) {
+        const MipGenerator::Level &level(chain.levels[i]);
+        const TextureFile::Level &entry(file.getLevel(i));
+        if (entry.width != static_cast<std::uint32_t>(level.width) || entry.height != static_cast<std::uint32_t>(level.height)
+            || entry.size != data[i].size() || std::memcmp(file.getData(i), data[i].data(), data[i].size()) != 0) {
+            std::cerr << "Verify failed: level " << i << " differs from what was written" << std::endl;
+            return 1;
+        }
+        std::vector<GLubyte> decoded(level.pixels.size());
+        if (format == 0) std::memcpy(decoded.data(), file.getData(i), decoded.size());
+        else if (!BlockCompression::decode(static_cast<BlockCompression::Format>(format), file.getData(i),
+                                                     level.width, level.height, decoded.data())) {
+            std::cerr << "Verify failed: level " << i << " has blocks the decoder does not support" << std::endl;
+            return 1;
+        }
+        const double quality_db(psnr(level.pixels.data(), decoded.data(), level.pixels.size()));
+        std::cout << "level " << i << " (" << level.width << "x" << level.height << "): PSNR " << quality_db << " dB" << std::endl;
+        if (quality_db < minimum) ok = false;
+    }
+    if (!ok) std::cerr << "Verify failed: PSNR is below " << minimum << " dB" << std::endl;
+    return ok ? 0 : 1;
+}